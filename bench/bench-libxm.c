@@ -0,0 +1,170 @@
+/* This program is free software. It comes without any warranty, to the
+ * extent permitted by applicable law. You can redistribute it and/or
+ * modify it under the terms of the Do What The Fuck You Want To Public
+ * License, Version 2, as published by Sam Hocevar. See
+ * http://sam.zoy.org/wtfpl/COPYING for more details. */
+
+/* Measure the time spent in each stage of loading and playing modules.
+ * Prints one line per module, as tab separated values with a header line. */
+
+#include <xm.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifndef BENCH_VARIANT
+#define BENCH_VARIANT "default"
+#endif
+
+#define RENDER_CHUNK 1024
+
+/* Every stage is repeated until it has run for at least this long, and the
+   average time is kept */
+static double min_stage_time = .1;
+static uint32_t rate = 48000;
+static uint32_t max_seconds = 300;
+
+static double now(void) {
+	struct timespec ts;
+	#ifdef TIME_MONOTONIC
+	timespec_get(&ts, TIME_MONOTONIC);
+	#else
+	timespec_get(&ts, TIME_UTC);
+	#endif
+	return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+/* Run code until min_stage_time has elapsed, and store the average time of
+   one run (in seconds) in result. The clock is only checked every batch
+   runs, so that it doesn't skew timings of very fast stages. */
+#define MEASURE(result, batch, ...) do {                                \
+		uint32_t runs_ = 0;                                     \
+		double start_ = now(), elapsed_;                        \
+		do {                                                    \
+			for(uint8_t i_ = 0; i_ < (batch); ++i_) {       \
+				__VA_ARGS__;                            \
+			}                                               \
+			runs_ += (batch);                               \
+		} while((elapsed_ = now() - start_) < min_stage_time);  \
+		(result) = elapsed_ / runs_;                            \
+	} while(0)
+
+static char* read_file(const char* path, uint32_t* length) {
+	FILE* f = fopen(path, "rb");
+	if(f == NULL) {
+		perror(path);
+		return NULL;
+	}
+	char* data = NULL;
+	long l;
+	if(fseek(f, 0, SEEK_END) || (l = ftell(f)) < 0 || l > UINT32_MAX) {
+		goto end;
+	}
+	rewind(f);
+	data = malloc((size_t)l + 1);
+	if(data != NULL && l > 0 && fread(data, (size_t)l, 1, f) != 1) {
+		free(data);
+		data = NULL;
+	}
+	*length = (uint32_t)l;
+ end:
+	fclose(f);
+	return data;
+}
+
+/* @returns the number of frames until the module loops, up to max_seconds
+   worth of frames */
+static uint32_t render(xm_context_t* ctx) {
+	static float out[2 * RENDER_CHUNK];
+	const uint32_t max_frames = max_seconds * rate;
+	uint32_t frames = 0;
+	xm_set_max_loop_count(ctx, 1);
+	while(frames < max_frames && !xm_get_loop_count(ctx)) {
+		xm_generate_samples(ctx, out, RENDER_CHUNK);
+		frames += RENDER_CHUNK;
+	}
+	return frames;
+}
+
+static int bench(const char* path) {
+	uint32_t length;
+	char* data = read_file(path, &length);
+	if(data == NULL) return 1;
+
+	xm_prescan_data_t* p = malloc(XM_PRESCAN_DATA_SIZE);
+	if(p == NULL || !xm_prescan_module(data, length, p)) {
+		fprintf(stderr, "%s: xm_prescan_module() failed\n", path);
+		return 1;
+	}
+	uint32_t ctx_size = xm_size_for_context(p);
+	char* pool = malloc(ctx_size);
+	char* libxm = malloc(ctx_size);
+	char* copy = malloc(ctx_size);
+	if(pool == NULL || libxm == NULL || copy == NULL) return 1;
+
+	double prescan, load, to_libxm, from_libxm, copy_time, render_time;
+	xm_context_t* ctx = nullptr;
+	uint32_t frames = 0;
+	MEASURE(prescan, 16, if(!xm_prescan_module(data, length, p)) return 1);
+	MEASURE(load, 16, ctx = xm_create_context(pool, p, data, length, rate));
+	MEASURE(to_libxm, 16, xm_context_to_libxm(ctx, libxm));
+	/* xm_create_context_from_libxm() modifies its input, so it has to be
+	   copied every time, don't count the copy */
+	MEASURE(copy_time, 16, memcpy(copy, libxm, ctx_size));
+	MEASURE(from_libxm, 16,
+	        memcpy(copy, libxm, ctx_size);
+	        ctx = xm_create_context_from_libxm(copy, rate));
+	from_libxm -= copy_time;
+	MEASURE(render_time, 1,
+	        memcpy(copy, libxm, ctx_size);
+	        ctx = xm_create_context_from_libxm(copy, rate);
+	        frames = render(ctx));
+
+	uint8_t channels = xm_get_number_of_channels(ctx);
+	const char* name = strrchr(path, '/');
+	printf("%s\t%s\t%u\t%u\t%.0f\t%.0f\t%.0f\t%.0f\t%u\t%.0f\t%.3f\n",
+	       BENCH_VARIANT, name ? name + 1 : path, channels, ctx_size,
+	       prescan * 1e9, load * 1e9, to_libxm * 1e9, from_libxm * 1e9,
+	       frames, (double)frames / render_time,
+	       render_time * 1e9 / ((double)frames * channels));
+	fflush(stdout);
+
+	free(copy);
+	free(libxm);
+	free(pool);
+	free(p);
+	free(data);
+	return 0;
+}
+
+int main(int argc, char** argv) {
+	int i = 1;
+	for(; i < argc && !strncmp(argv[i], "--", 2); i += 2) {
+		if(i + 1 >= argc) goto usage;
+		if(!strcmp(argv[i], "--rate")) {
+			rate = (uint32_t)strtoul(argv[i + 1], NULL, 10);
+		} else if(!strcmp(argv[i], "--max-seconds")) {
+			max_seconds = (uint32_t)strtoul(argv[i + 1], NULL, 10);
+		} else if(!strcmp(argv[i], "--min-stage-time")) {
+			min_stage_time = strtod(argv[i + 1], NULL);
+		} else {
+			goto usage;
+		}
+	}
+	if(i == argc || rate == 0) goto usage;
+
+	printf("variant\tmodule\tchannels\tcontext_bytes\tprescan_ns\tload_ns"
+	       "\tto_libxm_ns\tfrom_libxm_ns\tframes\tframes_per_s"
+	       "\tns_per_channel_frame\n");
+	int ret = 0;
+	for(; i < argc; ++i) {
+		if(bench(argv[i])) ret = 1;
+	}
+	return ret;
+
+ usage:
+	fprintf(stderr, "Usage: %s [--rate <hz>] [--max-seconds <s>] "
+	        "[--min-stage-time <s>] <file.xm>...\n", argv[0]);
+	return 1;
+}
@@ -0,0 +1,37 @@
+#!/bin/sh
+# Run bench-libxm for a matrix of build variants, and print all results as
+# a single tab separated table on standard output.
+#
+# Usage: bench/bench-matrix.sh [extra modules...]
+#
+# Set BUILD_DIR to choose where variants are built (default: build-bench),
+# and BENCH_ARGS to pass options to bench-libxm (eg "--max-seconds 60").
+
+set -e
+SRC_DIR=$(cd "$(dirname "$0")" && pwd)
+BUILD_DIR=${BUILD_DIR:-build-bench}
+
+header=1
+for lerp in ON OFF; do
+for ramp in ON OFF; do
+for type in int8_t int16_t float; do
+for bits in 8 12; do
+	variant="lerp$lerp-ramp$ramp-$type-$bits"
+	delta=ON
+	[ "$type" = float ] && delta=OFF
+	cmake -S "$SRC_DIR" -B "$BUILD_DIR/$variant" \
+	      -DCMAKE_BUILD_TYPE=Release \
+	      -DXM_LINEAR_INTERPOLATION=$lerp -DXM_RAMPING=$ramp \
+	      -DXM_SAMPLE_TYPE=$type -DXM_MICROSTEP_BITS=$bits \
+	      -DXM_LIBXM_DELTA_SAMPLES=$delta >/dev/null
+	cmake --build "$BUILD_DIR/$variant" --target bench-libxm >/dev/null
+	# shellcheck disable=SC2086
+	"$BUILD_DIR/$variant/bench-libxm" $BENCH_ARGS \
+	    "$SRC_DIR"/../tests/*.xm \
+	    "$SRC_DIR"/../examples/xmprocdemo/mus.xm "$@" \
+	    | if [ $header = 1 ]; then cat; else tail -n +2; fi
+	header=0
+done
+done
+done
+done
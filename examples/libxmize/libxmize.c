@@ -28,6 +28,7 @@ static void zero_waveforms(xm_context_t* ctx) {
 			if(sample_data == NULL) continue;
 			memset(sample_data, 0, sample_length
 			       * sizeof(xm_sample_point_t));
+			xm_update_sample_waveform(ctx, i, s);
 			total_zeroed_bytes += sample_length
 				* (uint32_t)sizeof(xm_sample_point_t);
 		}
@@ -53,8 +54,21 @@ static void zero_waveforms(xm_context_t* ctx) {
 /* } */
 
 int main(int argc, char** argv) {
-	if(argc < 2) {
-		NOTICE("Usage: %s [--zero-all-waveforms] <in.xm>", argv[0]);
+	bool zero = false, mappable = false;
+	int i = 1;
+	for(; i < argc - 1; ++i) {
+		if(!strcmp("--zero-all-waveforms", argv[i])) {
+			zero = true;
+		} else if(!strcmp("--mappable", argv[i])) {
+			mappable = true;
+		} else {
+			break;
+		}
+	}
+	if(i != argc - 1) {
+		NOTICE("Usage: %s [--zero-all-waveforms] [--mappable] <in.xm>\n"
+		       "\t--mappable: write data for "
+		       "xm_create_context_from_mappable_libxm()", argv[0]);
 		exit(1);
 	}
 
@@ -104,11 +118,15 @@ int main(int argc, char** argv) {
 	                                      (uint32_t)in_length, 48000);
 	//analyze(argv[0], ctx);
 
-	if(!strcmp("--zero-all-waveforms", argv[1])) {
+	if(zero) {
 		zero_waveforms(ctx);
 	}
 
-	xm_context_to_libxm(ctx, libxmized);
+	if(mappable) {
+		xm_context_to_mappable_libxm(ctx, libxmized);
+	} else {
+		xm_context_to_libxm(ctx, libxmized);
+	}
 
 	if(!fwrite(libxmized, ctx_size, 1, stdout)) {
 		perror("fwrite");
@@ -0,0 +1,152 @@
+/* This program is free software. It comes without any warranty, to the
+ * extent permitted by applicable law. You can redistribute it and/or
+ * modify it under the terms of the Do What The Fuck You Want To Public
+ * License, Version 2, as published by Sam Hocevar. See
+ * http://sam.zoy.org/wtfpl/COPYING for more details. */
+
+/* Load many modules, with sample data decoded by several threads, print
+ * their metadata as tab separated values and optionally convert them to the
+ * libxm format. */
+
+#include <xm.h>
+#include <xm_mt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define NOTICE(fmt, ...) do {                                           \
+		fprintf(stderr, "xmbatch: " fmt "\n" __VA_OPT__(,) __VA_ARGS__); \
+		fflush(stderr); \
+	} while(0)
+
+#define RATE 48000
+
+static void usage(const char* argv0) {
+	NOTICE("Usage: %s [--threads <n>] [--libxm <dir>] <file.xm>...\n"
+	       "\t--threads: threads used to decode samples, defaults to 4\n"
+	       "\t--libxm: also write <dir>/<file>.libxm for every module",
+	       argv0);
+	exit(1);
+}
+
+static char* read_file(const char* path, uint32_t* length) {
+	FILE* f = fopen(path, "rb");
+	if(f == NULL) {
+		perror(path);
+		return NULL;
+	}
+	char* data = NULL;
+	long l;
+	if(fseek(f, 0, SEEK_END) || (l = ftell(f)) < 0 || l > UINT32_MAX) {
+		goto end;
+	}
+	rewind(f);
+	data = malloc((size_t)l + 1);
+	if(data != NULL && l > 0 && fread(data, (size_t)l, 1, f) != 1) {
+		free(data);
+		data = NULL;
+	}
+	*length = (uint32_t)l;
+ end:
+	fclose(f);
+	return data;
+}
+
+static bool write_libxm(xm_context_t* ctx, const char* dir,
+                        const char* path) {
+	const char* name = strrchr(path, '/');
+	name = name ? name + 1 : path;
+	char* out_path = malloc(strlen(dir) + strlen(name) + 8);
+	char* libxm = malloc(xm_context_size(ctx));
+	bool ok = false;
+	if(out_path == NULL || libxm == NULL) goto end;
+	sprintf(out_path, "%s/%s.libxm", dir, name);
+
+	xm_context_to_libxm(ctx, libxm);
+	FILE* f = fopen(out_path, "wb");
+	if(f == NULL) {
+		perror(out_path);
+		goto end;
+	}
+	ok = fwrite(libxm, xm_context_size(ctx), 1, f) == 1;
+	if(fclose(f)) ok = false;
+	if(!ok) perror(out_path);
+
+ end:
+	free(libxm);
+	free(out_path);
+	return ok;
+}
+
+static bool process(xm_batch_t* batch, xm_prescan_data_t* p,
+                    const char* path, const char* libxm_dir) {
+	uint32_t length;
+	char* data = read_file(path, &length);
+	if(data == NULL) return false;
+	char* pool = NULL;
+	bool ok = false;
+
+	if(!xm_prescan_module(data, length, p)) {
+		NOTICE("%s: xm_prescan_module() failed", path);
+		goto end;
+	}
+	pool = malloc(xm_size_for_context(p));
+	if(pool == NULL) {
+		perror("malloc");
+		goto end;
+	}
+	xm_context_t* ctx = xm_batch_create_context(batch, pool, p, data,
+	                                            length, RATE);
+
+	/* Before xm_analyze_timeline(), which plays the context */
+	if(libxm_dir && !write_libxm(ctx, libxm_dir, path)) goto end;
+
+	uint32_t frames = xm_analyze_timeline(ctx, NULL, 0, NULL);
+	printf("%s\t%u\t%u\t%u\t%u\t%u\t%u\t%s\n", path,
+	       xm_get_number_of_channels(ctx), xm_get_module_length(ctx),
+	       xm_get_number_of_patterns(ctx),
+	       xm_get_number_of_instruments(ctx), xm_context_size(ctx),
+	       frames, xm_get_module_name(ctx));
+	ok = true;
+
+ end:
+	free(pool);
+	free(data);
+	return ok;
+}
+
+int main(int argc, char** argv) {
+	long threads = 4;
+	const char* libxm_dir = NULL;
+
+	int i;
+	for(i = 1; i < argc && !strncmp(argv[i], "--", 2); ++i) {
+		if(!strcmp(argv[i], "--threads") && i + 1 < argc) {
+			threads = strtol(argv[++i], NULL, 10);
+			if(threads < 1 || threads > UINT8_MAX) usage(argv[0]);
+		} else if(!strcmp(argv[i], "--libxm") && i + 1 < argc) {
+			libxm_dir = argv[++i];
+		} else {
+			usage(argv[0]);
+		}
+	}
+	if(i == argc) usage(argv[0]);
+
+	xm_batch_t* batch = xm_create_batch((uint8_t)threads);
+	xm_prescan_data_t* p = malloc(XM_PRESCAN_DATA_SIZE);
+	if(batch == NULL || p == NULL) {
+		NOTICE("could not create batch");
+		return 1;
+	}
+
+	printf("module\tchannels\tlength\tpatterns\tinstruments"
+	       "\tcontext_bytes\tframes_%u_hz\tname\n", RATE);
+	int ret = 0;
+	for(; i < argc; ++i) {
+		if(!process(batch, p, argv[i], libxm_dir)) ret = 1;
+	}
+
+	free(p);
+	xm_free_batch(batch);
+	return ret;
+}
@@ -65,6 +65,11 @@ static void gen_waveforms(void) {
 		                  int16_t: next >> 16,
 		                  float: -1.f + (float)(next >> 16) / (float)INT16_MAX);
 	}
+
+	xm_update_sample_waveform(ctx, 1, 0);
+	xm_update_sample_waveform(ctx, 2, 0);
+	xm_update_sample_waveform(ctx, 4, 0);
+	xm_update_sample_waveform(ctx, 8, 0);
 }
 
 // XXX: pipewire requires environment. figure out a way to get it within
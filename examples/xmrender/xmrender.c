@@ -0,0 +1,242 @@
+/* This program is free software. It comes without any warranty, to the
+ * extent permitted by applicable law. You can redistribute it and/or
+ * modify it under the terms of the Do What The Fuck You Want To Public
+ * License, Version 2, as published by Sam Hocevar. See
+ * http://sam.zoy.org/wtfpl/COPYING for more details. */
+
+/* Render a module to a .wav file, as fast as possible */
+
+#include <xm.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define NOTICE(fmt, ...) do {                                           \
+		fprintf(stderr, "xmrender: " fmt "\n" __VA_OPT__(,) __VA_ARGS__); \
+		fflush(stderr); \
+	} while(0)
+
+/* Frames rendered per call to xm_render(). Big enough to make per-call and
+   per-fwrite() overhead irrelevant. */
+#define CHUNK_FRAMES (1 << 16)
+
+#define WAV_HEADER_SIZE 44
+
+static void usage(const char* argv0) {
+	NOTICE("Usage: %s [--s16] [--rate <hz>] [--loops <n>] "
+	       "[--interpolation <mode>] <in.xm> <out.wav>\n"
+	       "\t--s16: write 16-bit integer PCM instead of 32-bit float\n"
+	       "\t--rate: sample rate, defaults to 48000\n"
+	       "\t--interpolation: default, cubic or sinc\n"
+	       "\t--loops: stop after the module has looped n times, "
+	       "defaults to 1\n"
+	       "\tUse - as <out.wav> to write to standard output.", argv0);
+	exit(1);
+}
+
+static void put_le16(unsigned char* p, uint16_t x) {
+	p[0] = (unsigned char)x;
+	p[1] = (unsigned char)(x >> 8);
+}
+
+static void put_le32(unsigned char* p, uint32_t x) {
+	put_le16(p, (uint16_t)x);
+	put_le16(p + 2, (uint16_t)(x >> 16));
+}
+
+static void write_wav_header(FILE* out, bool s16, uint32_t rate,
+                             uint32_t data_size) {
+	uint16_t bytes_per_frame = s16 ? 4 : 8;
+	unsigned char h[WAV_HEADER_SIZE];
+	memcpy(h, "RIFF", 4);
+	put_le32(h + 4, data_size + WAV_HEADER_SIZE - 8);
+	memcpy(h + 8, "WAVEfmt ", 8);
+	put_le32(h + 16, 16);
+	put_le16(h + 20, s16 ? 1 : 3); /* PCM or IEEE float */
+	put_le16(h + 22, 2);
+	put_le32(h + 24, rate);
+	put_le32(h + 28, rate * bytes_per_frame);
+	put_le16(h + 32, bytes_per_frame);
+	put_le16(h + 34, s16 ? 16 : 32);
+	memcpy(h + 36, "data", 4);
+	put_le32(h + 40, data_size);
+
+	if(fwrite(h, WAV_HEADER_SIZE, 1, out) != 1) {
+		perror("fwrite");
+		exit(1);
+	}
+}
+
+/* Convert rendered floats to little endian PCM, in place (each output
+   sample is never bigger than its input sample) */
+static size_t convert(float* buf, size_t count, bool s16) {
+	unsigned char* out = (unsigned char*)buf;
+	if(s16) {
+		for(size_t i = 0; i < count; ++i) {
+			float x = buf[i] * 32767.f;
+			if(x > 32767.f) x = 32767.f;
+			if(x < -32768.f) x = -32768.f;
+			put_le16(out + 2 * i, (uint16_t)(int16_t)lrintf(x));
+		}
+		return 2 * count;
+	}
+
+	for(size_t i = 0; i < count; ++i) {
+		uint32_t x;
+		memcpy(&x, buf + i, sizeof(x));
+		put_le32(out + 4 * i, x);
+	}
+	return 4 * count;
+}
+
+static char* read_file(const char* path, uint32_t* length) {
+	FILE* in = fopen(path, "rb");
+	if(in == NULL) {
+		perror("fopen");
+		exit(1);
+	}
+	if(fseek(in, 0, SEEK_END)) {
+		perror("fseek");
+		exit(1);
+	}
+	long in_length = ftell(in);
+	if(in_length == -1) {
+		perror("ftell");
+		exit(1);
+	}
+	if(in_length > UINT32_MAX) {
+		NOTICE("input file too large");
+		exit(1);
+	}
+	rewind(in);
+
+	char* data = malloc((size_t)in_length);
+	if(data == NULL) {
+		perror("malloc");
+		exit(1);
+	}
+	if(in_length > 0 && fread(data, (size_t)in_length, 1, in) != 1) {
+		perror("fread");
+		exit(1);
+	}
+	fclose(in);
+	*length = (uint32_t)in_length;
+	return data;
+}
+
+int main(int argc, char** argv) {
+	bool s16 = false;
+	uint32_t rate = 48000;
+	uint8_t loops = 1;
+	xm_interpolation_t interpolation = XM_INTERPOLATION_DEFAULT;
+
+	int i;
+	for(i = 1; i < argc - 2; ++i) {
+		if(!strcmp(argv[i], "--s16")) {
+			s16 = true;
+		} else if(!strcmp(argv[i], "--rate") && i + 1 < argc - 2) {
+			long r = strtol(argv[++i], NULL, 10);
+			if(r <= 32 || r > 3355443) usage(argv[0]);
+			rate = (uint32_t)r;
+		} else if(!strcmp(argv[i], "--loops") && i + 1 < argc - 2) {
+			long l = strtol(argv[++i], NULL, 10);
+			if(l < 1 || l > UINT8_MAX) usage(argv[0]);
+			loops = (uint8_t)l;
+		} else if(!strcmp(argv[i], "--interpolation") && i + 1 < argc - 2) {
+			++i;
+			if(!strcmp(argv[i], "default")) {
+				interpolation = XM_INTERPOLATION_DEFAULT;
+			} else if(!strcmp(argv[i], "cubic")) {
+				interpolation = XM_INTERPOLATION_CUBIC;
+			} else if(!strcmp(argv[i], "sinc")) {
+				interpolation = XM_INTERPOLATION_SINC;
+			} else {
+				usage(argv[0]);
+			}
+		} else {
+			usage(argv[0]);
+		}
+	}
+	if(i != argc - 2) usage(argv[0]);
+
+	uint32_t xm_length;
+	char* xmdata = read_file(argv[argc - 2], &xm_length);
+
+	xm_prescan_data_t* p = malloc(XM_PRESCAN_DATA_SIZE);
+	if(p == NULL) {
+		perror("malloc");
+		exit(1);
+	}
+	if(!xm_prescan_module(xmdata, xm_length, p)) {
+		NOTICE("xm_prescan_module() failed");
+		exit(1);
+	}
+	char* pool = malloc(xm_size_for_context(p));
+	if(pool == NULL) {
+		perror("malloc");
+		exit(1);
+	}
+	xm_context_t* ctx = xm_create_context(pool, p, xmdata, xm_length, rate);
+	free(p);
+	xm_set_max_loop_count(ctx, loops);
+
+	char* table = NULL;
+	if(interpolation != XM_INTERPOLATION_DEFAULT) {
+		table = malloc(xm_size_for_interpolation_table(interpolation));
+		if(table == NULL) {
+			perror("malloc");
+			exit(1);
+		}
+		xm_set_interpolation_table(ctx, xm_build_interpolation_table(
+			                           interpolation, table));
+	}
+
+	bool to_stdout = !strcmp(argv[argc - 1], "-");
+	FILE* out = to_stdout ? stdout : fopen(argv[argc - 1], "wb");
+	if(out == NULL) {
+		perror("fopen");
+		exit(1);
+	}
+
+	/* Sizes are unknown until the module ends, they are fixed up below
+	   (if the output is seekable) */
+	write_wav_header(out, s16, rate, UINT32_MAX - WAV_HEADER_SIZE);
+
+	float* buf = malloc(sizeof(float) * 2 * CHUNK_FRAMES);
+	if(buf == NULL) {
+		perror("malloc");
+		exit(1);
+	}
+
+	uint64_t data_size = 0;
+	uint32_t n;
+	do {
+		n = xm_render(ctx, buf, CHUNK_FRAMES);
+		size_t bytes = convert(buf, 2 * (size_t)n, s16);
+		if(bytes && fwrite(buf, bytes, 1, out) != 1) {
+			perror("fwrite");
+			exit(1);
+		}
+		data_size += bytes;
+	} while(n == CHUNK_FRAMES);
+
+	if(data_size > UINT32_MAX - WAV_HEADER_SIZE) {
+		NOTICE("output too large for a .wav file, header left as is");
+	} else if(!to_stdout && !fseek(out, 0, SEEK_SET)) {
+		write_wav_header(out, s16, rate, (uint32_t)data_size);
+	}
+
+	if(fclose(out)) {
+		perror("fclose");
+		exit(1);
+	}
+
+	NOTICE("rendered %llu frames",
+	       (unsigned long long)(data_size / (s16 ? 4 : 8)));
+	free(buf);
+	free(table);
+	free(pool);
+	free(xmdata);
+	return 0;
+}
@@ -18,6 +18,12 @@
 #define ENVELOPE_FLAG_SUSTAIN 0b00000010
 #define ENVELOPE_FLAG_LOOP 0b00000100
 
+/* Stored in the top bits of xm_sample_t.lazy, offset in the bottom bits */
+#define LAZY_SAMPLE_TYPE_MASK (3u << 30)
+#define LAZY_SAMPLE_XM0104_8B (1u << 30)
+#define LAZY_SAMPLE_XM0104_16B (2u << 30)
+#define LAZY_SAMPLE_MOD (3u << 30)
+
 #define ASSERT_ALIGNED(ptr, type)                                       \
 	assert((uintptr_t)((void*)(ptr)) % alignof(type) == 0)
 
@@ -27,7 +33,7 @@
  */
 #define READ_U8_BOUND(offset, bound) \
 	((uint8_t)(((uint32_t)(offset) < (uint32_t)(bound)) ? \
-	           (((uint8_t*)moddata)[offset]) : 0))
+	           xm_reader_u8(reader, (uint32_t)(offset)) : 0))
 
 #define READ_U16_BOUND(offset, bound) \
 	((uint16_t)((uint16_t)READ_U8_BOUND(offset, bound) \
@@ -44,7 +50,7 @@
 	            | (uint32_t)READ_U16BE_BOUND((offset) + 2, bound)))
 
 #define READ_MEMCPY_BOUND(ptr, offset, length, bound) \
-	memcpy_pad(ptr, length, moddata, bound, offset)
+	xm_reader_memcpy(reader, ptr, length, bound, offset)
 
 #define READ_U8(offset) READ_U8_BOUND(offset, moddata_length)
 #define READ_U16(offset) READ_U16_BOUND(offset, moddata_length)
@@ -64,8 +70,8 @@
 	_Generic((xm_sample_point_t){}, int8_t: v, int16_t: (v * 256), \
 	         float: (float)v / (float)INT8_MAX)
 
-#define SAMPLE_POINT_FROM_S16(v) \
-	_Generic((xm_sample_point_t){}, int8_t: xm_dither_16b_8b(v), \
+#define SAMPLE_POINT_FROM_S16(v, dither) \
+	_Generic((xm_sample_point_t){}, int8_t: xm_dither_16b_8b(v, dither), \
 		int16_t: v, float: (float)v / (float)INT16_MAX)
 
 struct xm_prescan_data_s {
@@ -77,6 +83,9 @@ struct xm_prescan_data_s {
 	} format;
 	uint32_t num_rows:24;
 	uint32_t samples_data_length;
+	uint32_t num_slots; /* Non-empty pattern slots */
+	uint32_t stream_min_length; /* See xm_prescan_module_streaming(), or 0
+	                               if no sample is streamed */
 	uint16_t num_patterns;
 	uint16_t num_samples;
 	uint16_t pot_length;
@@ -85,51 +94,164 @@ struct xm_prescan_data_s {
 };
 const uint8_t XM_PRESCAN_DATA_SIZE = sizeof(xm_prescan_data_t);
 
+/* Bytes read at once when loading through a xm_read_callback_t */
+#define READER_BUFFER_SIZE 1024
+
+/* Source of the module data. Loaded from memory, window is the whole module
+   and read is NULL. Loaded through a callback, window is buffer, and gets
+   refilled with the bytes around any offset read outside of it. */
+struct xm_reader_s {
+	xm_read_callback_t read;
+	void* user;
+	const char* window;
+	uint32_t window_offset;
+	uint32_t window_length;
+	uint32_t length; /* Total length of the module data */
+	uint32_t num_reads; /* Calls to read, only used for NOTICE() */
+	char buffer[READER_BUFFER_SIZE];
+	uint32_t stream_min_length; /* See xm_prescan_data_t */
+	bool lazy; /* Leave sample data undecoded, see xm_defer_sample() */
+	char __pad[3];
+};
+typedef struct xm_reader_s xm_reader_t;
+
 /* ----- Static functions ----- */
 
-static void memcpy_pad(void*, size_t, const void*, size_t, size_t);
-static int8_t xm_dither_16b_8b(int16_t);
+static void xm_init_reader(xm_reader_t*, const char*, xm_read_callback_t, void*, uint32_t);
+static uint8_t xm_reader_u8(xm_reader_t*, uint32_t);
+static bool xm_reader_refill(xm_reader_t*, uint32_t);
+static void xm_reader_memcpy(xm_reader_t*, void*, uint32_t, uint32_t, uint32_t);
+static int8_t xm_dither_16b_8b(int16_t, uint32_t*);
+static bool xm_slot_is_empty(const xm_pattern_slot_t*);
 static uint64_t xm_fnv1a(const unsigned char*, uint32_t);
 static void xm_fixup_context(xm_context_t*);
 
-static bool xm_prescan_xm0104(const char*, uint32_t, xm_prescan_data_t*);
-static void xm_load_xm0104(xm_context_t*, const char*, uint32_t);
-static uint32_t xm_load_xm0104_module_header(xm_context_t*, const char*, uint32_t);
-static uint32_t xm_load_xm0104_pattern(xm_context_t*, xm_pattern_t*, const char*, uint32_t, uint32_t);
-static uint32_t xm_load_xm0104_instrument(xm_context_t*, xm_instrument_t*, const char*, uint32_t, uint32_t);
-static void xm_load_xm0104_envelope_points(xm_envelope_t*, const char*);
+static bool xm_prescan(xm_reader_t*, uint32_t, uint32_t, xm_prescan_data_t*);
+static xm_context_t* xm_create_context_with_reader(char*, const xm_prescan_data_t*, xm_reader_t*, uint32_t, uint32_t);
+static bool xm_defer_sample(xm_context_t*, const xm_reader_t*, xm_sample_t*, uint32_t, uint32_t);
+#if XM_LAZY_SAMPLES
+static uint32_t xm_decode_instrument_samples(xm_context_t*, xm_reader_t*, uint8_t);
+static uint16_t xm_count_lazy_samples(const xm_context_t*);
+#endif
+
+static bool xm_prescan_xm0104(xm_reader_t*, uint32_t, xm_prescan_data_t*);
+static void xm_load_xm0104(xm_context_t*, xm_reader_t*, uint32_t);
+static uint32_t xm_load_xm0104_module_header(xm_context_t*, xm_reader_t*, uint32_t);
+static uint32_t xm_load_xm0104_pattern(xm_context_t*, xm_pattern_t*, xm_reader_t*, uint32_t, uint32_t);
+static uint8_t xm_load_xm0104_slot(xm_pattern_slot_t*, xm_reader_t*, uint32_t, uint32_t);
+static uint32_t xm_load_xm0104_instrument(xm_context_t*, xm_instrument_t*, xm_reader_t*, uint32_t, uint32_t);
+static void xm_load_xm0104_envelope_points(xm_envelope_t*, xm_reader_t*, uint32_t);
 static void xm_check_and_fix_envelope(xm_envelope_t*, uint8_t);
-static uint32_t xm_load_xm0104_sample_header(xm_sample_t*, bool*, const char*, uint32_t, uint32_t);
-static void xm_load_xm0104_8b_sample_data(uint32_t, xm_sample_point_t*, const char*, uint32_t, uint32_t);
-static void xm_load_xm0104_16b_sample_data(uint32_t, xm_sample_point_t*, const char*, uint32_t, uint32_t);
+static uint32_t xm_load_xm0104_sample_header(xm_sample_t*, bool*, xm_reader_t*, uint32_t, uint32_t);
+static void xm_load_xm0104_8b_sample_data(uint32_t, xm_sample_point_t*, xm_reader_t*, uint32_t, uint32_t);
+static void xm_load_xm0104_16b_sample_data(uint32_t, xm_sample_point_t*, xm_reader_t*, uint32_t, uint32_t);
 
-static bool xm_prescan_mod(const char*, uint32_t, xm_prescan_data_t*);
-static void xm_load_mod(xm_context_t*, const char*, uint32_t, const xm_prescan_data_t*);
+static bool xm_prescan_mod(xm_reader_t*, uint32_t, xm_prescan_data_t*);
+static void xm_load_mod(xm_context_t*, xm_reader_t*, uint32_t, const xm_prescan_data_t*);
+static void xm_load_mod_sample_data(uint32_t, xm_sample_point_t*, xm_reader_t*, uint32_t, uint32_t);
 
 /* ----- Function definitions ----- */
 
-static void memcpy_pad(void* dst, size_t dst_len, const void* src, size_t src_len, size_t offset) {
-	uint8_t* dst_c = dst;
-	const uint8_t* src_c = src;
+static void xm_init_reader(xm_reader_t* reader, const char* moddata,
+                           xm_read_callback_t read, void* user,
+                           uint32_t moddata_length) {
+	reader->read = read;
+	reader->user = user;
+	reader->window = moddata;
+	reader->window_offset = 0;
+	reader->window_length = moddata ? moddata_length : 0;
+	reader->length = moddata_length;
+	reader->num_reads = 0;
+	reader->stream_min_length = 0;
+	reader->lazy = false;
+}
 
-	/* how many bytes can be copied without overrunning `src` */
-	size_t copy_bytes = (src_len >= offset) ? (src_len - offset) : 0;
-	copy_bytes = copy_bytes > dst_len ? dst_len : copy_bytes;
+static uint8_t xm_reader_u8(xm_reader_t* reader, uint32_t offset) {
+	/* Unsigned wraparound also catches offset < window_offset */
+	if(offset - reader->window_offset < reader->window_length
+	   || xm_reader_refill(reader, offset)) {
+		return (uint8_t)reader->window[offset - reader->window_offset];
+	}
+	return 0;
+}
 
-	__builtin_memcpy(dst_c, src_c + offset, copy_bytes);
-	/* padded bytes */
-	__builtin_memset(dst_c + copy_bytes, 0, dst_len - copy_bytes);
+static bool xm_reader_refill(xm_reader_t* reader, uint32_t offset) {
+	if(reader->read == NULL || offset >= reader->length) {
+		return false;
+	}
+	uint32_t length = reader->length - offset;
+	if(length > READER_BUFFER_SIZE) length = READER_BUFFER_SIZE;
+	uint32_t r = reader->read(reader->user, reader->buffer, offset, length);
+	reader->num_reads += 1;
+	if(r == 0 || r > length) {
+		NOTICE("read callback failed at offset %u, "
+		       "assuming the module ends there", offset);
+		/* Don't retry, every later read will be zero */
+		reader->length = offset;
+		reader->window_length = 0;
+		return false;
+	}
+	reader->window = reader->buffer;
+	reader->window_offset = offset;
+	reader->window_length = r;
+	return true;
+}
+
+static void xm_reader_memcpy(xm_reader_t* reader, void* dst, uint32_t length,
+                             uint32_t bound, uint32_t offset) {
+	uint8_t* dst_c = dst;
+	for(uint32_t i = 0; i < length; ++i) {
+		dst_c[i] = READ_U8_BOUND(offset + i, bound);
+	}
 }
 
 bool xm_prescan_module(const char* moddata, uint32_t moddata_length,
                        xm_prescan_data_t* out) {
+	xm_reader_t reader;
+	xm_init_reader(&reader, moddata, NULL, NULL, moddata_length);
+	return xm_prescan(&reader, moddata_length, 0, out);
+}
+
+bool xm_prescan_module_from_callback(xm_read_callback_t read, void* user,
+                                     uint32_t moddata_length,
+                                     xm_prescan_data_t* out) {
+	xm_reader_t reader;
+	xm_init_reader(&reader, NULL, read, user, moddata_length);
+	bool ret = xm_prescan(&reader, moddata_length, 0, out);
+	NOTICE("prescan used %u reads", reader.num_reads);
+	return ret;
+}
+
+bool xm_prescan_module_streaming(xm_read_callback_t read, void* user,
+                                 uint32_t moddata_length,
+                                 [[maybe_unused]] uint32_t min_length,
+                                 xm_prescan_data_t* out) {
+	xm_reader_t reader;
+	xm_init_reader(&reader, NULL, read, user, moddata_length);
+	#if XM_STREAMING
+	assert(min_length > 0);
+	bool ret = xm_prescan(&reader, moddata_length, min_length, out);
+	#else
+	bool ret = xm_prescan(&reader, moddata_length, 0, out);
+	#endif
+	NOTICE("prescan used %u reads", reader.num_reads);
+	return ret;
+}
+
+/* @param stream_min_length minimum length of streamed samples, or 0 if no
+   sample is streamed */
+static bool xm_prescan(xm_reader_t* reader, uint32_t moddata_length,
+                       uint32_t stream_min_length, xm_prescan_data_t* out) {
+	out->stream_min_length = stream_min_length;
+	char magic[17];
+	READ_MEMCPY(magic, 0, 17);
 	if(moddata_length >= 60
-	   && memcmp("Extended Module: ", moddata, 17) == 0
-	   && moddata[37] == 0x1A
-	   && moddata[59] == 0x01
-	   && moddata[58] == 0x04) {
+	   && memcmp("Extended Module: ", magic, 17) == 0
+	   && READ_U8(37) == 0x1A
+	   && READ_U8(59) == 0x01
+	   && READ_U8(58) == 0x04) {
 		out->format = XM_FORMAT_XM0104;
-		if(xm_prescan_xm0104(moddata, moddata_length, out)) {
+		if(xm_prescan_xm0104(reader, moddata_length, out)) {
 			goto end;
 		} else {
 			return false;
@@ -142,39 +264,40 @@ bool xm_prescan_module(const char* moddata, uint32_t moddata_length,
 		out->format = XM_FORMAT_MOD;
 		bool load = false;
 
-		const char chn = moddata[150+31*30];
-		const char chn2 = moddata[151+31*30];
-		const char chn3 = moddata[153+31*30];
+		READ_MEMCPY(magic, 150+31*30, 4);
+		const char chn = magic[0];
+		const char chn2 = magic[1];
+		const char chn3 = magic[3];
 
-		if(memcmp("M.K.", moddata + 150+31*30, 4) == 0
-		   || memcmp("M!K!", moddata + 150+31*30, 4) == 0
-		   || memcmp("FLT4", moddata + 150+31*30, 4) == 0) {
+		if(memcmp("M.K.", magic, 4) == 0
+		   || memcmp("M!K!", magic, 4) == 0
+		   || memcmp("FLT4", magic, 4) == 0) {
 			out->num_channels = 4;
 			load = true;
-		} else if(memcmp("CD81", moddata + 150+31*30, 4) == 0
-		          || memcmp("OCTA", moddata + 150+31*30, 4) == 0
-		          || memcmp("OKTA", moddata + 150+31*30, 4) == 0
-		          || memcmp("FLT8", moddata + 150+31*30, 4) == 0) {
+		} else if(memcmp("CD81", magic, 4) == 0
+		          || memcmp("OCTA", magic, 4) == 0
+		          || memcmp("OKTA", magic, 4) == 0
+		          || memcmp("FLT8", magic, 4) == 0) {
 			out->num_channels = 8;
 			load = true;
 		} else if(chn >= '1' && chn <= '9'
-		   && memcmp("CHN", moddata + 151+31*30, 3) == 0) {
+		   && memcmp("CHN", magic + 1, 3) == 0) {
 			out->num_channels = (uint8_t)(chn - '0');
 			load = true;
 		} else if(chn >= '1' && chn <= '9' && chn2 >= '0' && chn2 <= '9'
-		   && (memcmp("CH", moddata + 152+31*30, 2) == 0
-		       || memcmp("CN", moddata + 152+31*30, 2) == 0)) {
+		   && (memcmp("CH", magic + 2, 2) == 0
+		       || memcmp("CN", magic + 2, 2) == 0)) {
 			out->num_channels = (uint8_t)
 				(10 * (chn - '0') + chn2 - '0');
 			load = true;
 		} else if(chn3 >= '1' && chn3 <= '9'
-		   && memcmp("TDZ", moddata + 150+31*30, 3) == 0) {
+		   && memcmp("TDZ", magic, 3) == 0) {
 			out->num_channels = (uint8_t)(chn3 - '0');
 			load = true;
 		}
 
 		if(load) {
-			if(xm_prescan_mod(moddata, moddata_length, out)) {
+			if(xm_prescan_mod(reader, moddata_length, out)) {
 				goto end;
 			} else {
 				return false;
@@ -188,13 +311,17 @@ bool xm_prescan_module(const char* moddata, uint32_t moddata_length,
  end:
 	uint32_t sz = sizeof(xm_context_t);
 	if(ckd_add(&sz, sz, sizeof(xm_pattern_t) * out->num_patterns)
-	   || ckd_add(&sz, sz, sizeof(xm_pattern_slot_t)
-	              * out->num_rows * out->num_channels)
+	   || ckd_add(&sz, sz, sizeof(xm_pattern_slot_t) * out->num_slots)
+	   || ckd_add(&sz, sz, sizeof(uint32_t) * (out->num_rows + 1))
 	   || ckd_add(&sz, sz, sizeof(xm_instrument_t) * out->num_instruments)
 	   || ckd_add(&sz, sz, sizeof(xm_sample_t) * out->num_samples)
 	   || ckd_add(&sz, sz, sizeof(xm_sample_point_t)
 	              * out->samples_data_length)
 	   || ckd_add(&sz, sz, sizeof(xm_channel_context_t) * out->num_channels)
+	   #if XM_TIMING_FUNCTIONS
+	   || ckd_add(&sz, sz, sizeof(uint32_t)
+	              * (out->num_instruments + out->num_samples))
+	   #endif
 	   || ckd_add(&sz, sz, sizeof(uint8_t) * MAX_ROWS_PER_PATTERN
 	              * out->pot_length)) {
 		NOTICE("module too big for uint32");
@@ -220,7 +347,42 @@ bool xm_prescan_module(const char* moddata, uint32_t moddata_length,
 
 xm_context_t* xm_create_context(char* mempool, const xm_prescan_data_t* p,
                                 const char* moddata, uint32_t moddata_length,
-                                uint16_t rate) {
+                                uint32_t rate) {
+	xm_reader_t reader;
+	xm_init_reader(&reader, moddata, NULL, NULL, moddata_length);
+	return xm_create_context_with_reader(mempool, p, &reader,
+	                                     moddata_length, rate);
+}
+
+xm_context_t* xm_create_context_from_callback(char* mempool,
+                                              const xm_prescan_data_t* p,
+                                              xm_read_callback_t read,
+                                              void* user,
+                                              uint32_t moddata_length,
+                                              uint32_t rate) {
+	xm_reader_t reader;
+	xm_init_reader(&reader, NULL, read, user, moddata_length);
+	xm_context_t* ctx = xm_create_context_with_reader(mempool, p, &reader,
+	                                                  moddata_length, rate);
+	NOTICE("load used %u reads", reader.num_reads);
+	return ctx;
+}
+
+xm_context_t* xm_create_context_lazy(char* mempool, const xm_prescan_data_t* p,
+                                     const char* moddata,
+                                     uint32_t moddata_length, uint32_t rate) {
+	xm_reader_t reader;
+	xm_init_reader(&reader, moddata, NULL, NULL, moddata_length);
+	reader.lazy = true;
+	return xm_create_context_with_reader(mempool, p, &reader,
+	                                     moddata_length, rate);
+}
+
+static xm_context_t* xm_create_context_with_reader(char* mempool,
+                                                   const xm_prescan_data_t* p,
+                                                   xm_reader_t* reader,
+                                                   uint32_t moddata_length,
+                                                   uint32_t rate) {
 	/* Make sure we are not misaligning data by accident */
 	ASSERT_ALIGNED(mempool, xm_context_t);
 	uint32_t ctx_size = xm_size_for_context(p);
@@ -232,6 +394,14 @@ xm_context_t* xm_create_context(char* mempool, const xm_prescan_data_t* p,
 	ctx->channels = (xm_channel_context_t*)mempool;
 	mempool += sizeof(xm_channel_context_t) * p->num_channels;
 
+	#if XM_TIMING_FUNCTIONS
+	ASSERT_ALIGNED(mempool, uint32_t);
+	ctx->instrument_triggers = (uint32_t*)mempool;
+	mempool += sizeof(uint32_t) * p->num_instruments;
+	ctx->sample_triggers = (uint32_t*)mempool;
+	mempool += sizeof(uint32_t) * p->num_samples;
+	#endif
+
 	ASSERT_ALIGNED(mempool, xm_instrument_t);
 	ctx->instruments = (xm_instrument_t*)mempool;
 	mempool += sizeof(xm_instrument_t) * p->num_instruments;
@@ -244,13 +414,17 @@ xm_context_t* xm_create_context(char* mempool, const xm_prescan_data_t* p,
 	ctx->patterns = (xm_pattern_t*)mempool;
 	mempool += sizeof(xm_pattern_t) * p->num_patterns;
 
+	ASSERT_ALIGNED(mempool, uint32_t);
+	ctx->rows = (uint32_t*)mempool;
+	mempool += sizeof(uint32_t) * (p->num_rows + 1);
+
 	ASSERT_ALIGNED(mempool, xm_sample_point_t);
 	ctx->samples_data = (xm_sample_point_t*)mempool;
 	mempool += sizeof(xm_sample_point_t) * p->samples_data_length;
 
 	ASSERT_ALIGNED(mempool, xm_pattern_slot_t);
 	ctx->pattern_slots = (xm_pattern_slot_t*)mempool;
-	mempool += sizeof(xm_pattern_slot_t) * p->num_rows * p->num_channels;
+	mempool += sizeof(xm_pattern_slot_t) * p->num_slots;
 
 	ASSERT_ALIGNED(mempool, uint8_t);
 	ctx->row_loop_count = (uint8_t*)mempool;
@@ -259,15 +433,17 @@ xm_context_t* xm_create_context(char* mempool, const xm_prescan_data_t* p,
 	assert(mempool - (char*)ctx == ctx_size);
 
 	ctx->rate = rate;
+	ctx->quality = QUALITY_AVAILABLE;
 	ctx->global_volume = MAX_VOLUME;
+	reader->stream_min_length = p->stream_min_length;
 
 	switch(p->format) {
 	case XM_FORMAT_XM0104:
-		xm_load_xm0104(ctx, moddata, moddata_length);
+		xm_load_xm0104(ctx, reader, moddata_length);
 		break;
 
 	case XM_FORMAT_MOD:
-		xm_load_mod(ctx, moddata, moddata_length, p);
+		xm_load_mod(ctx, reader, moddata_length, p);
 		break;
 
 	default:
@@ -278,15 +454,76 @@ xm_context_t* xm_create_context(char* mempool, const xm_prescan_data_t* p,
 	assert(ctx->module.length == p->pot_length);
 	assert(ctx->module.num_patterns == p->num_patterns);
 	assert(ctx->module.num_rows == p->num_rows);
+	assert(ctx->rows[ctx->module.num_rows] == p->num_slots);
 	assert(ctx->module.num_instruments == p->num_instruments);
 	assert(ctx->module.num_samples == p->num_samples);
 	assert(ctx->module.samples_data_length == p->samples_data_length);
 	assert(xm_context_size(ctx) == ctx_size);
 
+	ctx->tempo = ctx->module.tempo;
+	ctx->bpm = ctx->module.bpm;
 	xm_fixup_context(ctx);
 	return ctx;
 }
 
+uint32_t xm_size_for_shared_context(const xm_context_t* ctx) {
+	return (uint32_t)(sizeof(xm_context_t)
+	                  + sizeof(xm_channel_context_t) * ctx->module.num_channels
+	                  #if XM_TIMING_FUNCTIONS
+	                  + sizeof(uint32_t) * (ctx->module.num_instruments
+	                                        + ctx->module.num_samples)
+	                  #endif
+	                  + sizeof(uint8_t) * MAX_ROWS_PER_PATTERN
+	                  * ctx->module.length);
+}
+
+xm_context_t* xm_create_shared_context(char* mempool, const xm_context_t* src,
+                                       uint32_t rate) {
+	ASSERT_ALIGNED(mempool, xm_context_t);
+	uint32_t ctx_size = xm_size_for_shared_context(src);
+	__builtin_memset(mempool, 0, ctx_size);
+	xm_context_t* ctx = (xm_context_t*)mempool;
+	mempool += sizeof(xm_context_t);
+
+	/* Module data is only read during playback (except for instrument
+	   mute status), point to the data of src */
+	ctx->patterns = src->patterns;
+	ctx->pattern_slots = src->pattern_slots;
+	ctx->rows = src->rows;
+	ctx->instruments = src->instruments;
+	ctx->samples = src->samples;
+	ctx->samples_data = src->samples_data;
+	ctx->module = src->module;
+
+	/* Same layout as xm_create_context(), minus the module data, so that
+	   row_loop_count still comes last */
+	ASSERT_ALIGNED(mempool, xm_channel_context_t);
+	ctx->channels = (xm_channel_context_t*)mempool;
+	mempool += sizeof(xm_channel_context_t) * ctx->module.num_channels;
+
+	#if XM_TIMING_FUNCTIONS
+	ASSERT_ALIGNED(mempool, uint32_t);
+	ctx->instrument_triggers = (uint32_t*)mempool;
+	mempool += sizeof(uint32_t) * ctx->module.num_instruments;
+	ctx->sample_triggers = (uint32_t*)mempool;
+	mempool += sizeof(uint32_t) * ctx->module.num_samples;
+	#endif
+
+	ASSERT_ALIGNED(mempool, uint8_t);
+	ctx->row_loop_count = (uint8_t*)mempool;
+	mempool += sizeof(uint8_t) * MAX_ROWS_PER_PATTERN * ctx->module.length;
+
+	assert(mempool - (char*)ctx == ctx_size);
+	assert(xm_context_size(ctx) == ctx_size);
+
+	ctx->rate = rate;
+	ctx->quality = QUALITY_AVAILABLE;
+	ctx->global_volume = MAX_VOLUME;
+	ctx->tempo = ctx->module.tempo;
+	ctx->bpm = ctx->module.bpm;
+	return ctx;
+}
+
 uint32_t xm_size_for_context(const xm_prescan_data_t* p) {
 	return p->context_size;
 }
@@ -300,14 +537,136 @@ uint32_t xm_context_size(const xm_context_t* ctx) {
 		             * ctx->module.length);
 }
 
+/* If the context is loaded lazily, remember where the sample data is instead
+   of decoding it. Its frames stay zeroes until xm_decode_samples().
+   @returns true if the sample was deferred */
+static bool xm_defer_sample([[maybe_unused]] xm_context_t* ctx,
+                            [[maybe_unused]] const xm_reader_t* reader,
+                            [[maybe_unused]] xm_sample_t* s,
+                            [[maybe_unused]] uint32_t type,
+                            [[maybe_unused]] uint32_t offset) {
+	#if XM_LAZY_SAMPLES
+	if(!reader->lazy || s->length == 0 || (offset & LAZY_SAMPLE_TYPE_MASK)) {
+		return false;
+	}
+	s->lazy = type | offset;
+	return true;
+	#else
+	return false;
+	#endif
+}
+
+#if XM_LAZY_SAMPLES
+uint16_t xm_decode_samples(xm_context_t* ctx, const char* moddata,
+                           uint32_t moddata_length, uint32_t max_frames) {
+	xm_reader_t reader;
+	xm_init_reader(&reader, moddata, NULL, NULL, moddata_length);
+	uint32_t frames = 0;
+
+	/* Samples of the instruments used by the module, in the order they
+	   will be played */
+	for(; ctx->module.lazy_table_index < ctx->module.length;
+	    ++ctx->module.lazy_table_index) {
+		const xm_pattern_t* pat = ctx->patterns
+			+ ctx->module.pattern_table[ctx->module.lazy_table_index];
+		const xm_pattern_slot_t* slot = ctx->pattern_slots
+			+ ctx->rows[pat->rows_index];
+		for(uint32_t i = ctx->rows[pat->rows_index + pat->num_rows]
+			    - ctx->rows[pat->rows_index];
+		    i; --i, ++slot) {
+			if(slot->instrument == 0
+			   || slot->instrument > ctx->module.num_instruments) {
+				continue;
+			}
+			frames += xm_decode_instrument_samples(ctx, &reader,
+			                                       slot->instrument);
+			if(frames && frames >= max_frames) {
+				return xm_count_lazy_samples(ctx);
+			}
+		}
+	}
+
+	/* Samples never used in patterns, that can still be played with
+	   xm_trigger_note() */
+	for(uint8_t i = 1; i <= ctx->module.num_instruments; ++i) {
+		frames += xm_decode_instrument_samples(ctx, &reader, i);
+		if(frames && frames >= max_frames) break;
+	}
+
+	return xm_count_lazy_samples(ctx);
+}
+
+void xm_decode_instrument(xm_context_t* ctx, const char* moddata,
+                          uint32_t moddata_length, uint8_t instr) {
+	xm_reader_t reader;
+	xm_init_reader(&reader, moddata, NULL, NULL, moddata_length);
+	xm_decode_instrument_samples(ctx, &reader, instr);
+}
+
+static uint16_t xm_count_lazy_samples(const xm_context_t* ctx) {
+	uint16_t n = 0;
+	for(uint16_t i = 0; i < ctx->module.num_samples; ++i) {
+		if(ctx->samples[i].lazy) ++n;
+	}
+	return n;
+}
+
+/* @returns the number of decoded frames */
+static uint32_t xm_decode_instrument_samples(xm_context_t* ctx,
+                                             xm_reader_t* reader,
+                                             uint8_t instr) {
+	const xm_instrument_t* ins = ctx->instruments + instr - 1;
+	uint32_t frames = 0;
+	for(uint8_t i = 0; i < ins->num_samples; ++i) {
+		xm_sample_t* s = ctx->samples + ins->samples_index + i;
+		if(s->lazy == 0) continue;
+
+		xm_sample_point_t* out = ctx->samples_data + s->index;
+		uint32_t offset = s->lazy & ~LAZY_SAMPLE_TYPE_MASK;
+		switch(s->lazy & LAZY_SAMPLE_TYPE_MASK) {
+		case LAZY_SAMPLE_XM0104_8B:
+			xm_load_xm0104_8b_sample_data(s->length, out, reader,
+			                              reader->length, offset);
+			break;
+		case LAZY_SAMPLE_XM0104_16B:
+			xm_load_xm0104_16b_sample_data(s->length, out, reader,
+			                               reader->length, offset);
+			break;
+		case LAZY_SAMPLE_MOD:
+			xm_load_mod_sample_data(s->length, out, reader,
+			                        reader->length, offset);
+			break;
+		default:
+			UNREACHABLE();
+		}
+
+		s->lazy = 0;
+		xm_update_sample_waveform(ctx, instr, i);
+		frames += s->length;
+	}
+	return frames;
+}
+#else
+uint16_t xm_decode_samples([[maybe_unused]] xm_context_t* ctx,
+                           [[maybe_unused]] const char* moddata,
+                           [[maybe_unused]] uint32_t moddata_length,
+                           [[maybe_unused]] uint32_t max_frames) {
+	return 0;
+}
+
+void xm_decode_instrument([[maybe_unused]] xm_context_t* ctx,
+                          [[maybe_unused]] const char* moddata,
+                          [[maybe_unused]] uint32_t moddata_length,
+                          [[maybe_unused]] uint8_t instr) {}
+#endif
+
 
-static int8_t xm_dither_16b_8b(int16_t x) {
-	static uint32_t next = 1;
-	next = next * 214013 + 2531011;
+static int8_t xm_dither_16b_8b(int16_t x, uint32_t* next) {
+	*next = *next * 214013 + 2531011;
 	/* Not that this is perf critical, but this should compile to a cmovl
 	   (branchless) */
 	return (x >= 32512) ? 127 :
-		(int8_t)((x + (int16_t)((next >> 16) % 256)) / 256);
+		(int8_t)((x + (int16_t)((*next >> 16) % 256)) / 256);
 }
 
 static uint64_t xm_fnv1a(const unsigned char* data, uint32_t length) {
@@ -319,12 +678,16 @@ static uint64_t xm_fnv1a(const unsigned char* data, uint32_t length) {
 	return h;
 }
 
+static bool xm_slot_is_empty(const xm_pattern_slot_t* s) {
+	return (s->note | s->instrument | s->volume_column | s->effect_type
+	        | s->effect_param) == 0;
+}
+
 static void xm_fixup_context(xm_context_t* ctx) {
 	xm_pattern_slot_t* slot = ctx->pattern_slots;
 	static_assert(MAX_PATTERNS * MAX_ROWS_PER_PATTERN * MAX_CHANNELS
 	              <= UINT32_MAX);
-	for(uint32_t i = ctx->module.num_rows * ctx->module.num_channels;
-	    i; --i, ++slot) {
+	for(uint32_t i = ctx->rows[ctx->module.num_rows]; i; --i, ++slot) {
 		if(slot->note > 97) {
 			NOTICE("slot %lu: deleting invalid note %d",
 			       slot - ctx->pattern_slots, slot->note);
@@ -390,6 +753,12 @@ static void xm_fixup_context(xm_context_t* ctx) {
 			slot->volume_column = 0;
 		}
 	}
+
+	for(uint8_t i = 1; i <= ctx->module.num_instruments; ++i) {
+		for(uint8_t s = 0; s < ctx->instruments[i-1].num_samples; ++s) {
+			xm_update_sample_waveform(ctx, i, s);
+		}
+	}
 }
 
 #define CALC_OFFSET(dest, orig) do { \
@@ -412,13 +781,21 @@ void xm_context_to_libxm(xm_context_t* ctx, char* out) {
 	/* Force next generated samples to call xm_row() and refill
 	  ch->current */
 	ctx->current_tick = 0;
+	#if XM_RAMPING
+	__builtin_memset(ctx->ghosts, 0, sizeof(ctx->ghosts));
+	#endif
+
+	/* Don't store rate specific tables, they will be rebuilt by the next
+	   xm_tick() */
+	__builtin_memset(ctx->period_steps, 0, sizeof(ctx->period_steps));
+	ctx->period_steps_rate = 0;
 
 	/* (*) Everything done after this should be deterministically
 	   reversible */
 	uint32_t ctx_size = xm_context_size(ctx);
 	[[maybe_unused]] uint64_t old_hash = xm_fnv1a((void*)ctx, ctx_size);
 
-	uint16_t old_rate = ctx->rate;
+	uint32_t old_rate = ctx->rate;
 	ctx->rate = 0;
 
 	#if XM_LIBXM_DELTA_SAMPLES
@@ -429,13 +806,29 @@ void xm_context_to_libxm(xm_context_t* ctx, char* out) {
 
 	CALC_OFFSET(ctx->patterns, ctx);
 	CALC_OFFSET(ctx->pattern_slots, ctx);
+	CALC_OFFSET(ctx->rows, ctx);
 	CALC_OFFSET(ctx->instruments, ctx);
 	CALC_OFFSET(ctx->samples, ctx);
 	CALC_OFFSET(ctx->samples_data, ctx);
 	CALC_OFFSET(ctx->channels, ctx);
 	CALC_OFFSET(ctx->row_loop_count, ctx);
+	#if XM_TIMING_FUNCTIONS
+	CALC_OFFSET(ctx->instrument_triggers, ctx);
+	CALC_OFFSET(ctx->sample_triggers, ctx);
+	#endif
 
 	__builtin_memcpy(out, ctx, ctx_size);
+	/* The event ring, interpolation table and sample provider aren't
+	   part of the context */
+	#if XM_EVENTS
+	((xm_context_t*)out)->events = NULL;
+	#endif
+	((xm_context_t*)out)->interpolation = NULL;
+	#if XM_STREAMING
+	((xm_context_t*)out)->provider = NULL;
+	((xm_context_t*)out)->provider_user = NULL;
+	((xm_context_t*)out)->streams = NULL;
+	#endif
 
 	/* Restore the context back to the state marked (*) */
 	ctx = xm_create_context_from_libxm((void*)ctx, old_rate);
@@ -443,7 +836,38 @@ void xm_context_to_libxm(xm_context_t* ctx, char* out) {
 	assert(xm_fnv1a((void*)ctx, ctx_size) == old_hash);
 }
 
-xm_context_t* xm_create_context_from_libxm(char* data, uint16_t rate) {
+void xm_context_to_mappable_libxm(xm_context_t* ctx, char* out) {
+	xm_context_to_libxm(ctx, out);
+
+	#if XM_LIBXM_DELTA_SAMPLES
+	/* Undo the delta coding, in the output only */
+	xm_sample_point_t* samples_data = ((xm_context_t*)out)->samples_data;
+	APPLY_OFFSET(samples_data, out);
+	for(uint32_t i = 1; i < ctx->module.samples_data_length; ++i) {
+		samples_data[i] += samples_data[i-1];
+	}
+	#endif
+}
+
+xm_context_t* xm_create_context_from_mappable_libxm(char* pool,
+                                                    const char* data,
+                                                    uint32_t rate) {
+	ASSERT_ALIGNED(data, xm_context_t);
+	xm_context_t* ctx = xm_create_shared_context(pool,
+	                                             (const xm_context_t*)data,
+	                                             rate);
+
+	/* Module data was copied as offsets, relative to data */
+	APPLY_OFFSET(ctx->patterns, data);
+	APPLY_OFFSET(ctx->pattern_slots, data);
+	APPLY_OFFSET(ctx->rows, data);
+	APPLY_OFFSET(ctx->instruments, data);
+	APPLY_OFFSET(ctx->samples, data);
+	APPLY_OFFSET(ctx->samples_data, data);
+	return ctx;
+}
+
+xm_context_t* xm_create_context_from_libxm(char* data, uint32_t rate) {
 	ASSERT_ALIGNED(data, xm_context_t);
 	xm_context_t* ctx = (void*)data;
 	ctx->rate = rate;
@@ -451,11 +875,16 @@ xm_context_t* xm_create_context_from_libxm(char* data, uint16_t rate) {
 	/* Reverse steps of xm_context_to_libxm() */
 	APPLY_OFFSET(ctx->patterns, ctx);
 	APPLY_OFFSET(ctx->pattern_slots, ctx);
+	APPLY_OFFSET(ctx->rows, ctx);
 	APPLY_OFFSET(ctx->instruments, ctx);
 	APPLY_OFFSET(ctx->samples, ctx);
 	APPLY_OFFSET(ctx->samples_data, ctx);
 	APPLY_OFFSET(ctx->channels, ctx);
 	APPLY_OFFSET(ctx->row_loop_count, ctx);
+	#if XM_TIMING_FUNCTIONS
+	APPLY_OFFSET(ctx->instrument_triggers, ctx);
+	APPLY_OFFSET(ctx->sample_triggers, ctx);
+	#endif
 
 	#if XM_LIBXM_DELTA_SAMPLES
 	for(uint32_t i = 1; i < ctx->module.samples_data_length; ++i) {
@@ -468,7 +897,7 @@ xm_context_t* xm_create_context_from_libxm(char* data, uint16_t rate) {
 
 /* ----- Fasttracker II .XM (XM 0104): little endian ----- */
 
-static bool xm_prescan_xm0104(const char* moddata, uint32_t moddata_length,
+static bool xm_prescan_xm0104(xm_reader_t* reader, uint32_t moddata_length,
                               xm_prescan_data_t* out) {
 	uint32_t offset = 60; /* Skip the first header */
 
@@ -497,6 +926,7 @@ static bool xm_prescan_xm0104(const char* moddata, uint32_t moddata_length,
 	out->num_instruments = (uint8_t)num_instruments;
 	out->num_samples = 0;
 	out->num_rows = 0;
+	out->num_slots = 0;
 	out->samples_data_length = 0;
 
 	uint8_t pot[PATTERN_ORDER_TABLE_LENGTH];
@@ -524,8 +954,22 @@ static bool xm_prescan_xm0104(const char* moddata, uint32_t moddata_length,
 
 		out->num_rows += num_rows;
 
+		/* Count non-empty slots, exactly like
+		   xm_load_xm0104_pattern() will load them */
+		uint32_t data = offset + READ_U32(offset);
+		uint32_t num_slots = (uint32_t)num_rows * out->num_channels;
+		for(uint32_t j = 0, k = 0; j < packed_size && k < num_slots;
+		    ++k) {
+			xm_pattern_slot_t slot = {};
+			j += xm_load_xm0104_slot(&slot, reader,
+			                         data + packed_size, data + j);
+			if(!xm_slot_is_empty(&slot)) {
+				out->num_slots += 1;
+			}
+		}
+
 		/* Pattern header length + packed pattern data size */
-		offset += READ_U32(offset) + (uint32_t)READ_U16(offset + 7);
+		offset = data + packed_size;
 	}
 
 	/* Maybe add space for an empty pattern */
@@ -580,6 +1024,15 @@ static bool xm_prescan_xm0104(const char* moddata, uint32_t moddata_length,
 			uint32_t loop_start = READ_U32(offset + 4);
 			uint32_t loop_length = READ_U32(offset + 8);
 			uint8_t flags = READ_U8(offset + 14);
+			/* Same loop fixups as xm_load_xm0104_sample_header(),
+			   the length of ping-pong loops is needed for the guard
+			   frames */
+			uint32_t ping_pong_length = loop_length;
+			if((loop_start > sample_length ? sample_length : loop_start)
+			   + loop_length > sample_length
+			   || !(flags & SAMPLE_FLAG_PING_PONG)) {
+				ping_pong_length = 0;
+			}
 			sample_length = TRIM_SAMPLE_LENGTH(sample_length,
 			                                   loop_start,
 			                                   loop_length,
@@ -590,6 +1043,21 @@ static bool xm_prescan_xm0104(const char* moddata, uint32_t moddata_length,
 					NOTICE("sample %d of instrument %d is 16-bit with an odd length!", j, i+1);
 				}
 				sample_length /= 2;
+				ping_pong_length /= 2;
+			}
+			if(out->stream_min_length
+			   && sample_length >= out->stream_min_length) {
+				/* Streamed, see xm_load_xm0104_instrument() */
+				if(sample_length > MAX_STREAMED_SAMPLE_LENGTH) {
+					NOTICE("sample %d of instrument %d is too "
+					       "big to stream (%u > %u)",
+					       j, i+1, sample_length,
+					       MAX_STREAMED_SAMPLE_LENGTH);
+					return false;
+				}
+				inst_samples_bytes += sample_bytes;
+				offset += SAMPLE_HEADER_SIZE;
+				continue;
 			}
 			uint32_t max = MAX_SAMPLE_LENGTH;
 			if(flags & SAMPLE_FLAG_PING_PONG) max /= 2;
@@ -598,7 +1066,9 @@ static bool xm_prescan_xm0104(const char* moddata, uint32_t moddata_length,
 				       "(%u > %u)", j, i+1, sample_length, max);
 				return false;
 			}
-			out->samples_data_length += sample_length;
+			out->samples_data_length += sample_length
+				+ SAMPLE_GUARD_LENGTH(ping_pong_length,
+				                      ping_pong_length > 0);
 			inst_samples_bytes += sample_bytes;
 			offset += SAMPLE_HEADER_SIZE;
 		}
@@ -610,7 +1080,7 @@ static bool xm_prescan_xm0104(const char* moddata, uint32_t moddata_length,
 }
 
 static uint32_t xm_load_xm0104_module_header(xm_context_t* ctx,
-                                             const char* moddata,
+                                             xm_reader_t* reader,
                                              uint32_t moddata_length) {
 	uint32_t offset = 0;
 	xm_module_t* mod = &(ctx->module);
@@ -674,8 +1144,8 @@ static uint32_t xm_load_xm0104_module_header(xm_context_t* ctx,
 		NOTICE("clamping bpm (%u -> %u)", bpm, MAX_BPM);
 		bpm = MAX_BPM;
 	}
-	ctx->tempo = (uint8_t)tempo;
-	ctx->bpm = (uint8_t)bpm;
+	ctx->module.tempo = (uint8_t)tempo;
+	ctx->module.bpm = (uint8_t)bpm;
 
 	READ_MEMCPY(mod->pattern_table, offset + 20, PATTERN_ORDER_TABLE_LENGTH);
 
@@ -684,7 +1154,7 @@ static uint32_t xm_load_xm0104_module_header(xm_context_t* ctx,
 
 static uint32_t xm_load_xm0104_pattern(xm_context_t* ctx,
                                        xm_pattern_t* pat,
-                                       const char* moddata,
+                                       xm_reader_t* reader,
                                        uint32_t moddata_length,
                                        uint32_t offset) {
 	uint16_t packed_patterndata_size = READ_U16(offset + 7);
@@ -693,8 +1163,10 @@ static uint32_t xm_load_xm0104_pattern(xm_context_t* ctx,
 	assert(ctx->module.num_rows <= UINT16_MAX);
 	pat->rows_index = (uint16_t)ctx->module.num_rows;
 	ctx->module.num_rows += pat->num_rows;
-	xm_pattern_slot_t* slots = ctx->pattern_slots
-		+ pat->rows_index * ctx->module.num_channels;
+	/* rows[0] was set by the previous pattern, to the number of slots
+	   loaded so far */
+	uint32_t* rows = ctx->rows + pat->rows_index;
+	uint32_t n = rows[0];
 
 	uint8_t packing_type = READ_U8(offset + 4);
 	if(packing_type != 0) {
@@ -709,6 +1181,9 @@ static uint32_t xm_load_xm0104_pattern(xm_context_t* ctx,
 		ctx->module.num_rows -= pat->num_rows;
 		pat->num_rows = EMPTY_PATTERN_NUM_ROWS;
 		ctx->module.num_rows += pat->num_rows;
+		for(uint16_t r = 1; r <= pat->num_rows; ++r) {
+			rows[r] = n;
+		}
 		return offset;
 	}
 
@@ -716,65 +1191,96 @@ static uint32_t xm_load_xm0104_pattern(xm_context_t* ctx,
 	   pattern is truncated mid-slot. */
 	moddata_length = offset + packed_patterndata_size;
 
-	/* j counts bytes in the file, k counts pattern slots */
-	uint16_t j, k;
-	for(j = 0, k = 0; j < packed_patterndata_size; ++k) {
-		uint8_t note = READ_U8(offset + j);
-		xm_pattern_slot_t* slot = slots + k;
+	/* j counts bytes in the file, k counts pattern slots (empty or not).
+	   Extra slots after the last row are ignored. */
+	uint32_t num_slots = pat->num_rows * ctx->module.num_channels;
+	uint32_t j, k;
+	for(j = 0, k = 0; j < packed_patterndata_size && k < num_slots; ++k) {
+		uint8_t channel = (uint8_t)(k % ctx->module.num_channels);
+		if(channel == 0) {
+			rows[k / ctx->module.num_channels] = n;
+		}
 
-		if(note & (1 << 7)) {
-			/* MSB is set, this is a compressed packet */
-			++j;
+		xm_pattern_slot_t slot = {};
+		j += xm_load_xm0104_slot(&slot, reader, moddata_length,
+		                         offset + j);
+		if(!xm_slot_is_empty(&slot)) {
+			slot.channel = channel;
+			ctx->pattern_slots[n++] = slot;
+		}
+	}
 
-			if(note & (1 << 0)) {
-				/* Note follows */
-				slot->note = READ_U8(offset + j);
-				++j;
-			}
+	/* Rows that were not started (incomplete pattern data), and the start
+	   of the next pattern */
+	for(uint32_t r = (k + ctx->module.num_channels - 1)
+		    / ctx->module.num_channels; r <= pat->num_rows; ++r) {
+		rows[r] = n;
+	}
 
-			if(note & (1 << 1)) {
-				/* Instrument follows */
-				slot->instrument = READ_U8(offset + j);
-				++j;
-			}
+	if(k != num_slots) {
+		NOTICE("incomplete packed pattern data for pattern %ld, expected %u slots, got %u", pat - ctx->patterns, num_slots, k);
+	}
+	return offset + packed_patterndata_size;
+}
 
-			if(note & (1 << 2)) {
-				/* Volume column follows */
-				slot->volume_column = READ_U8(offset + j);
-				++j;
-			}
+/* Decode one slot of packed pattern data, only the fields found in the data
+   are written to slot.
+   @returns the number of bytes read */
+static uint8_t xm_load_xm0104_slot(xm_pattern_slot_t* slot,
+                                   xm_reader_t* reader,
+                                   uint32_t moddata_length,
+                                   uint32_t offset) {
+	uint8_t note = READ_U8(offset);
+
+	if(!(note & (1 << 7))) {
+		/* Uncompressed packet */
+		slot->note = note;
+		slot->instrument = READ_U8(offset + 1);
+		slot->volume_column = READ_U8(offset + 2);
+		slot->effect_type = READ_U8(offset + 3);
+		slot->effect_param = READ_U8(offset + 4);
+		return 5;
+	}
 
-			if(note & (1 << 3)) {
-				/* Effect follows */
-				slot->effect_type = READ_U8(offset + j);
-				++j;
-			}
+	/* MSB is set, this is a compressed packet */
+	uint8_t j = 1;
 
-			if(note & (1 << 4)) {
-				/* Effect parameter follows */
-				slot->effect_param = READ_U8(offset + j);
-				++j;
-			}
-		} else {
-			/* Uncompressed packet */
-			slot->note = note;
-			slot->instrument = READ_U8(offset + j + 1);
-			slot->volume_column = READ_U8(offset + j + 2);
-			slot->effect_type = READ_U8(offset + j + 3);
-			slot->effect_param = READ_U8(offset + j + 4);
-			j += 5;
-		}
+	if(note & (1 << 0)) {
+		/* Note follows */
+		slot->note = READ_U8(offset + j);
+		++j;
 	}
 
-	if(k != pat->num_rows * ctx->module.num_channels) {
-		NOTICE("incomplete packed pattern data for pattern %ld, expected %u slots, got %u", pat - ctx->patterns, pat->num_rows * ctx->module.num_channels, k);
+	if(note & (1 << 1)) {
+		/* Instrument follows */
+		slot->instrument = READ_U8(offset + j);
+		++j;
 	}
-	return offset + packed_patterndata_size;
+
+	if(note & (1 << 2)) {
+		/* Volume column follows */
+		slot->volume_column = READ_U8(offset + j);
+		++j;
+	}
+
+	if(note & (1 << 3)) {
+		/* Effect follows */
+		slot->effect_type = READ_U8(offset + j);
+		++j;
+	}
+
+	if(note & (1 << 4)) {
+		/* Effect parameter follows */
+		slot->effect_param = READ_U8(offset + j);
+		++j;
+	}
+
+	return j;
 }
 
 static uint32_t xm_load_xm0104_instrument(xm_context_t* ctx,
                                           xm_instrument_t* instr,
-                                          const char* moddata,
+                                          xm_reader_t* reader,
                                           uint32_t moddata_length,
                                           uint32_t offset) {
 	#if XM_STRINGS
@@ -809,9 +1315,9 @@ static uint32_t xm_load_xm0104_instrument(xm_context_t* ctx,
 	READ_MEMCPY(instr->sample_of_notes, offset + 33, NUM_NOTES);
 
 	xm_load_xm0104_envelope_points(&instr->volume_envelope,
-	                               moddata + offset + 129);
+	                               reader, offset + 129);
 	xm_load_xm0104_envelope_points(&instr->panning_envelope,
-	                               moddata + offset + 177);
+	                               reader, offset + 177);
 
 	instr->volume_envelope.num_points = READ_U8(offset + 225);
 	instr->panning_envelope.num_points = READ_U8(offset + 226);
@@ -847,11 +1353,11 @@ static uint32_t xm_load_xm0104_instrument(xm_context_t* ctx,
 	ctx->module.num_samples += instr->num_samples;
 	for(uint16_t i = 0; i < instr->num_samples; ++i) {
 		bool is_16bit;
-		offset = xm_load_xm0104_sample_header(ctx->samples + instr->samples_index + i, &is_16bit, moddata, moddata_length, offset);
+		offset = xm_load_xm0104_sample_header(ctx->samples + instr->samples_index + i, &is_16bit, reader, moddata_length, offset);
 		if(is_16bit) {
 			/* Find some free bit in the struct to pack the
 			   16bitness */
-			static_assert(MAX_SAMPLE_LENGTH < (1u << 31));
+			static_assert(MAX_STREAMED_SAMPLE_LENGTH < (1u << 31));
 			ctx->samples[instr->samples_index+i].length
 				|= (1u << 31);
 		}
@@ -865,37 +1371,58 @@ static uint32_t xm_load_xm0104_instrument(xm_context_t* ctx,
 		   actual sample length as stored in the context) */
 		xm_sample_point_t* sample_data = ctx->samples_data
 			+ ctx->module.samples_data_length;
-		if(s->length & (1u << 31)) {
-			s->length &= ~(1u << 31);
+		bool is_16bit = s->length & (1u << 31);
+		s->length &= ~(1u << 31);
+		if(reader->stream_min_length
+		   && s->length >= reader->stream_min_length) {
+			/* Leave the data in the module, it is read by the
+			   provider of xm_set_sample_provider() */
+			offset += is_16bit ? s->index * 2 : s->index;
+			s->index = STREAM_INDEX;
+			continue;
+		}
+		if(is_16bit) {
 			if(_Generic((xm_sample_point_t){},
 			            int8_t: true,
 			            default: false)) {
 				NOTICE("instrument %ld, sample %u will be dithered from 16 to 8 bits", instr - ctx->instruments + 1, i);
 			}
-			xm_load_xm0104_16b_sample_data(s->length, sample_data,
-			                               moddata, moddata_length,
-			                               offset);
+			if(!xm_defer_sample(ctx, reader, s,
+			                    LAZY_SAMPLE_XM0104_16B, offset)) {
+				xm_load_xm0104_16b_sample_data(s->length,
+				                               sample_data,
+				                               reader,
+				                               moddata_length,
+				                               offset);
+			}
 			offset += s->index * 2;
 		} else {
-			xm_load_xm0104_8b_sample_data(s->length, sample_data,
-			                              moddata, moddata_length,
-			                              offset);
+			if(!xm_defer_sample(ctx, reader, s,
+			                    LAZY_SAMPLE_XM0104_8B, offset)) {
+				xm_load_xm0104_8b_sample_data(s->length,
+				                              sample_data,
+				                              reader,
+				                              moddata_length,
+				                              offset);
+			}
 			offset += s->index;
 		}
 		s->index = ctx->module.samples_data_length;
-		ctx->module.samples_data_length += s->length;
+		ctx->module.samples_data_length += s->length
+			+ SAMPLE_GUARD_LENGTH(s->loop_length, s->ping_pong);
 	}
 
 	return offset;
 }
 
 static void xm_load_xm0104_envelope_points(xm_envelope_t* env,
-                                           const char* moddata) {
-	uint32_t moddata_length = MAX_ENVELOPE_POINTS * 4;
+                                           xm_reader_t* reader,
+                                           uint32_t offset) {
+	uint32_t moddata_length = offset + MAX_ENVELOPE_POINTS * 4;
 	uint16_t env_val;
 	for(uint8_t i = 0; i < MAX_ENVELOPE_POINTS; ++i) {
-		env->points[i].frame = READ_U16(4u * i);
-		env_val = READ_U16(4u * i + 2u);
+		env->points[i].frame = READ_U16(offset + 4u * i);
+		env_val = READ_U16(offset + 4u * i + 2u);
 		if(env_val > MAX_ENVELOPE_VALUE) {
 			NOTICE("clamped invalid envelope pt value (%u -> %u)",
 			       env_val, MAX_ENVELOPE_VALUE);
@@ -957,7 +1484,7 @@ static void xm_check_and_fix_envelope(xm_envelope_t* env, uint8_t flags) {
 }
 
 static uint32_t xm_load_xm0104_sample_header(xm_sample_t* sample, bool* is_16bit,
-                                             const char* moddata,
+                                             xm_reader_t* reader,
                                              uint32_t moddata_length,
                                              uint32_t offset) {
 	sample->length = READ_U32(offset);
@@ -1027,7 +1554,7 @@ static uint32_t xm_load_xm0104_sample_header(xm_sample_t* sample, bool* is_16bit
 
 static void xm_load_xm0104_8b_sample_data(uint32_t length,
                                           xm_sample_point_t* out,
-                                          const char* moddata,
+                                          xm_reader_t* reader,
                                           uint32_t moddata_length,
                                           uint32_t offset) {
 	int8_t v = 0;
@@ -1041,26 +1568,29 @@ static void xm_load_xm0104_8b_sample_data(uint32_t length,
 
 static void xm_load_xm0104_16b_sample_data(uint32_t length,
                                            xm_sample_point_t* out,
-                                           const char* moddata,
+                                           xm_reader_t* reader,
                                            uint32_t moddata_length,
                                            uint32_t offset) {
 	int16_t v = 0;
+	/* Dither noise restarts with every sample, so that samples decode to
+	   the same frames in any order (or concurrently) */
+	uint32_t dither = 1;
 	for(uint32_t k = 0; k < length; ++k) {
 		v += (int16_t)READ_U16(offset + (k << 1));
-		out[k] = SAMPLE_POINT_FROM_S16(v);
+		out[k] = SAMPLE_POINT_FROM_S16(v, &dither);
 	}
 }
 
 static void xm_load_xm0104(xm_context_t* ctx,
-                           const char* moddata, uint32_t moddata_length) {
+                           xm_reader_t* reader, uint32_t moddata_length) {
 	/* Read module header */
-	uint32_t offset = xm_load_xm0104_module_header(ctx, moddata,
+	uint32_t offset = xm_load_xm0104_module_header(ctx, reader,
 	                                               moddata_length);
 
 	/* Read pattern headers + slots */
 	for(uint16_t i = 0; i < ctx->module.num_patterns; ++i) {
 		offset = xm_load_xm0104_pattern(ctx, ctx->patterns + i,
-		                                moddata, moddata_length, offset);
+		                                reader, moddata_length, offset);
 	}
 
 	/* Scan for invalid patterns and replace by empty pattern */
@@ -1086,6 +1616,10 @@ static void xm_load_xm0104(xm_context_t* ctx,
 		assert(ctx->module.num_rows < UINT16_MAX);
 		ctx->patterns[ctx->module.num_patterns].rows_index
 			= (uint16_t)ctx->module.num_rows;
+		uint32_t* rows = ctx->rows + ctx->module.num_rows;
+		for(uint16_t r = 1; r <= EMPTY_PATTERN_NUM_ROWS; ++r) {
+			rows[r] = rows[0];
+		}
 		ctx->module.num_patterns += 1;
 		ctx->module.num_rows += EMPTY_PATTERN_NUM_ROWS;
 	}
@@ -1093,14 +1627,14 @@ static void xm_load_xm0104(xm_context_t* ctx,
 	/* Read instruments, samples and sample data */
 	for(uint16_t i = 0; i < ctx->module.num_instruments; ++i) {
 		offset = xm_load_xm0104_instrument(ctx, ctx->instruments + i,
-		                                   moddata, moddata_length,
+		                                   reader, moddata_length,
 		                                   offset);
 	}
 }
 
 /* ----- Amiga .MOD (M.K., xCHN, etc.): big endian ------ */
 
-static bool xm_prescan_mod(const char* moddata, uint32_t moddata_length,
+static bool xm_prescan_mod(xm_reader_t* reader, uint32_t moddata_length,
                            xm_prescan_data_t* p) {
 	assert(p->num_instruments > 0 && p->num_instruments <= MAX_INSTRUMENTS);
 	assert(p->num_channels > 0 && p->num_channels <= MAX_CHANNELS);
@@ -1118,7 +1652,8 @@ static bool xm_prescan_mod(const char* moddata, uint32_t moddata_length,
 			                            loop_length,
 			                            SAMPLE_FLAG_FORWARD);
 		}
-		p->samples_data_length += length;
+		p->samples_data_length += length
+			+ SAMPLE_GUARD_LENGTH(loop_length, false);
 	}
 
 	p->pot_length = READ_U8(950);
@@ -1139,11 +1674,19 @@ static bool xm_prescan_mod(const char* moddata, uint32_t moddata_length,
 		return false;
 	}
 
+	/* Count non-empty slots, empty slots are all zeroes */
+	p->num_slots = 0;
+	for(uint32_t i = 0; i < p->num_rows * p->num_channels; ++i) {
+		if(READ_U32BE(1084 + 4 * i)) {
+			p->num_slots += 1;
+		}
+	}
+
 	return true;
 }
 
 static void xm_load_mod(xm_context_t* ctx,
-                        const char* moddata, uint32_t moddata_length,
+                        xm_reader_t* reader, uint32_t moddata_length,
                         const xm_prescan_data_t* p) {
 	#if XM_STRINGS
 	static_assert(MODULE_NAME_LENGTH >= 21); /* +1 for NUL */
@@ -1151,8 +1694,8 @@ static void xm_load_mod(xm_context_t* ctx,
 	#endif
 
 	ctx->module.frequency_type = XM_AMIGA_FREQUENCIES;
-	ctx->bpm = 125;
-	ctx->tempo = 6;
+	ctx->module.bpm = 125;
+	ctx->module.tempo = 6;
 
 	ctx->module.num_channels = p->num_channels;
 	ctx->module.num_instruments = p->num_instruments;
@@ -1224,15 +1767,18 @@ static void xm_load_mod(xm_context_t* ctx,
 
 	/* Read patterns */
 	bool has_panning_effects = false;
+	uint32_t n = 0;
 	for(uint16_t i = 0; i < ctx->module.num_patterns; ++i) {
 		xm_pattern_t* pat = ctx->patterns + i;
 		pat->num_rows = 64;
 		pat->rows_index = 64 * i;
 
 		for(uint16_t j = 0; j < ctx->module.num_channels * pat->num_rows; ++j) {
-			xm_pattern_slot_t* slot = ctx->pattern_slots
-				+ pat->rows_index * ctx->module.num_channels
-				+ j;
+			uint8_t channel = (uint8_t)(j % ctx->module.num_channels);
+			if(channel == 0) {
+				ctx->rows[pat->rows_index
+				          + j / ctx->module.num_channels] = n;
+			}
 			/* 0bSSSSppppppppppppSSSSeeeePPPPPPPP
 			     ^ upper nibble of sample number
 			                     ^ lower nibble of sample number
@@ -1241,6 +1787,10 @@ static void xm_load_mod(xm_context_t* ctx,
 			                             ^ effect param */
 			uint32_t x = READ_U32BE(offset);
 			offset += 4;
+			if(x == 0) continue;
+
+			xm_pattern_slot_t* slot = ctx->pattern_slots + n++;
+			slot->channel = channel;
 			slot->instrument = (uint8_t)
 				(((x & 0xF0000000) >> 24) | ((x >> 12) & 0x0F));
 			slot->effect_type = (uint8_t)((x >> 8) & 0x0F);
@@ -1271,60 +1821,72 @@ static void xm_load_mod(xm_context_t* ctx,
 			}
 		}
 	}
+	ctx->rows[ctx->module.num_rows] = n;
 
 	/* Read sample data */
 	for(uint8_t i = 0; i < ctx->module.num_instruments; ++i) {
-		xm_sample_point_t* out = ctx->samples_data
-			+ ctx->module.samples_data_length;
-		for(uint32_t k = 0; k < ctx->samples[i].length; ++k) {
-			*out++ = SAMPLE_POINT_FROM_S8((int8_t)READ_U8(offset+k));
+		if(!xm_defer_sample(ctx, reader, ctx->samples + i,
+		                    LAZY_SAMPLE_MOD, offset)) {
+			xm_load_mod_sample_data(ctx->samples[i].length,
+			                        ctx->samples_data
+			                        + ctx->module.samples_data_length,
+			                        reader, moddata_length, offset);
 		}
 		offset += ctx->samples[i].index;
 		ctx->samples[i].index = ctx->module.samples_data_length;
-		ctx->module.samples_data_length += ctx->samples[i].length;
+		ctx->module.samples_data_length += ctx->samples[i].length
+			+ SAMPLE_GUARD_LENGTH(ctx->samples[i].loop_length,
+			                      false);
 	}
 
 	xm_pattern_slot_t* slot = ctx->pattern_slots;
-	for(uint32_t row = 0; row < ctx->module.num_rows; ++row) {
-		for(uint8_t ch = 0; ch < ctx->module.num_channels; ++ch) {
-			/* Emulate hard panning (LRRL LRRL etc) */
-			if(!has_panning_effects && slot->instrument) {
-				slot->volume_column =
-					(((ch >> 1) ^ ch) & 1) ? 0xCF : 0xC0;
-			}
+	for(uint32_t i = ctx->rows[ctx->module.num_rows]; i; --i, ++slot) {
+		uint8_t ch = slot->channel;
 
-			/* Imitate ProTracker 2/3 lacking effect memory for
-			   1xx/2xx/Axy (based on the MilkyTracker docs) */
-			if(slot->effect_param == 0) {
-				if(slot->effect_type == 0x1
-				   || slot->effect_type == 0x2
-				   || slot->effect_type == 0xA) {
-					slot->effect_type = 0;
-				}
-				if(slot->effect_type == 0x5
-				   || slot->effect_type == 0x6) {
-					slot->effect_type = 0x3;
-				}
-			}
+		/* Emulate hard panning (LRRL LRRL etc) */
+		if(!has_panning_effects && slot->instrument) {
+			slot->volume_column =
+				(((ch >> 1) ^ ch) & 1) ? 0xCF : 0xC0;
+		}
 
-			/* Convert 0xy arpeggio from ProTracker 2/3 semantics to
-			   Fasttracker II semantics */
-			if(slot->effect_type == 0) {
-				/* 0xy -> 0yx */
-				slot->effect_param = (uint8_t)
-					((slot->effect_param << 4)
-					 | (slot->effect_param >> 4));
+		/* Imitate ProTracker 2/3 lacking effect memory for
+		   1xx/2xx/Axy (based on the MilkyTracker docs) */
+		if(slot->effect_param == 0) {
+			if(slot->effect_type == 0x1
+			   || slot->effect_type == 0x2
+			   || slot->effect_type == 0xA) {
+				slot->effect_type = 0;
 			}
-
-			/* Convert E5y finetune from ProTracker 2/3 semantics to
-			   Fasttracker II semantics */
-			if(slot->effect_type == 0xE
-			   && slot->effect_param >> 4 == 0x5) {
-				/* E50 -> E58, E51 ->  E59, ..., E5F -> E57 */
-				slot->effect_param ^= 0b00001000;
+			if(slot->effect_type == 0x5
+			   || slot->effect_type == 0x6) {
+				slot->effect_type = 0x3;
 			}
+		}
+
+		/* Convert 0xy arpeggio from ProTracker 2/3 semantics to
+		   Fasttracker II semantics */
+		if(slot->effect_type == 0) {
+			/* 0xy -> 0yx */
+			slot->effect_param = (uint8_t)
+				((slot->effect_param << 4)
+				 | (slot->effect_param >> 4));
+		}
 
-			slot++;
+		/* Convert E5y finetune from ProTracker 2/3 semantics to
+		   Fasttracker II semantics */
+		if(slot->effect_type == 0xE
+		   && slot->effect_param >> 4 == 0x5) {
+			/* E50 -> E58, E51 ->  E59, ..., E5F -> E57 */
+			slot->effect_param ^= 0b00001000;
 		}
 	}
 }
+
+static void xm_load_mod_sample_data(uint32_t length, xm_sample_point_t* out,
+                                    xm_reader_t* reader,
+                                    uint32_t moddata_length,
+                                    uint32_t offset) {
+	for(uint32_t k = 0; k < length; ++k) {
+		out[k] = SAMPLE_POINT_FROM_S8((int8_t)READ_U8(offset + k));
+	}
+}
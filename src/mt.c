@@ -0,0 +1,613 @@
+/* This program is free software. It comes without any warranty, to the
+ * extent permitted by applicable law. You can redistribute it and/or
+ * modify it under the terms of the Do What The Fuck You Want To Public
+ * License, Version 2, as published by Sam Hocevar. See
+ * http://sam.zoy.org/wtfpl/COPYING for more details. */
+
+#include <xm_mt.h>
+#include <assert.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <threads.h>
+
+/* Workers are kept on separate cache lines, so that claiming jobs on one
+   worker doesn't invalidate the cache of the others */
+#define CACHE_LINE_SIZE 64
+
+/* Maximum length of the spans given to each thread by
+   xm_batch_generate_samples_channels() */
+#define CHANNEL_SPAN_LENGTH 1024
+
+/* Maximum number of player commands waiting to be applied, must be a power
+   of 2 */
+#define PLAYER_COMMANDS 64
+
+/* Biggest ring of a player, in frames. Frame counters wrap around at
+   2^32, so this must stay well below 2^31. */
+#define PLAYER_MAX_RING_LENGTH (1u << 24)
+
+/* How long the player thread sleeps when the ring is full */
+#define PLAYER_SLEEP_NS 1000000
+
+/* Indices of xm_player_t.sides */
+#define PLAYER_THREAD 0
+#define AUDIO_THREAD 1
+
+struct xm_worker_state_s {
+	atomic_uint next; /* Next job to claim, jobs are next..end */
+	uint32_t end;
+	struct xm_batch_s* batch;
+	thrd_t thread;
+};
+typedef struct xm_worker_state_s xm_worker_state_t;
+
+struct xm_worker_s {
+	alignas(CACHE_LINE_SIZE) xm_worker_state_t s;
+	char __pad[CACHE_LINE_SIZE - sizeof(xm_worker_state_t)];
+};
+typedef struct xm_worker_s xm_worker_t;
+static_assert(sizeof(xm_worker_t) == CACHE_LINE_SIZE);
+
+/* Counters of a player, only written by one thread. The counters of the
+   player thread and of the audio thread are kept on separate cache lines. */
+struct xm_player_side_state_s {
+	atomic_uint frames; /* Frames rendered by the player thread, or read
+	                       by the audio thread (mod 2^32) */
+	atomic_uint commands; /* Commands applied by the player thread, or
+	                         queued by the audio thread (mod 2^32) */
+	atomic_uint seeked; /* Player thread only, frames rendered before the
+	                       last seek, that the audio thread skips */
+};
+typedef struct xm_player_side_state_s xm_player_side_state_t;
+
+struct xm_player_side_s {
+	alignas(CACHE_LINE_SIZE) xm_player_side_state_t s;
+	char __pad[CACHE_LINE_SIZE - sizeof(xm_player_side_state_t)];
+};
+typedef struct xm_player_side_s xm_player_side_t;
+static_assert(sizeof(xm_player_side_t) == CACHE_LINE_SIZE);
+
+struct xm_player_command_s {
+	float volume;
+	enum: uint8_t {
+		XM_PLAYER_MUTE_CHANNEL,
+		XM_PLAYER_MUTE_INSTRUMENT,
+		XM_PLAYER_SEEK,
+		XM_PLAYER_SET_VOLUME,
+	} type;
+	uint8_t args[3]; /* Channel or instrument and mute flag, or pot, row
+	                    and tick */
+};
+typedef struct xm_player_command_s xm_player_command_t;
+
+struct xm_player_s {
+	xm_player_side_t* sides;
+	xm_context_t* ctx;
+	float* ring; /* 2*ring_length floats, interleaved */
+	thrd_t thread;
+	xm_player_command_t commands[PLAYER_COMMANDS];
+	uint32_t ring_length; /* In frames, power of 2 */
+	float volume; /* Only used by the player thread */
+	atomic_bool quit;
+	char __pad[UINTPTR_MAX == UINT64_MAX ? 7 : 3];
+};
+
+struct xm_batch_s {
+	mtx_t lock;
+	cnd_t wake; /* New jobs were posted, or the batch is being freed */
+	cnd_t done; /* All workers are done with the current jobs */
+
+	void (*run)(struct xm_batch_s*, uint32_t); /* Run one job */
+	xm_worker_t* workers; /* workers[0] is the calling thread */
+
+	/* Jobs of xm_batch_generate_samples() */
+	xm_context_t* const* contexts;
+	float* const* outputs;
+
+	/* Jobs of xm_batch_generate_samples_channels() */
+	xm_context_t* ctx;
+	float* scratch; /* scratch_channels*2*CHANNEL_SPAN_LENGTH floats */
+	bool* mixed; /* scratch_channels bools */
+
+	/* Jobs of xm_batch_create_context() (also uses ctx) */
+	const char* moddata; /* moddata..moddata_end */
+	const char* moddata_end;
+
+	atomic_uint running; /* Number of workers still busy with the current
+	                        jobs */
+	uint32_t generation; /* Incremented every time jobs are posted */
+	uint16_t num_jobs;
+	uint16_t numsamples;
+	uint16_t scratch_channels;
+	uint8_t num_workers;
+	bool quit;
+};
+
+/* ----- Static functions ----- */
+
+static bool xm_batch_claim(xm_worker_t*, uint32_t*) __attribute__((warn_unused_result)) __attribute__((nonnull));
+static void xm_batch_work(xm_batch_t*, uint8_t) __attribute__((nonnull));
+static int xm_batch_thread(void*) __attribute__((nonnull));
+static void xm_batch_run(xm_batch_t*, uint16_t, void (*)(xm_batch_t*, uint32_t)) __attribute__((nonnull));
+static void xm_batch_context_job(xm_batch_t*, uint32_t) __attribute__((nonnull));
+static void xm_batch_channel_job(xm_batch_t*, uint32_t) __attribute__((nonnull));
+static void xm_batch_instrument_job(xm_batch_t*, uint32_t) __attribute__((nonnull));
+static int xm_player_thread(void*) __attribute__((nonnull));
+static void xm_player_apply_commands(xm_player_t*) __attribute__((nonnull));
+static bool xm_player_queue(xm_player_t*, xm_player_command_t) __attribute__((nonnull));
+static uint32_t xm_player_begin_read(xm_player_t*, uint32_t*, uint32_t) __attribute__((nonnull));
+
+/* ----- Function definitions ----- */
+
+/* Claim the next job of a worker.
+
+   @returns true if a job was claimed and written to *job */
+static bool xm_batch_claim(xm_worker_t* w, uint32_t* job) {
+	if(atomic_load_explicit(&w->s.next, memory_order_relaxed) >= w->s.end) {
+		/* Don't bother bumping the counter of an empty queue */
+		return false;
+	}
+	*job = atomic_fetch_add_explicit(&w->s.next, 1, memory_order_relaxed);
+	return *job < w->s.end;
+}
+
+/* Run all the jobs of worker i, then steal jobs from the other workers
+   until there is nothing left to do */
+static void xm_batch_work(xm_batch_t* b, uint8_t i) {
+	uint32_t job;
+	for(uint8_t k = 0; k < b->num_workers; ++k) {
+		xm_worker_t* w = b->workers + (i + k) % b->num_workers;
+		while(xm_batch_claim(w, &job)) {
+			b->run(b, job);
+		}
+	}
+
+	if(atomic_fetch_sub_explicit(&b->running, 1,
+	                             memory_order_acq_rel) == 1) {
+		mtx_lock(&b->lock);
+		cnd_signal(&b->done);
+		mtx_unlock(&b->lock);
+	}
+}
+
+static int xm_batch_thread(void* arg) {
+	xm_worker_t* w = arg;
+	xm_batch_t* b = w->s.batch;
+	uint8_t i = (uint8_t)(w - b->workers);
+	uint32_t generation = 0;
+
+	mtx_lock(&b->lock);
+	for(;;) {
+		while(!b->quit && b->generation == generation) {
+			cnd_wait(&b->wake, &b->lock);
+		}
+		if(b->quit) break;
+		generation = b->generation;
+		mtx_unlock(&b->lock);
+		xm_batch_work(b, i);
+		mtx_lock(&b->lock);
+	}
+	mtx_unlock(&b->lock);
+	return 0;
+}
+
+xm_batch_t* xm_create_batch(uint8_t num_threads) {
+	if(num_threads == 0) return NULL;
+
+	xm_batch_t* b = calloc(1, sizeof(xm_batch_t));
+	if(b == NULL) return NULL;
+	b->workers = aligned_alloc(CACHE_LINE_SIZE,
+	                           sizeof(xm_worker_t) * num_threads);
+	if(b->workers == NULL) {
+		free(b);
+		return NULL;
+	}
+	__builtin_memset(b->workers, 0, sizeof(xm_worker_t) * num_threads);
+
+	if(mtx_init(&b->lock, mtx_plain) != thrd_success) goto err_lock;
+	if(cnd_init(&b->wake) != thrd_success) goto err_wake;
+	if(cnd_init(&b->done) != thrd_success) goto err_done;
+
+	for(b->num_workers = 1; b->num_workers < num_threads;
+	    ++b->num_workers) {
+		xm_worker_t* w = b->workers + b->num_workers;
+		w->s.batch = b;
+		if(thrd_create(&w->s.thread, xm_batch_thread, w)
+		   != thrd_success) {
+			xm_free_batch(b);
+			return NULL;
+		}
+	}
+
+	return b;
+
+ err_done:
+	cnd_destroy(&b->wake);
+ err_wake:
+	mtx_destroy(&b->lock);
+ err_lock:
+	free(b->workers);
+	free(b);
+	return NULL;
+}
+
+void xm_free_batch(xm_batch_t* b) {
+	mtx_lock(&b->lock);
+	b->quit = true;
+	cnd_broadcast(&b->wake);
+	mtx_unlock(&b->lock);
+
+	for(uint8_t i = 1; i < b->num_workers; ++i) {
+		thrd_join(b->workers[i].s.thread, NULL);
+	}
+
+	cnd_destroy(&b->done);
+	cnd_destroy(&b->wake);
+	mtx_destroy(&b->lock);
+	free(b->scratch);
+	free(b->mixed);
+	free(b->workers);
+	free(b);
+}
+
+/* Run num_jobs jobs on all workers, and wait for them to finish */
+static void xm_batch_run(xm_batch_t* b, uint16_t num_jobs,
+                         void (*run)(xm_batch_t*, uint32_t)) {
+	mtx_lock(&b->lock);
+	assert(atomic_load(&b->running) == 0);
+	b->run = run;
+	b->num_jobs = num_jobs;
+
+	/* Split jobs in contiguous ranges, so that a job keeps being
+	   processed by the same worker as long as num_jobs stays the same */
+	for(uint8_t i = 0; i < b->num_workers; ++i) {
+		xm_worker_t* w = b->workers + i;
+		atomic_store_explicit(&w->s.next,
+		                      (uint32_t)num_jobs * i / b->num_workers,
+		                      memory_order_relaxed);
+		w->s.end = (uint32_t)num_jobs * (i + 1u) / b->num_workers;
+	}
+
+	atomic_store_explicit(&b->running, b->num_workers,
+	                      memory_order_relaxed);
+	b->generation++;
+	cnd_broadcast(&b->wake);
+	mtx_unlock(&b->lock);
+
+	xm_batch_work(b, 0);
+
+	mtx_lock(&b->lock);
+	while(atomic_load_explicit(&b->running, memory_order_acquire) > 0) {
+		cnd_wait(&b->done, &b->lock);
+	}
+	mtx_unlock(&b->lock);
+}
+
+static void xm_batch_context_job(xm_batch_t* b, uint32_t i) {
+	xm_generate_samples(b->contexts[i], b->outputs[i], b->numsamples);
+}
+
+static void xm_batch_channel_job(xm_batch_t* b, uint32_t i) {
+	float* out = b->scratch + i * 2 * CHANNEL_SPAN_LENGTH;
+	__builtin_memset(out, 0, sizeof(float) * 2 * b->numsamples);
+	b->mixed[i] = xm_mix_channel_span(b->ctx, (uint8_t)(i + 1), out,
+	                                  b->numsamples);
+}
+
+static void xm_batch_instrument_job(xm_batch_t* b, uint32_t i) {
+	xm_decode_instrument(b->ctx, b->moddata,
+	                     (uint32_t)(b->moddata_end - b->moddata),
+	                     (uint8_t)(i + 1));
+}
+
+void xm_batch_generate_samples(xm_batch_t* b, xm_context_t* const* contexts,
+                               float* const* outputs, uint16_t num_contexts,
+                               uint16_t numsamples) {
+	b->contexts = contexts;
+	b->outputs = outputs;
+	b->numsamples = numsamples;
+	xm_batch_run(b, num_contexts, xm_batch_context_job);
+}
+
+void xm_batch_generate_samples_channels(xm_batch_t* b, xm_context_t* ctx,
+                                        float* output,
+                                        uint16_t numsamples) {
+	uint8_t num_channels = xm_get_number_of_channels(ctx);
+	if(b->scratch_channels < num_channels) {
+		free(b->scratch);
+		free(b->mixed);
+		b->scratch = malloc(sizeof(float) * 2 * CHANNEL_SPAN_LENGTH
+		                    * num_channels);
+		b->mixed = malloc(sizeof(bool) * num_channels);
+		if(b->scratch == NULL || b->mixed == NULL) {
+			free(b->scratch);
+			free(b->mixed);
+			b->scratch = NULL;
+			b->mixed = NULL;
+			b->scratch_channels = 0;
+			/* Still generate the correct samples */
+			xm_generate_samples(ctx, output, numsamples);
+			return;
+		}
+		b->scratch_channels = num_channels;
+	}
+
+	__builtin_memset(output, 0, sizeof(float) * 2 * numsamples);
+	b->ctx = ctx;
+	bool silent = true;
+	xm_begin_spans(ctx);
+	while(numsamples) {
+		b->numsamples = xm_begin_span(ctx, numsamples < CHANNEL_SPAN_LENGTH
+		                              ? numsamples : CHANNEL_SPAN_LENGTH);
+		xm_batch_run(b, num_channels, xm_batch_channel_job);
+
+		/* Reduce in channel order, exactly like xm_generate_samples()
+		   mixes channels */
+		for(uint8_t c = 0; c < num_channels; ++c) {
+			if(!b->mixed[c]) continue;
+			silent = false;
+			const float* in = b->scratch + c * 2 * CHANNEL_SPAN_LENGTH;
+			for(uint16_t i = 0; i < 2 * b->numsamples; ++i) {
+				output[i] += in[i];
+			}
+		}
+
+		output += 2 * b->numsamples;
+		numsamples -= b->numsamples;
+	}
+	xm_end_spans(ctx, silent);
+}
+
+xm_context_t* xm_batch_create_context(xm_batch_t* b, char* pool,
+                                      const xm_prescan_data_t* p,
+                                      const char* moddata,
+                                      uint32_t moddata_length,
+                                      uint32_t rate) {
+	/* Headers and patterns first, this also assigns every sample its
+	   place in the pool */
+	xm_context_t* ctx = xm_create_context_lazy(pool, p, moddata,
+	                                           moddata_length, rate);
+
+	b->ctx = ctx;
+	b->moddata = moddata;
+	b->moddata_end = moddata + moddata_length;
+	xm_batch_run(b, xm_get_number_of_instruments(ctx),
+	             xm_batch_instrument_job);
+
+	[[maybe_unused]] uint16_t left = xm_decode_samples(ctx, moddata,
+	                                                   moddata_length,
+	                                                   UINT32_MAX);
+	assert(left == 0);
+	return ctx;
+}
+
+/* Apply the commands queued by the audio thread. Only called once the
+   latest span has ended a tick, so commands are always applied at tick
+   boundaries. */
+static void xm_player_apply_commands(xm_player_t* pl) {
+	xm_player_side_state_t* own = &pl->sides[PLAYER_THREAD].s;
+	uint32_t done = atomic_load_explicit(&own->commands,
+	                                     memory_order_relaxed);
+	uint32_t queued = atomic_load_explicit(
+		&pl->sides[AUDIO_THREAD].s.commands, memory_order_acquire);
+
+	for(; done != queued; ++done) {
+		const xm_player_command_t* c =
+			pl->commands + done % PLAYER_COMMANDS;
+		switch(c->type) {
+		case XM_PLAYER_MUTE_CHANNEL:
+			xm_mute_channel(pl->ctx, c->args[0], c->args[1]);
+			break;
+		case XM_PLAYER_MUTE_INSTRUMENT:
+			xm_mute_instrument(pl->ctx, c->args[0], c->args[1]);
+			break;
+		case XM_PLAYER_SEEK:
+			xm_seek(pl->ctx, c->args[0], c->args[1], c->args[2]);
+			/* Everything rendered so far is from before the seek */
+			atomic_store_explicit(&own->seeked,
+			                      atomic_load_explicit(&own->frames,
+			                      memory_order_relaxed),
+			                      memory_order_release);
+			break;
+		case XM_PLAYER_SET_VOLUME:
+			pl->volume = c->volume;
+			break;
+		}
+	}
+
+	atomic_store_explicit(&own->commands, done, memory_order_release);
+}
+
+static int xm_player_thread(void* arg) {
+	xm_player_t* pl = arg;
+	xm_player_side_state_t* own = &pl->sides[PLAYER_THREAD].s;
+	uint8_t num_channels = xm_get_number_of_channels(pl->ctx);
+	uint32_t rendered = 0;
+	/* The context may have been played before, only trust spans shorter
+	   than requested: xm_begin_span() cut them at the end of a tick */
+	bool tick_over = false;
+
+	while(!atomic_load_explicit(&pl->quit, memory_order_relaxed)) {
+		if(tick_over) xm_player_apply_commands(pl);
+
+		uint32_t read = atomic_load_explicit(
+			&pl->sides[AUDIO_THREAD].s.frames, memory_order_acquire);
+		uint32_t at = rendered % pl->ring_length;
+		uint32_t n = pl->ring_length - (rendered - read);
+		if(n > pl->ring_length - at) n = pl->ring_length - at;
+		if(n > UINT16_MAX) n = UINT16_MAX;
+		if(n == 0) {
+			thrd_sleep(&(struct timespec){ .tv_nsec = PLAYER_SLEEP_NS },
+			           NULL);
+			continue;
+		}
+
+		/* One span at most, so that the next commands are applied as
+		   soon as the tick is over */
+		xm_begin_spans(pl->ctx);
+		uint16_t span = xm_begin_span(pl->ctx, (uint16_t)n);
+		tick_over = span < n;
+		n = span;
+		float* out = pl->ring + 2 * at;
+		__builtin_memset(out, 0, sizeof(float) * 2 * n);
+		bool silent = true;
+		for(uint8_t c = 1; c <= num_channels; ++c) {
+			if(xm_mix_channel_span(pl->ctx, c, out, (uint16_t)n)) {
+				silent = false;
+			}
+		}
+		xm_end_spans(pl->ctx, silent);
+		if(pl->volume != 1.f) {
+			for(uint32_t i = 0; i < 2 * n; ++i) {
+				out[i] *= pl->volume;
+			}
+		}
+
+		rendered += n;
+		atomic_store_explicit(&own->frames, rendered,
+		                      memory_order_release);
+	}
+
+	return 0;
+}
+
+xm_player_t* xm_create_player(xm_context_t* ctx, uint32_t ring_length) {
+	if(ring_length == 0 || ring_length > PLAYER_MAX_RING_LENGTH) {
+		return NULL;
+	}
+
+	xm_player_t* pl = calloc(1, sizeof(xm_player_t));
+	if(pl == NULL) return NULL;
+	pl->ctx = ctx;
+	pl->volume = 1.f;
+	for(pl->ring_length = 1; pl->ring_length < ring_length;
+	    pl->ring_length *= 2);
+
+	pl->ring = malloc(sizeof(float) * 2 * pl->ring_length);
+	pl->sides = aligned_alloc(CACHE_LINE_SIZE, sizeof(xm_player_side_t) * 2);
+	if(pl->ring == NULL || pl->sides == NULL) goto err;
+	__builtin_memset(pl->sides, 0, sizeof(xm_player_side_t) * 2);
+
+	if(thrd_create(&pl->thread, xm_player_thread, pl) != thrd_success) {
+		goto err;
+	}
+	return pl;
+
+ err:
+	free(pl->sides);
+	free(pl->ring);
+	free(pl);
+	return NULL;
+}
+
+void xm_free_player(xm_player_t* pl) {
+	atomic_store_explicit(&pl->quit, true, memory_order_relaxed);
+	thrd_join(pl->thread, NULL);
+	free(pl->sides);
+	free(pl->ring);
+	free(pl);
+}
+
+/* Skip frames rendered before a seek, and find the frames that can be read.
+
+   @param read where to store the position of the first frame to read
+   @returns the number of frames to read, at most numsamples, and never
+   wrapping around the end of the ring */
+static uint32_t xm_player_begin_read(xm_player_t* pl, uint32_t* read,
+                                     uint32_t numsamples) {
+	const xm_player_side_state_t* player = &pl->sides[PLAYER_THREAD].s;
+	*read = atomic_load_explicit(&pl->sides[AUDIO_THREAD].s.frames,
+	                             memory_order_relaxed);
+	uint32_t seeked = atomic_load_explicit(&player->seeked,
+	                                       memory_order_acquire);
+	if((int32_t)(seeked - *read) > 0) *read = seeked;
+
+	uint32_t n = atomic_load_explicit(&player->frames,
+	                                  memory_order_acquire) - *read;
+	if(n > numsamples) n = numsamples;
+	uint32_t at = *read % pl->ring_length;
+	if(n > pl->ring_length - at) n = pl->ring_length - at;
+	return n;
+}
+
+uint32_t xm_player_read(xm_player_t* pl, float* output, uint32_t numsamples) {
+	uint32_t total = 0, read, n;
+	/* At most two copies, if the frames wrap around the end of the
+	   ring */
+	while((n = xm_player_begin_read(pl, &read, numsamples - total))) {
+		__builtin_memcpy(output + 2 * total,
+		                 pl->ring + 2 * (read % pl->ring_length),
+		                 sizeof(float) * 2 * n);
+		total += n;
+		atomic_store_explicit(&pl->sides[AUDIO_THREAD].s.frames,
+		                      read + n, memory_order_release);
+	}
+	__builtin_memset(output + 2 * total, 0,
+	                 sizeof(float) * 2 * (numsamples - total));
+	return total;
+}
+
+uint32_t xm_player_read_noninterleaved(xm_player_t* pl, float* output_left,
+                                       float* output_right,
+                                       uint32_t numsamples) {
+	uint32_t total = 0, read, n;
+	while((n = xm_player_begin_read(pl, &read, numsamples - total))) {
+		const float* in = pl->ring + 2 * (read % pl->ring_length);
+		for(uint32_t i = 0; i < n; ++i) {
+			output_left[total + i] = in[2 * i];
+			output_right[total + i] = in[2 * i + 1];
+		}
+		total += n;
+		atomic_store_explicit(&pl->sides[AUDIO_THREAD].s.frames,
+		                      read + n, memory_order_release);
+	}
+	for(uint32_t i = total; i < numsamples; ++i) {
+		output_left[i] = .0f;
+		output_right[i] = .0f;
+	}
+	return total;
+}
+
+/* @returns false if the command queue is full */
+static bool xm_player_queue(xm_player_t* pl, xm_player_command_t c) {
+	xm_player_side_state_t* own = &pl->sides[AUDIO_THREAD].s;
+	uint32_t queued = atomic_load_explicit(&own->commands,
+	                                       memory_order_relaxed);
+	uint32_t done = atomic_load_explicit(
+		&pl->sides[PLAYER_THREAD].s.commands, memory_order_acquire);
+	if(queued - done >= PLAYER_COMMANDS) return false;
+
+	pl->commands[queued % PLAYER_COMMANDS] = c;
+	atomic_store_explicit(&own->commands, queued + 1,
+	                      memory_order_release);
+	return true;
+}
+
+bool xm_player_mute_channel(xm_player_t* pl, uint8_t channel, bool mute) {
+	return xm_player_queue(pl, (xm_player_command_t){
+			.type = XM_PLAYER_MUTE_CHANNEL,
+			.args = { channel, mute },
+		});
+}
+
+bool xm_player_mute_instrument(xm_player_t* pl, uint8_t instr, bool mute) {
+	return xm_player_queue(pl, (xm_player_command_t){
+			.type = XM_PLAYER_MUTE_INSTRUMENT,
+			.args = { instr, mute },
+		});
+}
+
+bool xm_player_seek(xm_player_t* pl, uint8_t pot, uint8_t row,
+                    uint8_t tick) {
+	return xm_player_queue(pl, (xm_player_command_t){
+			.type = XM_PLAYER_SEEK,
+			.args = { pot, row, tick },
+		});
+}
+
+bool xm_player_set_volume(xm_player_t* pl, float volume) {
+	return xm_player_queue(pl, (xm_player_command_t){
+			.type = XM_PLAYER_SET_VOLUME,
+			.volume = volume,
+		});
+}
@@ -9,6 +9,63 @@
 
 #include "xm_internal.h"
 
+/* A seek index is laid out as: the xm_seek_index_t header, max_snapshots
+   snapshots of snapshot_size bytes each (a xm_seek_snapshot_t followed by
+   the num_channels channel contexts), then the list of rows (as
+   MAX_ROWS_PER_PATTERN * table index + row) in the order they were first
+   visited. The list is enough to rebuild ctx->row_loop_count, as every row
+   is visited at most once before the module loops. */
+struct xm_seek_index_s {
+	const xm_context_t* ctx; /* Snapshots contain pointers to this
+	                            context */
+	uint32_t length; /* Samples until the module loops */
+	uint32_t generated_samples; /* Of ctx, when the index was built */
+	uint32_t rows_per_snapshot;
+	uint16_t num_snapshots;
+	uint16_t max_snapshots;
+	char __pad[UINTPTR_MAX == UINT64_MAX ? 8 : 4];
+};
+
+struct xm_seek_snapshot_s {
+	uint32_t position; /* In samples since the start of the index */
+	uint32_t num_visits; /* Length of the visited rows list */
+	uint32_t remaining_samples_in_tick;
+	#if XM_RAMPING
+	xm_ghost_t ghosts[MAX_GHOSTS];
+	#endif
+	uint8_t current_tick;
+	uint8_t extra_rows_done;
+	uint8_t current_row;
+	uint8_t extra_rows;
+	uint8_t current_table_index;
+	uint8_t global_volume;
+	uint8_t tempo;
+	uint8_t bpm;
+	bool position_jump;
+	bool pattern_break;
+	uint8_t jump_dest;
+	uint8_t jump_row;
+	uint8_t loop_count;
+	char __pad[7];
+};
+typedef struct xm_seek_snapshot_s xm_seek_snapshot_t;
+static_assert(sizeof(xm_seek_index_t) % alignof(xm_channel_context_t) == 0);
+static_assert(sizeof(xm_seek_snapshot_t) % alignof(xm_channel_context_t)
+              == 0);
+
+#define SEEK_SNAPSHOT_SIZE(ctx) ((uint32_t)(sizeof(xm_seek_snapshot_t) \
+	+ sizeof(xm_channel_context_t) * (ctx)->module.num_channels))
+
+/* One instance of the mixer, specialised for a combination of quality
+   features, see xm_mix_kernel() */
+struct xm_mix_kernel_s {
+	bool (*mix)(xm_context_t*, xm_channel_context_t*, float*, float*,
+	            uint16_t, uint16_t);
+	bool (*mix_s16)(xm_context_t*, xm_channel_context_t*, int32_t*,
+	                uint16_t);
+};
+typedef struct xm_mix_kernel_s xm_mix_kernel_t;
+
 /* ----- Static functions ----- */
 
 static int8_t xm_waveform(uint8_t, uint8_t) __attribute__((warn_unused_result));
@@ -26,32 +83,95 @@ static uint8_t xm_envelope_lerp(const xm_envelope_point_t*, const xm_envelope_po
 static void xm_tick_envelope(xm_channel_context_t*, const xm_envelope_t*, uint16_t*, uint8_t*) __attribute__((nonnull));
 static void xm_tick_envelopes(xm_channel_context_t*) __attribute__((nonnull));
 
+#if XM_PROFILING
+static uint64_t xm_profile_now(void) __attribute__((warn_unused_result));
+#endif
+
+static void xm_update_period_steps(xm_context_t*) __attribute__((nonnull));
+static uint32_t xm_octave_step(const xm_context_t*, int32_t) __attribute__((warn_unused_result)) __attribute__((nonnull));
+static float xm_octave_ratio(const xm_context_t*, int32_t) __attribute__((warn_unused_result)) __attribute__((nonnull));
+
 static uint16_t xm_linear_period(int16_t) __attribute__((warn_unused_result));
-static uint32_t xm_linear_frequency(xm_channel_context_t*) __attribute__((warn_unused_result)) __attribute__((nonnull));
+static uint32_t xm_linear_step(const xm_context_t*, const xm_channel_context_t*) __attribute__((warn_unused_result)) __attribute__((nonnull));
 static uint16_t xm_amiga_period(int16_t) __attribute__((warn_unused_result));
-static uint32_t xm_amiga_frequency(xm_channel_context_t*) __attribute__((warn_unused_result)) __attribute__((nonnull));
+static uint32_t xm_amiga_step(const xm_context_t*, const xm_channel_context_t*) __attribute__((warn_unused_result)) __attribute__((nonnull));
 
 static uint16_t xm_period(xm_context_t*, int16_t) __attribute__((warn_unused_result)) __attribute__((nonnull));
-static uint32_t xm_frequency(xm_context_t*, xm_channel_context_t*) __attribute__((warn_unused_result)) __attribute__((nonnull));
+static uint32_t xm_step(xm_context_t*, xm_channel_context_t*) __attribute__((warn_unused_result)) __attribute__((nonnull));
 
 static void xm_handle_pattern_slot(xm_context_t*, xm_channel_context_t*) __attribute__((nonnull));
 static void xm_trigger_instrument(xm_context_t*, xm_channel_context_t*) __attribute__((nonnull));
 static void xm_trigger_note(xm_context_t*, xm_channel_context_t*) __attribute__((nonnull));
 static void xm_cut_note(xm_channel_context_t*) __attribute__((nonnull));
+static void xm_ghost_voice(xm_context_t*, xm_channel_context_t*, const xm_sample_t*) __attribute__((nonnull(1, 2)));
+static bool xm_has_ghosts(const xm_context_t*, const xm_channel_context_t*) __attribute__((warn_unused_result)) __attribute__((nonnull));
+static void xm_kill_ghosts(xm_context_t*, const xm_channel_context_t*) __attribute__((nonnull));
 static void xm_key_off(xm_context_t*, xm_channel_context_t*) __attribute__((nonnull));
 
 static void xm_post_pattern_change(xm_context_t*) __attribute__((nonnull));
+#if XM_EVENTS
+static void xm_event(xm_context_t*, uint8_t, uint8_t, uint8_t, uint8_t) __attribute__((nonnull));
+#endif
+static void xm_apply_jumps(xm_context_t*) __attribute__((nonnull));
 static void xm_row(xm_context_t*) __attribute__((nonnull));
 static void xm_tick(xm_context_t*) __attribute__((nonnull));
+static void xm_update_active_channels(xm_context_t*) __attribute__((nonnull));
 
+static inline const xm_sample_point_t* xm_sample_data(const xm_context_t*, const xm_sample_t*) __attribute__((warn_unused_result)) __attribute__((nonnull)) __attribute__((returns_nonnull));
 static float xm_sample_at(const xm_context_t*, const xm_sample_t*, uint32_t) __attribute__((warn_unused_result)) __attribute__((nonnull));
-static float xm_next_of_sample(xm_context_t*, xm_channel_context_t*) __attribute__((warn_unused_result)) __attribute__((nonnull));
-static void xm_next_of_channel(xm_context_t*, xm_channel_context_t*, float*, float*) __attribute__((nonnull));
-static void xm_sample_unmixed(xm_context_t*, float*) __attribute__((nonnull));
-static void xm_sample(xm_context_t*, float*, float*) __attribute__((nonnull));
+static inline float xm_next_of_sample(xm_context_t*, xm_channel_context_t*, xm_sample_t**, uint32_t*, uint32_t, uint8_t) __attribute__((always_inline)) __attribute__((warn_unused_result)) __attribute__((nonnull));
+static float xm_polyphase_dot(const float*, const float*, uint32_t) __attribute__((warn_unused_result)) __attribute__((nonnull));
+static float xm_interpolate_at(const xm_context_t*, const xm_sample_t*, uint32_t) __attribute__((warn_unused_result)) __attribute__((nonnull));
+static uint16_t xm_safe_run_length(const xm_context_t*, const xm_channel_context_t*, uint16_t) __attribute__((warn_unused_result)) __attribute__((nonnull));
+static inline void xm_resample_run(const xm_sample_point_t*, uint32_t, uint32_t, float*, uint16_t, bool) __attribute__((always_inline)) __attribute__((nonnull));
+static void xm_polyphase_run(const xm_interpolation_table_t*, const xm_sample_point_t*, uint32_t, uint32_t, float*, uint16_t) __attribute__((nonnull));
+static uint64_t xm_channel_position(const xm_channel_context_t*) __attribute__((warn_unused_result)) __attribute__((nonnull));
+static void xm_set_channel_position(xm_channel_context_t*, uint64_t) __attribute__((nonnull));
+static void xm_skip_sample(xm_channel_context_t*, uint16_t) __attribute__((nonnull));
+#if XM_STREAMING
+static void xm_stream_fill(const xm_context_t*, xm_stream_window_t*, const xm_sample_t*, uint32_t, uint32_t) __attribute__((nonnull));
+static uint16_t xm_stream_begin(xm_context_t*, xm_channel_context_t*, uint16_t) __attribute__((warn_unused_result)) __attribute__((nonnull));
+static void xm_stream_end(xm_context_t*, xm_channel_context_t*) __attribute__((nonnull));
+#endif
+#if XM_RAMPING
+static inline uint16_t xm_ghost_run(xm_context_t*, xm_channel_context_t*, xm_ghost_t*, float*, uint16_t, uint8_t) __attribute__((always_inline)) __attribute__((nonnull));
+#endif
+static inline bool xm_next_of_channel(xm_context_t*, xm_channel_context_t*, float*, float*, uint16_t, uint16_t, bool, uint8_t) __attribute__((always_inline)) __attribute__((nonnull));
+static inline bool xm_next_of_voice(xm_context_t*, xm_channel_context_t*, float*, float*, uint16_t, uint16_t, bool, uint8_t) __attribute__((always_inline)) __attribute__((nonnull));
+static inline bool xm_next_of_channel_s16(xm_context_t*, xm_channel_context_t*, int32_t*, uint16_t, bool, uint8_t) __attribute__((always_inline)) __attribute__((nonnull));
+static inline bool xm_next_of_voice_s16(xm_context_t*, xm_channel_context_t*, int32_t*, uint16_t, bool, uint8_t) __attribute__((always_inline)) __attribute__((nonnull));
+static bool xm_is_streamed_voice(const xm_context_t*, const xm_channel_context_t*) __attribute__((warn_unused_result)) __attribute__((nonnull));
+static inline bool xm_next_of_stream(xm_context_t*, xm_channel_context_t*, float*, float*, uint16_t, uint16_t, bool, uint8_t) __attribute__((always_inline)) __attribute__((nonnull));
+static inline bool xm_next_of_stream_s16(xm_context_t*, xm_channel_context_t*, int32_t*, uint16_t, bool, uint8_t) __attribute__((always_inline)) __attribute__((nonnull));
+static const xm_mix_kernel_t* xm_mix_kernel(const xm_context_t*) __attribute__((warn_unused_result)) __attribute__((nonnull)) __attribute__((returns_nonnull));
+static void xm_cancel_span(xm_context_t*, uint16_t) __attribute__((nonnull));
+static bool xm_mix_span(xm_context_t*, float*, float*, uint16_t, uint16_t) __attribute__((nonnull));
+static void xm_sample_s16(xm_context_t*, int16_t*, int16_t*, uint16_t, uint16_t) __attribute__((nonnull));
+static void xm_sample_unmixed(xm_context_t*, float*, uint16_t) __attribute__((nonnull));
+static void xm_zero_frames(float*, uint16_t, uint16_t) __attribute__((nonnull));
+static void xm_sample(xm_context_t*, float*, float*, uint16_t, uint16_t) __attribute__((nonnull));
+
+static bool xm_next_tick_is_row(const xm_context_t*) __attribute__((warn_unused_result)) __attribute__((nonnull));
+static void xm_dry_run_span(xm_context_t*, uint16_t) __attribute__((nonnull));
+static void xm_dry_run_channel(xm_context_t*, xm_channel_context_t*, uint16_t) __attribute__((nonnull));
+static xm_seek_snapshot_t* xm_seek_snapshot(const xm_seek_index_t*, uint16_t) __attribute__((warn_unused_result)) __attribute__((nonnull));
+static uint16_t* xm_seek_visits(const xm_seek_index_t*) __attribute__((warn_unused_result)) __attribute__((nonnull));
+static void xm_save_snapshot(const xm_context_t*, xm_seek_snapshot_t*, uint32_t, uint32_t) __attribute__((nonnull));
 
 /* ----- Other oddities ----- */
 
+/* True once the module has looped xm_set_max_loop_count() times, after
+   which only silence is generated */
+#define XM_LOOPS_DONE(ctx) ((ctx)->max_loop_count > 0 \
+                            && (ctx)->loop_count >= (ctx)->max_loop_count)
+
+/* True if nothing of a channel should be heard, its samples only keep
+   playing silently */
+#define XM_CHANNEL_MUTED(ctx, ch) ((ch)->muted \
+                                   || ((ch)->instrument != NULL \
+                                       && (ch)->instrument->muted) \
+                                   || XM_LOOPS_DONE(ctx))
+
 #define XM_CLAMP_UP1F(vol, limit) do {                                  \
 		if((vol) > (limit)) (vol) = (limit); \
 	} while(0)
@@ -70,16 +190,62 @@ static void xm_sample(xm_context_t*, float*, float*) __attribute__((nonnull));
 
 #define XM_LERP(u, v, t) ((u) + (t) * ((v) - (u)))
 
-[[maybe_unused]] static void XM_SLIDE_TOWARDS(float* val,
-                                              float goal, float incr) {
-	if(*val > goal) {
-		*val -= incr;
-		XM_CLAMP_DOWN1F(*val, goal);
-	} else {
-		*val += incr;
-		XM_CLAMP_UP1F(*val, goal);
-	}
-}
+/* Ping-pong loops are stored unrolled in samples_data (see
+   SAMPLE_GUARD_LENGTH), these give the end and length of the equivalent
+   forward loop */
+#define SAMPLE_LOOP_END(smp) \
+	((smp)->length + ((smp)->ping_pong ? (smp)->loop_length : 0))
+#define SAMPLE_LOOP_LENGTH(smp) \
+	((smp)->loop_length * ((smp)->ping_pong ? 2 : 1))
+
+/* Divisor to convert a sample point to a float in -1..1 */
+#define SAMPLE_POINT_SCALE _Generic((xm_sample_point_t){}, \
+                                    int8_t: (float)INT8_MAX, \
+                                    int16_t: (float)INT16_MAX, \
+                                    float: 1.f)
+#define SAMPLE_POINT_TO_FLOAT(v) _Generic((xm_sample_point_t){}, \
+                                          float: (v), \
+                                          default: (float)(v) / SAMPLE_POINT_SCALE)
+
+/* Fixed point conversions for the xm_generate_samples_s16() path. Q15 means
+   -1..1 is mapped to -32768..32768. 258 is 32768/INT8_MAX rounded, to match
+   SAMPLE_POINT_SCALE. */
+#define SAMPLE_POINT_TO_Q15(v) _Generic((xm_sample_point_t){}, \
+                                        int8_t: (int32_t)(v) * 258, \
+                                        int16_t: (int32_t)(v), \
+                                        float: (int32_t)((v) * 32768.f))
+#define FLOAT_TO_Q15(x) ((int32_t)((x) * 32768.f))
+
+/* Maximum number of frames mixed in one go by xm_sample_s16(), this sets the
+   size of its (stack allocated) int32 accumulator */
+#define S16_MIX_BLOCK 128
+
+/* Maximum number of frames interpolated in one go by xm_resample_run() */
+#define RESAMPLE_BLOCK 64
+
+/* Resamplers of the mixer instances, see xm_mix_kernel() */
+#define RESAMPLE_NEAREST 0
+#define RESAMPLE_LINEAR 1
+#define RESAMPLE_TABLE 2 /* With ctx->interpolation */
+
+/* Flags of ch->tick_effects: which columns of ch->current have something to
+   do in xm_tick_effects() */
+#define TICK_VOLUME_COLUMN 1
+#define TICK_EFFECT 2
+
+/* Volume column commands (by upper nibble) and effect types with a per tick
+   part in xm_tick_effects() */
+#define TICK_VOLUME_COLUMNS ((1u << 0x6) | (1u << 0x7) | (1u << 0xB) \
+                             | (1u << 0xD) | (1u << 0xE) | (1u << 0xF))
+#define TICK_EFFECT_TYPES ((1ull << 0) | (1ull << 1) | (1ull << 2)      \
+                           | (1ull << 3) | (1ull << 4) | (1ull << 5)    \
+                           | (1ull << 6) | (1ull << 7) | (1ull << 0xA)  \
+                           | (1ull << 0xE) | (1ull << 17) | (1ull << 20) \
+                           | (1ull << 25) | (1ull << 27) | (1ull << 29))
+
+/* ch->current of channels without a slot in the current row (only non-empty
+   slots are stored) */
+static const xm_pattern_slot_t xm_empty_slot;
 
 static bool HAS_TONE_PORTAMENTO(const xm_pattern_slot_t* s) {
 	return s->effect_type == 3 || s->effect_type == 5
@@ -91,6 +257,27 @@ static bool HAS_VIBRATO(const xm_pattern_slot_t* s) {
 		|| (s->volume_column >> 4) == 0xB;
 }
 
+/* @returns the TICK_* flags of s */
+static uint8_t TICK_EFFECTS(const xm_pattern_slot_t* s) {
+	uint8_t flags = 0;
+	if(TICK_VOLUME_COLUMNS & (1u << (s->volume_column >> 4))) {
+		flags |= TICK_VOLUME_COLUMN;
+	}
+	if(s->effect_type < 64
+	   && (TICK_EFFECT_TYPES & (1ull << s->effect_type))) {
+		/* 000 does nothing, and only E9y/ECy/EDy have a per tick
+		   part */
+		if((s->effect_type != 0 || s->effect_param != 0)
+		   && (s->effect_type != 0xE
+		       || s->effect_param >> 4 == 0x9
+		       || s->effect_param >> 4 == 0xC
+		       || s->effect_param >> 4 == 0xD)) {
+			flags |= TICK_EFFECT;
+		}
+	}
+	return flags;
+}
+
 static bool NOTE_IS_VALID(uint8_t n) {
 	return n & ~KEY_OFF_NOTE;
 }
@@ -128,8 +315,10 @@ static int8_t xm_waveform(uint8_t waveform, uint8_t step) {
 		   regardless */
 		/* Use the POSIX.1-2001 example, just to be deterministic
 		 * across different machines */
-		static uint32_t next_rand = 24492; /* XXX: this is NOT
-		                                      re-entrant! */
+		/* XXX: this is NOT re-entrant! The state is per thread, so
+		   at least several contexts can be played by different
+		   threads */
+		static thread_local uint32_t next_rand = 24492;
 		next_rand = next_rand * 1103515245 + 12345;
 		return (int8_t)((next_rand >> 16) & 0xFF);
 
@@ -321,13 +510,84 @@ static void xm_post_pattern_change(xm_context_t* ctx) {
 	}
 }
 
+#if XM_EVENTS
+/* Write an event in the ring given to xm_set_event_buffer(), if any */
+static void xm_event(xm_context_t* ctx, uint8_t type, uint8_t channel,
+                     uint8_t a, uint8_t b) {
+	if(ctx->events == NULL) return;
+	ctx->events[ctx->events_written++ & ctx->events_mask] = (xm_event_t){
+		.offset = ctx->events_offset,
+		.type = type,
+		.channel = channel,
+		.instrument = a,
+		.note = b,
+	};
+}
+#endif
+
+#if XM_PROFILING
+/* @returns a monotonic time in nanoseconds */
+static uint64_t xm_profile_now(void) {
+	struct timespec ts;
+	#ifdef TIME_MONOTONIC
+	timespec_get(&ts, TIME_MONOTONIC);
+	#else
+	timespec_get(&ts, TIME_UTC);
+	#endif
+	return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
+#endif
+
+/* Build the table used by xm_octave_step(), for the current rate */
+static void xm_update_period_steps(xm_context_t* ctx) {
+	assert(ctx->rate > 32);
+	const float base = 8363.f * (float)SAMPLE_MICROSTEPS
+		* (float)(1 << PERIOD_STEPS_FRAC_BITS) / (float)ctx->rate;
+	for(uint16_t i = 0; i < PERIOD_STEPS_LENGTH; ++i) {
+		ctx->period_steps[i] = (uint32_t)
+			(base * exp2f((float)i / (float)PERIOD_STEPS_LENGTH) + .5f);
+	}
+	ctx->period_steps_rate = ctx->rate;
+}
+
+/* @returns the (rounded) step of a sample played at 8363 * 2^(x/768) Hz */
+static uint32_t xm_octave_step(const xm_context_t* ctx, int32_t x) {
+	assert(ctx->period_steps_rate == ctx->rate);
+	int32_t octave = x / PERIOD_STEPS_LENGTH;
+	int32_t i = x % PERIOD_STEPS_LENGTH;
+	if(i < 0) {
+		i += PERIOD_STEPS_LENGTH;
+		octave--;
+	}
+	assert(octave < PERIOD_STEPS_FRAC_BITS);
+	uint32_t shift = (uint32_t)(PERIOD_STEPS_FRAC_BITS - octave);
+	if(shift >= 32) return 0;
+	return (uint32_t)(((uint64_t)ctx->period_steps[i] + (1u << (shift - 1)))
+	                  >> shift);
+}
+
+/* @returns 2^(x/768) */
+static float xm_octave_ratio(const xm_context_t* ctx, int32_t x) {
+	int32_t octave = x / PERIOD_STEPS_LENGTH;
+	int32_t i = x % PERIOD_STEPS_LENGTH;
+	if(i < 0) {
+		i += PERIOD_STEPS_LENGTH;
+		octave--;
+	}
+	assert(octave > -32 && octave < 32);
+	float r = (float)ctx->period_steps[i] / (float)ctx->period_steps[0];
+	return octave >= 0 ? r * (float)(1u << octave)
+		: r / (float)(1u << -octave);
+}
+
 [[maybe_unused]] static uint16_t xm_linear_period(int16_t note) {
 	assert(7680 - note * 4 > 0);
 	assert(7860 - note * 4 < UINT16_MAX);
 	return (uint16_t)(7680 - note * 4);
 }
 
-[[maybe_unused]] static uint32_t xm_linear_frequency(xm_channel_context_t* ch) {
+[[maybe_unused]] static uint32_t xm_linear_step(const xm_context_t* ctx,
+                                                const xm_channel_context_t* ch) {
 	assert(ch->period > 0 && ch->period < INT16_MAX);
 	uint16_t p = ch->period;
 	if(ch->arp_note_offset) {
@@ -341,27 +601,32 @@ static void xm_post_pattern_change(xm_context_t* ctx) {
 		p -= ch->vibrato_offset;
 		p -= ch->autovibrato_note_offset;
 	}
-	return (uint32_t)(8363.f * exp2f((4608.f - (float)p) / 768.f));
+	/* Period 4608 is 8363 Hz, the frequency doubles every 768 periods */
+	return xm_octave_step(ctx, 4608 - (int32_t)p);
 }
 
 [[maybe_unused]] static uint16_t xm_amiga_period(int16_t note) {
 	return (uint16_t)(32.f * 856.f * exp2f((float)note / (-12.f * 16.f)));
 }
 
-[[maybe_unused]] static uint32_t xm_amiga_frequency(xm_channel_context_t* ch) {
+[[maybe_unused]] static uint32_t xm_amiga_step(const xm_context_t* ctx,
+                                               const xm_channel_context_t* ch) {
 	assert(ch->period > 0);
 	float p = (float)ch->period;
 	if(ch->arp_note_offset) {
-		p *= exp2f((float)ch->arp_note_offset / (-12.f));
+		p *= xm_octave_ratio(ctx, -64 * ch->arp_note_offset);
 		p = p < 107.f ? 107.f : p;
 	} else {
-		p *= exp2f((float)ch->autovibrato_note_offset / (-12.f * 64.f));
+		p *= xm_octave_ratio(ctx, -ch->autovibrato_note_offset);
 		p -= (float)ch->vibrato_offset;
 	}
 
-	/* This is the PAL value. No reason to choose this one over the
-	 * NTSC value. */
-	return (uint32_t)(4.f * 7093789.2f / (p * 2.f));
+	/* The frequency is 4 * 7093789.2 / (p * 2) Hz. This is the PAL value.
+	 * No reason to choose this one over the NTSC value. period_steps[0]
+	 * is the step of 8363 Hz. */
+	return (uint32_t)((2.f * 7093789.2f / 8363.f)
+	                  * (float)ctx->period_steps[0]
+	                  / (float)(1 << PERIOD_STEPS_FRAC_BITS) / p + .5f);
 }
 
 static uint16_t xm_period([[maybe_unused]] xm_context_t* ctx, int16_t note) {
@@ -380,25 +645,25 @@ static uint16_t xm_period([[maybe_unused]] xm_context_t* ctx, int16_t note) {
 	#endif
 }
 
-static uint32_t xm_frequency([[maybe_unused]] xm_context_t* ctx,
-                             xm_channel_context_t* ch) {
+static uint32_t xm_step(xm_context_t* ctx, xm_channel_context_t* ch) {
 	#if XM_FREQUENCY_TYPES == 1
-	return xm_linear_frequency(ch);
+	return xm_linear_step(ctx, ch);
 	#elif XM_FREQUENCY_TYPES == 2
-	return xm_amiga_frequency(ch);
+	return xm_amiga_step(ctx, ch);
 	#else
 	switch(ctx->module.frequency_type) {
 	case XM_LINEAR_FREQUENCIES:
-		return xm_linear_frequency(ch);
+		return xm_linear_step(ctx, ch);
 	case XM_AMIGA_FREQUENCIES:
-		return xm_amiga_frequency(ch);
+		return xm_amiga_step(ctx, ch);
 	}
 	UNREACHABLE();
 	#endif
 }
 
 static void xm_handle_pattern_slot(xm_context_t* ctx, xm_channel_context_t* ch) {
-	xm_pattern_slot_t* s = ch->current;
+	const xm_pattern_slot_t* s = ch->current;
+	const xm_sample_t* previous = ch->sample;
 
 	if(s->instrument) {
 		/* Update ch->next_instrument */
@@ -420,6 +685,7 @@ static void xm_handle_pattern_slot(xm_context_t* ctx, xm_channel_context_t* ch)
 				+ ch->instrument->samples_index
 				+ ch->instrument->sample_of_notes[s->note - 1];
 		} else {
+			xm_ghost_voice(ctx, ch, previous);
 			ch->instrument = NULL;
 			ch->sample = NULL;
 			xm_cut_note(ch);
@@ -459,11 +725,13 @@ static void xm_handle_pattern_slot(xm_context_t* ctx, xm_channel_context_t* ch)
 				}
 				ch->orig_period =
 					xm_period(ctx, note + ch->finetune);
+				xm_ghost_voice(ctx, ch, previous);
 				xm_trigger_note(ctx, ch);
 			}
 		}
 	} else if(s->effect_type == 0x0E && s->effect_param == 0x90) {
 		/* E90 acts like a ghost note */
+		xm_ghost_voice(ctx, ch, previous);
 		xm_trigger_note(ctx, ch);
 	}
 
@@ -542,6 +810,9 @@ static void xm_handle_pattern_slot(xm_context_t* ctx, xm_channel_context_t* ch)
 		}
 		static_assert(256 * SAMPLE_MICROSTEPS * UINT8_MAX <= UINT32_MAX);
 		ch->sample_position *= SAMPLE_MICROSTEPS;
+		#if XM_STREAMING
+		ch->stream_frame = 0;
+		#endif
 		break;
 
 	case 0xB: /* Bxx: Position jump */
@@ -716,16 +987,21 @@ static void xm_trigger_instrument([[maybe_unused]] xm_context_t* ctx,
 	#if XM_TIMING_FUNCTIONS
 	ch->latest_trigger = ctx->generated_samples;
 	assert(ch->instrument != NULL);
-	ch->instrument->latest_trigger = ctx->generated_samples;
+	ctx->instrument_triggers[ch->instrument - ctx->instruments]
+		= ctx->generated_samples;
 	#endif
 }
 
 static void xm_trigger_note([[maybe_unused]] xm_context_t* ctx,
                             xm_channel_context_t* ch) {
 	if(ch->sample == NULL) return;
+	PROFILE_COUNT(ch->profile.note_triggers, 1);
 
 	ch->period = ch->orig_period;
 	ch->sample_position = 0;
+	#if XM_STREAMING
+	ch->stream_frame = 0;
+	#endif
 	ch->vibrato_offset = 0;
 
 	/* XXX: is this reset by a note trigger or inst trigger? does it matter
@@ -735,7 +1011,15 @@ static void xm_trigger_note([[maybe_unused]] xm_context_t* ctx,
 
 	#if XM_TIMING_FUNCTIONS
 	ch->latest_trigger = ctx->generated_samples;
-	ch->sample->latest_trigger = ctx->generated_samples;
+	ctx->sample_triggers[ch->sample - ctx->samples]
+		= ctx->generated_samples;
+	#endif
+
+	#if XM_EVENTS
+	assert(ch->instrument != NULL);
+	xm_event(ctx, XM_EVENT_NOTE_ON, (uint8_t)(ch - ctx->channels + 1),
+	         (uint8_t)(ch->instrument - ctx->instruments + 1),
+	         NOTE_IS_VALID(ch->current->note) ? ch->current->note : 0);
 	#endif
 }
 
@@ -744,10 +1028,82 @@ static void xm_cut_note(xm_channel_context_t* ch) {
 	ch->volume = 0;
 }
 
+/* Hand the voice playing smp on a channel over to a ghost, which fades it
+   out in RAMPING_FRAMES frames, so that a new note can restart the channel
+   without clicking. Must be called before the new note resets the sample
+   position. */
+static void xm_ghost_voice([[maybe_unused]] xm_context_t* ctx,
+                           [[maybe_unused]] xm_channel_context_t* ch,
+                           [[maybe_unused]] const xm_sample_t* smp) {
+	#if XM_RAMPING
+	if(!(ctx->quality & XM_QUALITY_RAMPING) || smp == NULL) return;
+	if(SAMPLE_IS_STREAMED(smp)) {
+		/* The frames around its position are only in the window of
+		   the channel, which the new note will take over */
+		return;
+	}
+	if(smp == ch->sample && ch->sample_position == 0) {
+		/* The new note would replay the exact same voice */
+		return;
+	}
+
+	/* Current volume, maybe halfway through a ramp */
+	const float left = ch->actual_volume[0]
+		- (float)ch->ramp_frames * ch->volume_step[0];
+	const float right = ch->actual_volume[1]
+		- (float)ch->ramp_frames * ch->volume_step[1];
+	if(left == 0.f && right == 0.f) return;
+
+	/* Take a free ghost, or steal the one closest to the end of its fade
+	   out */
+	xm_ghost_t* g = ctx->ghosts;
+	for(uint8_t i = 1; i < MAX_GHOSTS && g->frames; ++i) {
+		if(ctx->ghosts[i].frames < g->frames) g = ctx->ghosts + i;
+	}
+	*g = (xm_ghost_t){
+		.volume = { left, right },
+		.sample_position = ch->sample_position,
+		.step = ch->step,
+		.sample = (uint16_t)(smp - ctx->samples),
+		.channel = (uint8_t)(ch - ctx->channels),
+		.frames = RAMPING_FRAMES,
+	};
+	#endif
+}
+
+static bool xm_has_ghosts([[maybe_unused]] const xm_context_t* ctx,
+                          [[maybe_unused]] const xm_channel_context_t* ch) {
+	#if XM_RAMPING
+	for(uint8_t i = 0; i < MAX_GHOSTS; ++i) {
+		if(ctx->ghosts[i].frames
+		   && ctx->channels + ctx->ghosts[i].channel == ch) {
+			return true;
+		}
+	}
+	#endif
+	return false;
+}
+
+static void xm_kill_ghosts([[maybe_unused]] xm_context_t* ctx,
+                           [[maybe_unused]] const xm_channel_context_t* ch) {
+	#if XM_RAMPING
+	for(uint8_t i = 0; i < MAX_GHOSTS; ++i) {
+		if(ctx->channels + ctx->ghosts[i].channel == ch) {
+			ctx->ghosts[i].frames = 0;
+		}
+	}
+	#endif
+}
+
 static void xm_key_off(xm_context_t* ctx, xm_channel_context_t* ch) {
 	/* Key Off */
 	ch->sustained = false;
 
+	#if XM_EVENTS
+	xm_event(ctx, XM_EVENT_NOTE_OFF, (uint8_t)(ch - ctx->channels + 1),
+	         0, 0);
+	#endif
+
 	/* XXX: An immediate key-off (note 97 or K00) doesn't actually cut the
 	   note when also triggering an instrument. Find the proper logic around
 	   triggers to avoid needing this ugly workaround in the first place. */
@@ -762,7 +1118,8 @@ static void xm_key_off(xm_context_t* ctx, xm_channel_context_t* ch) {
 	}
 }
 
-static void xm_row(xm_context_t* ctx) {
+/* Move to the destination of a pending Bxx/Dxx jump, if any */
+static void xm_apply_jumps(xm_context_t* ctx) {
 	if(ctx->position_jump || ctx->pattern_break) {
 		if(ctx->position_jump) {
 			ctx->current_table_index = ctx->jump_dest;
@@ -775,32 +1132,60 @@ static void xm_row(xm_context_t* ctx) {
 		ctx->pattern_break = false;
 		ctx->jump_row = 0;
 		xm_post_pattern_change(ctx);
+
+		#if XM_EVENTS
+		xm_event(ctx, XM_EVENT_JUMP, 0, ctx->current_table_index,
+		         ctx->current_row);
+		#endif
 	}
+}
+
+static void xm_row(xm_context_t* ctx) {
+	xm_apply_jumps(ctx);
+
+	#if XM_EVENTS
+	if(ctx->events_pattern_index != ctx->current_table_index) {
+		ctx->events_pattern_index = ctx->current_table_index;
+		xm_event(ctx, XM_EVENT_PATTERN, 0, ctx->current_table_index,
+		         ctx->current_row);
+	}
+	xm_event(ctx, XM_EVENT_ROW, 0, ctx->current_table_index,
+	         ctx->current_row);
+	#endif
 
 	xm_pattern_t* cur = ctx->patterns
 		+ ctx->module.pattern_table[ctx->current_table_index];
-	xm_pattern_slot_t* s = ctx->pattern_slots + ctx->module.num_channels
-		* (cur->rows_index + ctx->current_row);
+	const uint32_t* row = ctx->rows + cur->rows_index + ctx->current_row;
+	const xm_pattern_slot_t* s = ctx->pattern_slots + row[0];
+	const xm_pattern_slot_t* end = ctx->pattern_slots + row[1];
 	xm_channel_context_t* ch = ctx->channels;
 	bool in_a_loop = false;
 
 	/* Read notes… */
-	for(uint8_t i = 0; i < ctx->module.num_channels; ++i, ++ch, ++s) {
-		ch->current = s;
-
-		if(s->effect_type != 0xE || s->effect_param >> 4 != 0xD) {
-			/* No EDy note delay */
-			xm_handle_pattern_slot(ctx, ch);
+	for(uint8_t i = 0; i < ctx->module.num_channels; ++i, ++ch) {
+		if(s == end || s->channel != i) {
+			/* Empty slot, xm_handle_pattern_slot() would do
+			   nothing */
+			ch->current = &xm_empty_slot;
 		} else {
-			/* Call xm_handle_pattern_slot() later, in
-			   xm_tick_effects() */
-			ch->note_delay_param = s->effect_param & 0x0F;
+			ch->current = s++;
+			if(ch->current->effect_type != 0xE
+			   || ch->current->effect_param >> 4 != 0xD) {
+				/* No EDy note delay */
+				xm_handle_pattern_slot(ctx, ch);
+			} else {
+				/* Call xm_handle_pattern_slot() later, in
+				   xm_tick_effects() */
+				ch->note_delay_param =
+					ch->current->effect_param & 0x0F;
+			}
 		}
 
 		if(ch->pattern_loop_count > 0) {
 			in_a_loop = true;
 		}
 
+		ch->tick_effects = TICK_EFFECTS(ch->current);
 		ch->arp_note_offset = 0;
 
 		if(ch->should_reset_vibrato && !HAS_VIBRATO(ch->current)) {
@@ -896,6 +1281,13 @@ static void xm_tick_envelopes(xm_channel_context_t* ch) {
 }
 
 static void xm_tick(xm_context_t* ctx) {
+	PROFILE_START();
+	PROFILE_COUNT(ctx->profile.ticks, 1);
+
+	if(ctx->period_steps_rate != ctx->rate) {
+		xm_update_period_steps(ctx);
+	}
+
 	if(ctx->current_tick >= ctx->tempo) {
 		ctx->current_tick = 0;
 		ctx->extra_rows_done++;
@@ -907,7 +1299,10 @@ static void xm_tick(xm_context_t* ctx) {
 	   && (!ctx->extra_rows || ctx->extra_rows_done > ctx->extra_rows)) {
 		ctx->extra_rows = 0;
 		ctx->extra_rows_done = 0;
+		PROFILE_START();
+		PROFILE_COUNT(ctx->profile.rows, 1);
 		xm_row(ctx);
+		PROFILE_END(ctx->profile.row_time);
 	}
 
 	/* Process effects of the entire row *before* moving on with the math,
@@ -916,11 +1311,18 @@ static void xm_tick(xm_context_t* ctx) {
 	for(uint8_t i = 0; i < ctx->module.num_channels; ++i) {
 		xm_channel_context_t* ch = ctx->channels + i;
 
-		xm_tick_envelopes(ch);
+		{
+			PROFILE_START();
+			xm_tick_envelopes(ch);
+			PROFILE_END(ch->profile.tick_envelopes_time);
+		}
 		xm_autovibrato(ch);
 
-		if(ctx->current_tick || ctx->extra_rows_done) {
+		if(ch->tick_effects
+		   && (ctx->current_tick || ctx->extra_rows_done)) {
+			PROFILE_START();
 			xm_tick_effects(ctx, ch);
+			PROFILE_END(ch->profile.tick_effects_time);
 		}
 	}
 
@@ -928,13 +1330,10 @@ static void xm_tick(xm_context_t* ctx) {
 		xm_channel_context_t* ch = ctx->channels + i;
 		if(!ch->period) continue;
 
-		/* Don't truncate, actually round up or down, precision matters
-		   here (rounding lets us use 0.5 instead of 1 in the error
+		/* Steps are rounded, not truncated, precision matters here
+		   (rounding lets us use 0.5 instead of 1 in the error
 		   formula, see SAMPLE_MICROSTEPS comment) */
-		ch->step = (uint32_t)
-			(((uint64_t)xm_frequency(ctx, ch) * SAMPLE_MICROSTEPS
-			  + ctx->rate / 2)
-			 / ctx->rate);
+		ch->step = xm_step(ctx, ch);
 
 		uint8_t panning = (uint8_t)
 			(ch->panning
@@ -963,21 +1362,31 @@ static void xm_tick(xm_context_t* ctx) {
 		float volume =  (float)base / (float)(INT32_MAX);
 		assert(volume >= 0.f && volume <= 1.f);
 
-		#if XM_RAMPING
 		/* See https://modarchive.org/forums/index.php?topic=3517.0
 		 * and https://github.com/Artefact2/libxm/pull/16 */
-		ch->target_volume[0] = volume
-			* sqrtf((float)(MAX_PANNING - panning)
-			        / (float)MAX_PANNING);
-		ch->target_volume[1] = volume
-			* sqrtf((float)panning / (float)MAX_PANNING);
-		#else
-		ch->actual_volume[0] = volume
-			* sqrtf((float)(MAX_PANNING - panning)
-			        / (float)MAX_PANNING);
-		ch->actual_volume[1] = volume * sqrtf((float)panning
-		                                      / (float)MAX_PANNING);
+		float left = volume * sqrtf((float)(MAX_PANNING - panning)
+		                            / (float)MAX_PANNING);
+		float right = volume * sqrtf((float)panning
+		                             / (float)MAX_PANNING);
+		#if XM_RAMPING
+		if(ctx->quality & XM_QUALITY_RAMPING) {
+			/* Ramp linearly from the current volume, which could
+			   be halfway through the previous ramp */
+			const float from_left = ch->actual_volume[0]
+				- (float)ch->ramp_frames * ch->volume_step[0];
+			const float from_right = ch->actual_volume[1]
+				- (float)ch->ramp_frames * ch->volume_step[1];
+			ch->volume_step[0] = (left - from_left)
+				/ (float)RAMPING_FRAMES;
+			ch->volume_step[1] = (right - from_right)
+				/ (float)RAMPING_FRAMES;
+			ch->ramp_frames = (left != from_left
+			                   || right != from_right)
+				? RAMPING_FRAMES : 0;
+		}
 		#endif
+		ch->actual_volume[0] = left;
+		ch->actual_volume[1] = right;
 	}
 
 	ctx->current_tick++;
@@ -985,60 +1394,86 @@ static void xm_tick(xm_context_t* ctx) {
 	/* FT2 manual says number of ticks / second = BPM * 0.4 */
 	static_assert(_Generic(ctx->remaining_samples_in_tick,
 	                       uint32_t: true, default: false));
-	static_assert(_Generic(ctx->rate, uint16_t: true, default: false));
+	static_assert(_Generic(ctx->rate, uint32_t: true, default: false));
 	static_assert(TICK_SUBSAMPLES % 4 == 0);
-	static_assert(10 * (TICK_SUBSAMPLES / 4) * UINT16_MAX <= UINT32_MAX);
-	uint32_t samples_in_tick = ctx->rate;
+	static_assert((10 * TICK_SUBSAMPLES / 4) % MIN_BPM == 0);
+	assert(ctx->rate <= MAX_RATE);
+	uint64_t samples_in_tick = ctx->rate;
 	samples_in_tick *= 10 * TICK_SUBSAMPLES / 4;
 	samples_in_tick /= ctx->bpm;
-	ctx->remaining_samples_in_tick += samples_in_tick;
+	ctx->remaining_samples_in_tick += (uint32_t)samples_in_tick;
+
+	xm_update_active_channels(ctx);
+	PROFILE_END(ctx->profile.tick_time);
+}
+
+/* Notes can only be triggered or cut in xm_tick(), so a channel that has no
+   sample playing (and no ghost fading out) after a tick will stay silent
+   until the next tick, and can be skipped by the mixer. */
+static void xm_update_active_channels(xm_context_t* ctx) {
+	ctx->num_active_channels = 0;
+	for(uint8_t i = 0; i < ctx->module.num_channels; ++i) {
+		xm_channel_context_t* ch = ctx->channels + i;
+		if(ch->sample != NULL || xm_has_ghosts(ctx, ch)) {
+			ctx->active_channels[ctx->num_active_channels++] = i;
+		}
+	}
 }
 
 /* These effects only do something every tick after the first tick of every row.
    Immediate effects (like Cxx or Fxx) are handled in
    xm_handle_pattern_slot(). */
 static void xm_tick_effects(xm_context_t* ctx, xm_channel_context_t* ch) {
-	switch(ch->current->volume_column >> 4) {
+	if(ch->tick_effects & TICK_VOLUME_COLUMN) {
+		switch(ch->current->volume_column >> 4) {
 
-	case 0x6: /* -x: Volume slide down */
-		ch->volume_offset = 0;
-		xm_param_slide(&ch->volume, ch->current->volume_column & 0x0F,
-		               MAX_VOLUME);
-		break;
+		case 0x6: /* -x: Volume slide down */
+			ch->volume_offset = 0;
+			xm_param_slide(&ch->volume,
+			               ch->current->volume_column & 0x0F,
+			               MAX_VOLUME);
+			break;
 
-	case 0x7: /* +x: Volume slide up */
-		ch->volume_offset = 0;
-		xm_param_slide(&ch->volume, ch->current->volume_column << 4,
-		               MAX_VOLUME);
-		break;
+		case 0x7: /* +x: Volume slide up */
+			ch->volume_offset = 0;
+			xm_param_slide(&ch->volume,
+			               ch->current->volume_column << 4,
+			               MAX_VOLUME);
+			break;
 
-	case 0xB: /* Vx: Vibrato */
-		if(ch->current->volume_column & 0x0F) {
-			ch->vibrato_param = (ch->vibrato_param & 0xF0)
-				| (ch->current->volume_column & 0x0F);
-		}
-		/* This vibrato *does not* reset pitch when the command
-		   is discontinued */
-		ch->should_reset_vibrato = false;
-		xm_vibrato(ch);
-		break;
+		case 0xB: /* Vx: Vibrato */
+			if(ch->current->volume_column & 0x0F) {
+				ch->vibrato_param = (ch->vibrato_param & 0xF0)
+					| (ch->current->volume_column & 0x0F);
+			}
+			/* This vibrato *does not* reset pitch when the command
+			   is discontinued */
+			ch->should_reset_vibrato = false;
+			xm_vibrato(ch);
+			break;
 
-	case 0xD: /* ◀x: Panning slide left */
-		xm_param_slide(&ch->panning, ch->current->volume_column & 0x0F,
-		               MAX_PANNING-1);
-		break;
+		case 0xD: /* ◀x: Panning slide left */
+			xm_param_slide(&ch->panning,
+			               ch->current->volume_column & 0x0F,
+			               MAX_PANNING-1);
+			break;
 
-	case 0xE: /* ▶x: Panning slide right */
-		xm_param_slide(&ch->panning, ch->current->volume_column << 4,
-		               MAX_PANNING-1);
-		break;
+		case 0xE: /* ▶x: Panning slide right */
+			xm_param_slide(&ch->panning,
+			               ch->current->volume_column << 4,
+			               MAX_PANNING-1);
+			break;
 
-	case 0xF: /* Mx: Tone portamento */
-		xm_tone_portamento(ch);
-		break;
+		case 0xF: /* Mx: Tone portamento */
+			xm_tone_portamento(ch);
+			break;
+
+		}
 
 	}
 
+	if(!(ch->tick_effects & TICK_EFFECT)) return;
+
 	switch(ch->current->effect_type) {
 
 	case 0: /* 0xy: Arpeggio */
@@ -1134,6 +1569,7 @@ static void xm_tick_effects(xm_context_t* ctx, xm_channel_context_t* ch) {
 			ch->volume_envelope_frame_count = 0;
 			ch->panning_envelope_frame_count = 0;
 			ch->sustained = true;
+			xm_ghost_voice(ctx, ch, ch->sample);
 			xm_trigger_note(ctx, ch);
 			xm_tick_envelopes(ch);
 			break;
@@ -1157,6 +1593,7 @@ static void xm_tick_effects(xm_context_t* ctx, xm_channel_context_t* ch) {
 			ch->panning_envelope_frame_count = 0;
 			ch->sustained = true;
 			if(!NOTE_IS_KEY_OFF(ch->current->note)) {
+				xm_ghost_voice(ctx, ch, ch->sample);
 				xm_trigger_note(ctx, ch);
 			}
 			xm_tick_envelopes(ch);
@@ -1226,203 +1663,1691 @@ static void xm_tick_effects(xm_context_t* ctx, xm_channel_context_t* ch) {
 	}
 }
 
+/* Frames of a sample, followed by its guard frames. Streamed samples are
+   never played as is, but through the window sample of their channel, see
+   xm_stream_begin(). */
+static inline const xm_sample_point_t* xm_sample_data(const xm_context_t* ctx,
+                                                      const xm_sample_t* smp) {
+	assert(!SAMPLE_IS_STREAMED(smp));
+	#if XM_STREAMING
+	if(smp->index > STREAM_INDEX) {
+		return ctx->streams[smp->index - STREAM_INDEX - 1].data;
+	}
+	#endif
+	return ctx->samples_data + smp->index;
+}
+
 static float xm_sample_at(const xm_context_t* ctx,
                           const xm_sample_t* sample, uint32_t k) {
 	assert(sample != NULL);
-	assert(k < sample->length);
-	assert(sample->index + k < ctx->module.samples_data_length);
-	return _Generic((xm_sample_point_t){},
-	                int8_t: (float)ctx->samples_data[sample->index + k] / (float)INT8_MAX,
-	                int16_t: (float)ctx->samples_data[sample->index + k] / (float)INT16_MAX,
-	                float: ctx->samples_data[sample->index + k]);
+	assert(k < sample->length + SAMPLE_GUARD_LENGTH(sample->loop_length,
+	                                                sample->ping_pong));
+	assert(sample->index >= STREAM_INDEX
+	       || sample->index + k < ctx->module.samples_data_length);
+	return SAMPLE_POINT_TO_FLOAT(xm_sample_data(ctx, sample)[k]);
 }
 
-/* XXX: rename me or merge with xm_next_of_channel */
-static float xm_next_of_sample(xm_context_t* ctx, xm_channel_context_t* ch) {
-	if(ch->sample == NULL) {
-		#if XM_RAMPING
-		if(ch->frame_count < RAMPING_POINTS) {
-			return XM_LERP(ch->end_of_previous_sample[ch->frame_count], .0f,
-			               (float)ch->frame_count / (float)RAMPING_POINTS);
-		}
-		#endif
-		return .0f;
-	}
+/* Generate the next frame of a voice: a channel (&ch->sample,
+   &ch->sample_position, ch->step) or one of its ghosts. *sample is set to
+   NULL once a sample without loop is over. ch is only used for profiling. */
+static inline float xm_next_of_sample(xm_context_t* ctx,
+                                      [[maybe_unused]]
+                                      xm_channel_context_t* ch,
+                                      xm_sample_t** sample,
+                                      uint32_t* position, uint32_t step,
+                                      uint8_t resampler) {
+	xm_sample_t* smp = *sample;
 
 	/* XXX: maybe do something about 0 length samples in load.c? */
-	if(ch->sample->length == 0) {
+	if(smp == NULL || smp->length == 0) {
 		return .0f;
 	}
 
-	xm_sample_t* smp = ch->sample;
-	uint32_t a = ch->sample_position / SAMPLE_MICROSTEPS;
-	[[maybe_unused]] float t = (float)(ch->sample_position % SAMPLE_MICROSTEPS) / (float)SAMPLE_MICROSTEPS;
+	const uint32_t pos = *position;
+	uint32_t a = pos / SAMPLE_MICROSTEPS;
+	[[maybe_unused]] float t = (float)(pos % SAMPLE_MICROSTEPS) / (float)SAMPLE_MICROSTEPS;
 	[[maybe_unused]] uint32_t b;
-	ch->sample_position += ch->step;
+	*position += step;
 
-	if(ch->sample->loop_length == 0) {
-		if((ch->sample_position / SAMPLE_MICROSTEPS)
-		   >= ch->sample->length) {
-			ch->sample = NULL;
+	if(smp->loop_length == 0) {
+		if((*position / SAMPLE_MICROSTEPS) >= smp->length) {
+			*sample = NULL;
 			b = a;
 		} else {
-			b = (a+1 < ch->sample->length) ? (a+1) : a;
+			/* If a+1 == length, this reads the guard frame, which
+			   is a copy of frame a */
+			b = a+1;
 		}
-	} else if(!ch->sample->ping_pong) {
-		/* If length=6, loop_length=4 */
-		/* 0 1 (2 3 4 5) (2 3 4 5) (2 3 4 5) ... */
-		assert(ch->sample->loop_length > 0);
-		while((ch->sample_position / SAMPLE_MICROSTEPS)
-		      >= ch->sample->length) {
-			ch->sample_position -= ch->sample->loop_length
-				* SAMPLE_MICROSTEPS;
-		}
-		b = (a+1 == ch->sample->length) ?
-			ch->sample->length - ch->sample->loop_length : (a+1);
-		assert(a < ch->sample->length);
-		assert(b < ch->sample->length);
 	} else {
 		/* If length=6, loop_length=4 */
+		/* 0 1 (2 3 4 5) (2 3 4 5) (2 3 4 5) ... */
+		/* Or for a ping-pong loop, stored unrolled: */
 		/* 0 1 (2 3 4 5 5 4 3 2) (2 3 4 5 5 4 3 2) ... */
-		assert(ch->sample->loop_length > 0);
-		while((ch->sample_position / SAMPLE_MICROSTEPS) >=
-		      ch->sample->length + ch->sample->loop_length) {
+		while((*position / SAMPLE_MICROSTEPS)
+		      >= SAMPLE_LOOP_END(smp)) {
 			/* This will not overflow, loop_length size is checked
 			   in load.c */
-			ch->sample_position -= ch->sample->loop_length
-				* 2 * SAMPLE_MICROSTEPS;
+			*position -= SAMPLE_LOOP_LENGTH(smp)
+				* SAMPLE_MICROSTEPS;
+			PROFILE_COUNT(ch->profile.loop_wraps, 1);
+		}
+		/* If a+1 is the loop end, this reads the guard frame, which
+		   is a copy of the loop start */
+		b = a+1;
+		assert(a < SAMPLE_LOOP_END(smp));
+	}
+
+	float u;
+	if(resampler == RESAMPLE_TABLE) {
+		u = xm_interpolate_at(ctx, smp, pos);
+	} else {
+		u = (float)xm_sample_at(ctx, smp, a);
+		#if XM_LINEAR_INTERPOLATION
+		if(resampler == RESAMPLE_LINEAR) {
+			/* u = sample_at(a), v = sample_at(b), t = lerp factor
+			   (0..1) */
+			u = XM_LERP(u, (float)xm_sample_at(ctx, smp, b), t);
+		}
+		#endif
+	}
+
+	return u;
+}
+
+/* Dot product of the taps of an interpolation table and their frames. The
+   sum is done in 4 lanes, added pairwise at the end, so that all the code
+   paths round the same way. */
+static float xm_polyphase_dot(const float* restrict coefs,
+                              const float* restrict x, uint32_t taps) {
+	static_assert(MAX_INTERPOLATION_TAPS % 4 == 0);
+	assert(taps % 4 == 0);
+
+	#if XM_SIMD && defined(__SSE2__)
+	__m128 acc = _mm_mul_ps(_mm_loadu_ps(coefs), _mm_loadu_ps(x));
+	for(uint32_t j = 4; j < taps; j += 4) {
+		acc = _mm_add_ps(acc, _mm_mul_ps(_mm_loadu_ps(coefs + j),
+		                                 _mm_loadu_ps(x + j)));
+	}
+	acc = _mm_add_ps(acc, _mm_movehl_ps(acc, acc));
+	return _mm_cvtss_f32(_mm_add_ss(acc, _mm_shuffle_ps(acc, acc, 1)));
+	#elif XM_SIMD && defined(__ARM_NEON) && defined(__aarch64__)
+	float32x4_t acc = vmulq_f32(vld1q_f32(coefs), vld1q_f32(x));
+	for(uint32_t j = 4; j < taps; j += 4) {
+		/* Not vmlaq_f32(), to match the rounding of the scalar path */
+		acc = vaddq_f32(acc, vmulq_f32(vld1q_f32(coefs + j),
+		                               vld1q_f32(x + j)));
+	}
+	float32x2_t s = vadd_f32(vget_low_f32(acc), vget_high_f32(acc));
+	return vget_lane_f32(s, 0) + vget_lane_f32(s, 1);
+	#else
+	float acc[4] = { coefs[0] * x[0], coefs[1] * x[1],
+	                 coefs[2] * x[2], coefs[3] * x[3] };
+	for(uint32_t j = 4; j < taps; ++j) {
+		acc[j % 4] += coefs[j] * x[j];
+	}
+	return (acc[0] + acc[2]) + (acc[1] + acc[3]);
+	#endif
+}
+
+/* Interpolate a sample at any position, with the table of ctx. Taps past the
+   loop end wrap around to the loop start (or repeat the last frame of
+   non-looping samples), taps before the start repeat the first frame. This
+   reads the same frames as xm_polyphase_run() wherever it can be used. */
+static float xm_interpolate_at(const xm_context_t* ctx,
+                               const xm_sample_t* smp, uint32_t pos) {
+	const xm_interpolation_table_t* table = ctx->interpolation;
+	const uint32_t end = SAMPLE_LOOP_END(smp);
+	float x[MAX_INTERPOLATION_TAPS];
+
+	int32_t k = (int32_t)(pos / SAMPLE_MICROSTEPS)
+		- (int32_t)(table->taps / 2 - 1);
+	for(uint32_t j = 0; j < table->taps; ++j, ++k) {
+		uint32_t i = (k < 0) ? 0 : (uint32_t)k;
+		if(smp->loop_length) {
+			while(i >= end) i -= SAMPLE_LOOP_LENGTH(smp);
+		} else if(i >= smp->length) {
+			i = smp->length - 1;
 		}
+		x[j] = xm_sample_at(ctx, smp, i);
+	}
+
+	return xm_polyphase_dot(table->coefs
+	                        + INTERPOLATION_PHASE(pos) * table->taps,
+	                        x, table->taps);
+}
 
-		if(a < ch->sample->length) {
-			/* In the first half of the loop, go forwards */
-			b = (a+1 == ch->sample->length) ? a : (a+1);
+/* How many frames (at most numsamples) of the current sample can be generated
+   without reaching the end of the sample, or the end of its loop? During these
+   frames, xm_resample_run() (or xm_polyphase_run(), with an interpolation
+   table) can be used instead of xm_next_of_sample(). */
+static uint16_t xm_safe_run_length(const xm_context_t* ctx,
+                                   const xm_channel_context_t* ch,
+                                   uint16_t numsamples) {
+	const xm_sample_t* smp = ch->sample;
+	assert(smp != NULL);
+
+	uint32_t end = SAMPLE_LOOP_END(smp);
+	#if XM_STREAMING
+	if(smp->index > STREAM_INDEX) {
+		/* Make the same runs as the streamed sample would, the s16
+		   mixer rounds frames outside of them differently.
+		   xm_stream_begin() already keeps all the frames read in the
+		   window. */
+		const xm_stream_window_t* w = ctx->streams
+			+ (smp->index - STREAM_INDEX - 1);
+		uint64_t e = (uint64_t)SAMPLE_LOOP_END(ctx->samples + w->source)
+			- w->start;
+		end = (e < MAX_SAMPLE_LENGTH) ? (uint32_t)e : MAX_SAMPLE_LENGTH;
+	}
+	#endif
+	if(ctx->interpolation != NULL) {
+		/* All the taps of every frame must be stored in samples_data,
+		   from the first frame to the guard frame */
+		uint32_t half = ctx->interpolation->taps / 2;
+		if(ch->sample_position / SAMPLE_MICROSTEPS + 1 < half
+		   || end < half) {
+			return 0;
+		}
+		end -= half - 1;
+	}
+
+	/* This will not overflow, length is checked in load.c */
+	uint32_t limit = end * SAMPLE_MICROSTEPS;
+	if(ch->sample_position >= limit) return 0;
+	if(ch->step == 0) return numsamples;
+
+	/* Position *after* the last frame must still be below the limit */
+	uint32_t n = (limit - 1 - ch->sample_position) / ch->step;
+	return (n < numsamples) ? (uint16_t)n : numsamples;
+}
+
+/* Interpolate n frames of a sample, starting at pos (in microsteps) and
+   advancing by step for each frame. The caller must make sure that no loop
+   wraparound happens in these frames, see xm_safe_run_length(). Results are
+   identical to xm_next_of_sample(), with linear interpolation if lerp is
+   true (or nearest neighbour otherwise). */
+static inline void xm_resample_run(const xm_sample_point_t* restrict data,
+                                   uint32_t pos, uint32_t step,
+                                   float* restrict out, uint16_t n,
+                                   [[maybe_unused]] bool lerp) {
+	assert(n <= RESAMPLE_BLOCK);
+	uint16_t k = 0;
+
+	#if XM_SIMD && defined(__AVX2__)
+	const __m256i lanes = _mm256_mullo_epi32(_mm256_set1_epi32((int)step),
+	                                         _mm256_setr_epi32(0, 1, 2, 3,
+	                                                           4, 5, 6, 7));
+	for(; k + 8 <= n; k += 8, pos += 8 * step, out += 8) {
+		__m256i p = _mm256_add_epi32(_mm256_set1_epi32((int)pos), lanes);
+		__m256i a = _mm256_srli_epi32(p, XM_MICROSTEP_BITS);
+		__m256 u, v;
+		if(_Generic((xm_sample_point_t){}, int16_t: true, default: false)) {
+			/* One 32-bit gather fetches both data[a] and data[a+1] */
+			__m256i ab = _mm256_i32gather_epi32((const int*)data,
+			                                    a, 2);
+			u = _mm256_cvtepi32_ps(_mm256_srai_epi32(
+				_mm256_slli_epi32(ab, 16), 16));
+			v = _mm256_cvtepi32_ps(_mm256_srai_epi32(ab, 16));
+		} else if(_Generic((xm_sample_point_t){}, float: true, default: false)) {
+			u = _mm256_i32gather_ps((const float*)data, a, 4);
+			v = _mm256_i32gather_ps((const float*)data + 1, a, 4);
+		} else {
+			uint32_t i[8];
+			_mm256_storeu_si256((__m256i*)i, a);
+			u = _mm256_cvtepi32_ps(_mm256_setr_epi32(
+				(int)data[i[0]], (int)data[i[1]],
+				(int)data[i[2]], (int)data[i[3]],
+				(int)data[i[4]], (int)data[i[5]],
+				(int)data[i[6]], (int)data[i[7]]));
+			v = _mm256_cvtepi32_ps(_mm256_setr_epi32(
+				(int)data[i[0]+1], (int)data[i[1]+1],
+				(int)data[i[2]+1], (int)data[i[3]+1],
+				(int)data[i[4]+1], (int)data[i[5]+1],
+				(int)data[i[6]+1], (int)data[i[7]+1]));
+		}
+		if(_Generic((xm_sample_point_t){}, float: false, default: true)) {
+			u = _mm256_div_ps(u, _mm256_set1_ps(SAMPLE_POINT_SCALE));
+			v = _mm256_div_ps(v, _mm256_set1_ps(SAMPLE_POINT_SCALE));
+		}
+		#if XM_LINEAR_INTERPOLATION
+		if(lerp) {
+			__m256 t = _mm256_mul_ps(
+				_mm256_cvtepi32_ps(_mm256_and_si256(
+					p, _mm256_set1_epi32(
+						SAMPLE_MICROSTEPS - 1))),
+				_mm256_set1_ps(1.f / (float)SAMPLE_MICROSTEPS));
+			u = _mm256_add_ps(u, _mm256_mul_ps(t,
+			                                   _mm256_sub_ps(v, u)));
+		}
+		#endif
+		_mm256_storeu_ps(out, u);
+	}
+	#elif XM_SIMD && (defined(__SSE2__) \
+	                  || (defined(__ARM_NEON) && defined(__aarch64__)))
+	for(; k + 4 <= n; k += 4, pos += 4 * step, out += 4) {
+		uint32_t p[4] = { pos, pos + step, pos + 2 * step, pos + 3 * step };
+		uint32_t i[4] = {
+			p[0] / SAMPLE_MICROSTEPS, p[1] / SAMPLE_MICROSTEPS,
+			p[2] / SAMPLE_MICROSTEPS, p[3] / SAMPLE_MICROSTEPS,
+		};
+		#if defined(__SSE2__)
+		__m128 u, v;
+		if(_Generic((xm_sample_point_t){}, float: true, default: false)) {
+			u = _mm_setr_ps((float)data[i[0]], (float)data[i[1]],
+			                (float)data[i[2]], (float)data[i[3]]);
+			v = _mm_setr_ps((float)data[i[0]+1], (float)data[i[1]+1],
+			                (float)data[i[2]+1], (float)data[i[3]+1]);
 		} else {
-			/* In the second half of the loop, go backwards */
-			/* loop_end -> loop_end - 1 */
-			/* loop_end + 1 -> loop_end - 2 */
-			/* etc. */
-			/* loop_end + loop_length - 1 -> loop_start */
-			a = ch->sample->length * 2 - 1 - a;
-			b = (a == ch->sample->length - ch->sample->loop_length) ?
-				a : (a-1);
-			assert(a >= ch->sample->length
-			       - ch->sample->loop_length);
-			assert(b >= ch->sample->length
-			       - ch->sample->loop_length);
+			u = _mm_cvtepi32_ps(_mm_setr_epi32(
+				(int)data[i[0]], (int)data[i[1]],
+				(int)data[i[2]], (int)data[i[3]]));
+			v = _mm_cvtepi32_ps(_mm_setr_epi32(
+				(int)data[i[0]+1], (int)data[i[1]+1],
+				(int)data[i[2]+1], (int)data[i[3]+1]));
+			u = _mm_div_ps(u, _mm_set1_ps(SAMPLE_POINT_SCALE));
+			v = _mm_div_ps(v, _mm_set1_ps(SAMPLE_POINT_SCALE));
+		}
+		#if XM_LINEAR_INTERPOLATION
+		if(lerp) {
+			__m128 t = _mm_mul_ps(
+				_mm_cvtepi32_ps(_mm_setr_epi32(
+					(int)(p[0] % SAMPLE_MICROSTEPS),
+					(int)(p[1] % SAMPLE_MICROSTEPS),
+					(int)(p[2] % SAMPLE_MICROSTEPS),
+					(int)(p[3] % SAMPLE_MICROSTEPS))),
+				_mm_set1_ps(1.f / (float)SAMPLE_MICROSTEPS));
+			u = _mm_add_ps(u, _mm_mul_ps(t, _mm_sub_ps(v, u)));
 		}
+		#endif
+		_mm_storeu_ps(out, u);
+		#else
+		float uu[4], vv[4];
+		for(uint8_t j = 0; j < 4; ++j) {
+			uu[j] = (float)data[i[j]];
+			vv[j] = (float)data[i[j]+1];
+		}
+		float32x4_t u = vld1q_f32(uu);
+		float32x4_t v = vld1q_f32(vv);
+		if(_Generic((xm_sample_point_t){}, float: false, default: true)) {
+			u = vdivq_f32(u, vdupq_n_f32(SAMPLE_POINT_SCALE));
+			v = vdivq_f32(v, vdupq_n_f32(SAMPLE_POINT_SCALE));
+		}
+		#if XM_LINEAR_INTERPOLATION
+		if(lerp) {
+			uint32x4_t pp = vandq_u32(vld1q_u32(p),
+			                          vdupq_n_u32(SAMPLE_MICROSTEPS
+			                                      - 1));
+			float32x4_t t = vmulq_f32(vcvtq_f32_u32(pp),
+			                          vdupq_n_f32(1.f / (float)
+			                                      SAMPLE_MICROSTEPS));
+			/* Not vmlaq_f32(), to match the rounding of the scalar
+			   path */
+			u = vaddq_f32(u, vmulq_f32(t, vsubq_f32(v, u)));
+		}
+		#endif
+		vst1q_f32(out, u);
+		#endif
+	}
+	#endif
 
-		assert(a < ch->sample->length);
-		assert(b < ch->sample->length);
+	for(; k < n; ++k, pos += step, ++out) {
+		uint32_t a = pos / SAMPLE_MICROSTEPS;
+		float u = SAMPLE_POINT_TO_FLOAT(data[a]);
+		#if XM_LINEAR_INTERPOLATION
+		if(lerp) {
+			float t = (float)(pos % SAMPLE_MICROSTEPS)
+				/ (float)SAMPLE_MICROSTEPS;
+			u = XM_LERP(u, SAMPLE_POINT_TO_FLOAT(data[a+1]), t);
+		}
+		#endif
+		*out = u;
 	}
+}
 
-	float u = (float)xm_sample_at(ctx, smp, a);
+/* Same as xm_resample_run(), with an interpolation table. The caller must
+   make sure that all the taps are in data, see xm_safe_run_length(). Results
+   are identical to xm_next_of_sample(). */
+static void xm_polyphase_run(const xm_interpolation_table_t* table,
+                             const xm_sample_point_t* restrict data,
+                             uint32_t pos, uint32_t step,
+                             float* restrict out, uint16_t n) {
+	const uint32_t taps = table->taps;
+	data -= taps / 2 - 1;
+	for(uint16_t k = 0; k < n; ++k, pos += step) {
+		const xm_sample_point_t* d = data + pos / SAMPLE_MICROSTEPS;
+		float x[MAX_INTERPOLATION_TAPS];
+		for(uint32_t j = 0; j < taps; ++j) {
+			x[j] = SAMPLE_POINT_TO_FLOAT(d[j]);
+		}
+		out[k] = xm_polyphase_dot(table->coefs
+		                          + INTERPOLATION_PHASE(pos) * taps,
+		                          x, taps);
+	}
+}
 
-	#if XM_LINEAR_INTERPOLATION
-	/* u = sample_at(a), v = sample_at(b), t = lerp factor (0..1) */
-	u = XM_LERP(u, (float)xm_sample_at(ctx, smp, b), t);
+/* Position of a channel in its sample, in microsteps. Only streamed samples
+   go past 32 bits, see ch->stream_frame. */
+static uint64_t xm_channel_position(const xm_channel_context_t* ch) {
+	#if XM_STREAMING
+	return (uint64_t)ch->stream_frame * SAMPLE_MICROSTEPS
+		+ ch->sample_position;
+	#else
+	return ch->sample_position;
 	#endif
+}
+
+static void xm_set_channel_position(xm_channel_context_t* ch, uint64_t pos) {
+	#if XM_STREAMING
+	if(pos > UINT32_MAX) {
+		ch->stream_frame = (uint32_t)(pos / SAMPLE_MICROSTEPS);
+		ch->sample_position = (uint32_t)(pos % SAMPLE_MICROSTEPS);
+		return;
+	}
+	ch->stream_frame = 0;
+	#endif
+	ch->sample_position = (uint32_t)pos;
+}
+
+/* Advance the sample position of a channel by numsamples frames, exactly like
+   numsamples calls to xm_next_of_sample() would (minus ramping, which is
+   irrelevant on inaudible channels), but without generating anything. */
+static void xm_skip_sample(xm_channel_context_t* ch, uint16_t numsamples) {
+	const xm_sample_t* smp = ch->sample;
+	if(smp == NULL || smp->length == 0 || numsamples == 0) return;
+
+	uint64_t end = (uint64_t)SAMPLE_LOOP_END(smp) * SAMPLE_MICROSTEPS;
+	uint64_t start = xm_channel_position(ch);
+	uint64_t pos = start + (uint64_t)ch->step * numsamples;
+	if(pos < end) {
+		xm_set_channel_position(ch, pos);
+	} else if(smp->loop_length == 0) {
+		/* Stop at the first frame past the end */
+		uint64_t frames = (start >= end) ? 1 :
+			(end - start + ch->step - 1) / ch->step;
+		xm_set_channel_position(ch, start + frames * ch->step);
+		ch->sample = NULL;
+	} else {
+		uint64_t loop_length = (uint64_t)SAMPLE_LOOP_LENGTH(smp)
+			* SAMPLE_MICROSTEPS;
+		uint64_t loop_start = end - loop_length;
+		xm_set_channel_position(ch, loop_start
+		                        + (pos - loop_start) % loop_length);
+		PROFILE_COUNT(ch->profile.loop_wraps,
+		              (uint32_t)((pos - loop_start) / loop_length));
+	}
+}
+
+#if XM_STREAMING
+/* Read count frames of a streamed sample into the window w, from frame
+   start on. Frames are numbered as in the unrolled loop of the sample (see
+   SAMPLE_LOOP_END()), and carry on past its loop end, back from its loop
+   start. */
+static void xm_stream_fill(const xm_context_t* ctx, xm_stream_window_t* w,
+                           const xm_sample_t* smp, uint32_t start,
+                           uint32_t count) {
+	/* Samples of an instrument are contiguous in ctx->samples */
+	uint8_t instr = 0;
+	while(w->source >= ctx->instruments[instr].samples_index
+	      + ctx->instruments[instr].num_samples) {
+		++instr;
+	}
+	const uint8_t sample = (uint8_t)(w->source
+	                                 - ctx->instruments[instr].samples_index);
+	const uint64_t end = SAMPLE_LOOP_END(smp);
+	xm_sample_point_t* out = w->data;
+
+	for(uint64_t j = start; count; ) {
+		uint64_t k = j;
+		if(smp->loop_length && k >= end) {
+			k = end - SAMPLE_LOOP_LENGTH(smp)
+				+ (k - end) % SAMPLE_LOOP_LENGTH(smp);
+		}
+
+		uint32_t run;
+		if(k < smp->length) {
+			run = smp->length - (uint32_t)k;
+			if(run > count) run = count;
+			ctx->provider(ctx->provider_user, instr + 1, sample,
+			              (uint32_t)k, run, out);
+		} else {
+			/* Second half of a ping-pong loop, the loop played
+			   backwards */
+			uint32_t m = (uint32_t)k - smp->length;
+			run = smp->loop_length - m;
+			if(run > count) run = count;
+			ctx->provider(ctx->provider_user, instr + 1, sample,
+			              smp->length - m - run, run, out);
+			for(uint32_t a = 0, b = run - 1; a < b; ++a, --b) {
+				xm_sample_point_t t = out[a];
+				out[a] = out[b];
+				out[b] = t;
+			}
+		}
+		out += run;
+		j += run;
+		count -= run;
+	}
+}
+
+/* Swap the streamed sample of a channel for the window sample of its
+   channel, with the frames around its position paged in. Loops are left to
+   xm_stream_end(): the window sample has none, and the channel only plays it
+   for the returned number of frames (at most numsamples, and at least one),
+   which never read frames past the loop end nor past the window.
+
+   Every frame reads the exact same sample points as if the sample was not
+   streamed, taps of interpolation tables included. */
+static uint16_t xm_stream_begin(xm_context_t* ctx, xm_channel_context_t* ch,
+                                uint16_t numsamples) {
+	xm_stream_window_t* w = ctx->streams + (ch - ctx->channels);
+	const xm_sample_t* smp = ch->sample;
+	assert(smp != NULL && SAMPLE_IS_STREAMED(smp));
+	const uint16_t source = (uint16_t)(smp - ctx->samples);
+	const uint64_t pos = xm_channel_position(ch);
+	const uint32_t frame = (uint32_t)(pos / SAMPLE_MICROSTEPS);
+	const uint32_t end = SAMPLE_LOOP_END(smp);
+	assert(frame < end);
+
+	/* Frames needed before and after the one at the position: taps of
+	   interpolation tables, or the next frame for linear interpolation */
+	const uint32_t history = MAX_INTERPOLATION_TAPS / 2;
+	const uint32_t lookahead = history + 1;
+
+	/* Non-looping samples end within the window, which holds their last
+	   frames and guard frame exactly like samples_data would */
+	bool at_end = smp->loop_length == 0
+		&& (uint64_t)w->start + w->length == smp->length;
+	if(w->source != source
+	   || frame < (uint64_t)w->start + (w->start ? history : 0)
+	   || (!at_end && (uint64_t)frame + lookahead
+	       >= (uint64_t)w->start + w->length)) {
+		uint32_t len = STREAM_WINDOW_FRAMES - 1;
+		w->source = source;
+		w->start = (frame > history) ? frame - history : 0;
+		if(smp->loop_length && frame >= end - SAMPLE_LOOP_LENGTH(smp)
+		   && SAMPLE_LOOP_LENGTH(smp) + history + lookahead < len) {
+			/* Hold the whole loop, so that it can be played
+			   again and again without reading it again */
+			uint32_t loop_start = end - SAMPLE_LOOP_LENGTH(smp);
+			w->start = (loop_start > history)
+				? loop_start - history : 0;
+		}
+		at_end = smp->loop_length == 0 && smp->length - w->start <= len;
+		if(at_end) len = smp->length - w->start;
+
+		xm_stream_fill(ctx, w, smp, w->start, len + !at_end);
+		/* Guard frame: the last frame again, or the next one */
+		if(at_end) w->data[len] = w->data[len - 1];
+
+		const uint32_t index = w->sample.index;
+		w->length = len;
+		w->sample = *smp;
+		w->sample.index = index;
+		w->sample.length = at_end ? len : MAX_SAMPLE_LENGTH;
+		w->sample.loop_length = 0;
+		w->sample.ping_pong = false;
+	}
+
+	const uint32_t rel = (uint32_t)(pos - (uint64_t)w->start
+	                                * SAMPLE_MICROSTEPS);
+	uint16_t n = numsamples;
+	if(!at_end && ch->step) {
+		/* The position of every frame played must stay below limit,
+		   the position after the last one can be anywhere */
+		uint32_t limit = w->length - lookahead;
+		if(smp->loop_length && end - w->start < limit) {
+			limit = end - w->start;
+		}
+		limit *= SAMPLE_MICROSTEPS;
+		assert(rel < limit);
+		uint32_t frames = (limit - 1 - rel) / ch->step + 1;
+		if(frames < n) n = (uint16_t)frames;
+	}
+
+	ch->sample = &w->sample;
+	ch->sample_position = rel;
+	ch->stream_frame = 0;
+	return n;
+}
+
+/* Swap the window sample played by xm_stream_begin() back for the streamed
+   sample */
+static void xm_stream_end(xm_context_t* ctx, xm_channel_context_t* ch) {
+	const xm_stream_window_t* w = ctx->streams + (ch - ctx->channels);
+	xm_sample_t* smp = ctx->samples + w->source;
+	uint64_t pos = (uint64_t)w->start * SAMPLE_MICROSTEPS
+		+ ch->sample_position;
+
+	if(smp->loop_length) {
+		const uint64_t end = (uint64_t)SAMPLE_LOOP_END(smp)
+			* SAMPLE_MICROSTEPS;
+		const uint64_t loop_length = (uint64_t)SAMPLE_LOOP_LENGTH(smp)
+			* SAMPLE_MICROSTEPS;
+		if(pos >= end) {
+			PROFILE_COUNT(ch->profile.loop_wraps,
+			              (uint32_t)((pos - end) / loop_length + 1));
+			pos = end - loop_length + (pos - end) % loop_length;
+		}
+	}
+	/* Only windows holding the end of a sample without loop can end */
+	if(ch->sample != NULL) ch->sample = smp;
+	xm_set_channel_position(ch, pos);
+}
+#endif
+
+#if XM_RAMPING
+/* Generate the next frames of the fade out of a ghost of ch, not
+   multiplied by its volume yet. Frees the ghost once it is over.
+
+   @returns the number of frames written to out, at most RAMPING_FRAMES */
+static inline uint16_t xm_ghost_run(xm_context_t* ctx,
+                                    xm_channel_context_t* ch, xm_ghost_t* g,
+                                    float* out, uint16_t numsamples,
+                                    uint8_t resampler) {
+	xm_sample_t* smp = ctx->samples + g->sample;
+	uint16_t i = 0;
+	for(; i < numsamples && g->frames && smp != NULL; ++i) {
+		g->frames--;
+		out[i] = xm_next_of_sample(ctx, ch, &smp, &g->sample_position,
+		                           g->step, resampler)
+			* (float)g->frames / (float)RAMPING_FRAMES;
+	}
+	if(smp == NULL) g->frames = 0;
+	return i;
+}
+#endif
+
+/* Mix a channel, with ramping if ramping is true and with one of the
+   RESAMPLE_* resamplers. Both are always constants, see xm_mix_kernel().
+
+   @returns true if anything was mixed in the output, false if this channel
+   was completely silent */
+static inline bool xm_next_of_channel(xm_context_t* ctx,
+                                      xm_channel_context_t* ch,
+                                      float* out_left, float* out_right,
+                                      uint16_t stride, uint16_t numsamples,
+                                      [[maybe_unused]] bool ramping,
+                                      uint8_t resampler) {
+	PROFILE_START();
+
+	/* Mute status and loop count can only change between calls or in
+	   xm_tick(), so they are constant for the whole span */
+	if(XM_CHANNEL_MUTED(ctx, ch)) {
+		/* Keep the sample playing, but don't advance ramping */
+		if(ramping) xm_kill_ghosts(ctx, ch);
+		xm_skip_sample(ch, numsamples);
+		PROFILE_END(ch->profile.mix_time);
+		return false;
+	}
+
+	bool mixed = false;
 
 	#if XM_RAMPING
-	if(ch->frame_count < RAMPING_POINTS) {
-		/* Smoothly transition between old and new sample. */
-		return XM_LERP(ch->end_of_previous_sample[ch->frame_count], u,
-		               (float)ch->frame_count / (float)RAMPING_POINTS);
+	/* Fade out the voices cut by the latest notes of this channel. They
+	   are mixed with the first frames of the channel in a block, added to
+	   the output at once: the output is then the same whether channels
+	   are mixed in order or apart (see
+	   xm_batch_generate_samples_channels()). */
+	float block_left[RAMPING_FRAMES];
+	float block_right[RAMPING_FRAMES];
+	uint16_t block = 0;
+	for(uint8_t i = 0; ramping && i < MAX_GHOSTS; ++i) {
+		xm_ghost_t* g = ctx->ghosts + i;
+		if(g->frames == 0 || ctx->channels + g->channel != ch) continue;
+		const float ghost_left = g->volume[0] * AMPLIFICATION;
+		const float ghost_right = g->volume[1] * AMPLIFICATION;
+		float buf[RAMPING_FRAMES];
+		uint16_t n = xm_ghost_run(ctx, ch, g, buf, numsamples,
+		                          resampler);
+		if(block == 0) {
+			__builtin_memset(block_left, 0, sizeof(block_left));
+			__builtin_memset(block_right, 0, sizeof(block_right));
+		}
+		for(uint16_t k = 0; k < n; ++k) {
+			block_left[k] += buf[k] * ghost_left;
+			block_right[k] += buf[k] * ghost_right;
+		}
+		if(n > block) block = n;
+	}
+	if(block) {
+		xm_next_of_voice(ctx, ch, block_left, block_right, 1, block,
+		                 ramping, resampler);
+		for(uint16_t k = 0; k < block; ++k) {
+			out_left[k * stride] += block_left[k];
+			out_right[k * stride] += block_right[k];
+		}
+		out_left += block * stride;
+		out_right += block * stride;
+		numsamples -= block;
+		mixed = true;
 	}
 	#endif
 
-	return u;
+	if(xm_next_of_voice(ctx, ch, out_left, out_right, stride, numsamples,
+	                    ramping, resampler)) {
+		mixed = true;
+	}
+	PROFILE_END(ch->profile.mix_time);
+	return mixed;
 }
 
-static void xm_next_of_channel(xm_context_t* ctx, xm_channel_context_t* ch,
-                               float* out_left, float* out_right) {
-	const float fval = xm_next_of_sample(ctx, ch) * AMPLIFICATION;
+/* Mix the sample playing in a channel, without its ghosts, see
+   xm_next_of_channel().
 
-	if(ch->muted || (ch->instrument != NULL && ch->instrument->muted)
-	   || (ctx->max_loop_count > 0
-	       && ctx->loop_count >= ctx->max_loop_count)) {
-		return;
+   @returns true if anything was mixed in the output */
+static inline bool xm_next_of_voice(xm_context_t* ctx,
+                                    xm_channel_context_t* ch,
+                                    float* out_left, float* out_right,
+                                    uint16_t stride, uint16_t numsamples,
+                                    [[maybe_unused]] bool ramping,
+                                    uint8_t resampler) {
+	bool mixed = false;
+
+	#if XM_RAMPING
+	/* Mix frame by frame until the volume ramp is over */
+	if(ramping && ch->ramp_frames) {
+		const uint16_t ramp = ch->ramp_frames < numsamples
+			? (uint16_t)ch->ramp_frames : numsamples;
+		for(uint16_t i = 0; i < ramp && ch->sample != NULL;
+		    ++i, out_left += stride, out_right += stride) {
+			/* Frames left in the ramp after this one */
+			const float k = (float)(ch->ramp_frames - 1 - i);
+			const float fval = xm_next_of_sample(
+				ctx, ch, &ch->sample, &ch->sample_position,
+				ch->step, resampler) * AMPLIFICATION;
+			*out_left += fval * (ch->actual_volume[0]
+			                     - k * ch->volume_step[0]);
+			*out_right += fval * (ch->actual_volume[1]
+			                      - k * ch->volume_step[1]);
+			PROFILE_COUNT(ch->profile.frames_mixed, 1);
+			mixed = true;
+		}
+		/* Volume is now constant for the rest of the span */
+		ch->ramp_frames -= ramp;
+		numsamples -= ramp;
+	}
+	#endif
+
+	if(ch->actual_volume[0] == 0.f && ch->actual_volume[1] == 0.f) {
+		/* Inaudible, only keep the sample playing */
+		xm_skip_sample(ch, numsamples);
+		return mixed;
 	}
 
-	*out_left += fval * ch->actual_volume[0];
-	*out_right += fval * ch->actual_volume[1];
+	if(numsamples && ch->sample != NULL) mixed = true;
+	const float vol_left = ch->actual_volume[0] * AMPLIFICATION;
+	const float vol_right = ch->actual_volume[1] * AMPLIFICATION;
+	while(numsamples && ch->sample != NULL) {
+		uint16_t run = xm_safe_run_length(ctx, ch,
+		                                  numsamples < RESAMPLE_BLOCK
+		                                  ? numsamples : RESAMPLE_BLOCK);
+		if(run == 0) {
+			/* Near the end of the sample or loop, go frame by
+			   frame */
+			const float fval = xm_next_of_sample(
+				ctx, ch, &ch->sample, &ch->sample_position,
+				ch->step, resampler);
+			*out_left += fval * vol_left;
+			*out_right += fval * vol_right;
+			out_left += stride;
+			out_right += stride;
+			--numsamples;
+			PROFILE_COUNT(ch->profile.frames_mixed, 1);
+			continue;
+		}
+
+		float buf[RESAMPLE_BLOCK];
+		if(resampler == RESAMPLE_TABLE) {
+			xm_polyphase_run(ctx->interpolation,
+			                 xm_sample_data(ctx, ch->sample),
+			                 ch->sample_position, ch->step, buf, run);
+		} else {
+			xm_resample_run(xm_sample_data(ctx, ch->sample),
+			                ch->sample_position, ch->step, buf, run,
+			                resampler == RESAMPLE_LINEAR);
+		}
+		ch->sample_position += run * ch->step;
+		for(uint16_t i = 0; i < run; ++i) {
+			out_left[i * stride] += buf[i] * vol_left;
+			out_right[i * stride] += buf[i] * vol_right;
+		}
+		out_left += run * stride;
+		out_right += run * stride;
+		numsamples -= run;
+		PROFILE_COUNT(ch->profile.frames_mixed, run);
+	}
+
+	return mixed;
+}
+
+/* Same as xm_next_of_channel(), but mixes in a Q15 interleaved accumulator,
+   with integer interpolation and volumes. Frames that are played without a
+   constant volume (ramping) or near a loop end are still computed in floating
+   point, then converted.
+
+   @returns true if anything was mixed in the output */
+static inline bool xm_next_of_channel_s16(xm_context_t* ctx,
+                                          xm_channel_context_t* ch,
+                                          int32_t* out, uint16_t numsamples,
+                                          [[maybe_unused]] bool ramping,
+                                          uint8_t resampler) {
+	PROFILE_START();
+
+	if(XM_CHANNEL_MUTED(ctx, ch)) {
+		if(ramping) xm_kill_ghosts(ctx, ch);
+		xm_skip_sample(ch, numsamples);
+		PROFILE_END(ch->profile.mix_time);
+		return false;
+	}
+
+	bool mixed = false;
 
 	#if XM_RAMPING
-	ch->frame_count++;
-	XM_SLIDE_TOWARDS(&(ch->actual_volume[0]),
-	                 ch->target_volume[0], RAMPING_VOLUME_RAMP);
-	XM_SLIDE_TOWARDS(&(ch->actual_volume[1]),
-	                 ch->target_volume[1], RAMPING_VOLUME_RAMP);
+	int32_t block_out[2 * RAMPING_FRAMES];
+	uint16_t block = 0;
+	for(uint8_t i = 0; ramping && i < MAX_GHOSTS; ++i) {
+		xm_ghost_t* g = ctx->ghosts + i;
+		if(g->frames == 0 || ctx->channels + g->channel != ch) continue;
+		const float ghost_left = g->volume[0] * AMPLIFICATION;
+		const float ghost_right = g->volume[1] * AMPLIFICATION;
+		float buf[RAMPING_FRAMES];
+		uint16_t n = xm_ghost_run(ctx, ch, g, buf, numsamples,
+		                          resampler);
+		if(block == 0) __builtin_memset(block_out, 0, sizeof(block_out));
+		for(uint16_t k = 0; k < n; ++k) {
+			block_out[2 * k] += FLOAT_TO_Q15(buf[k] * ghost_left);
+			block_out[2 * k + 1] += FLOAT_TO_Q15(buf[k]
+			                                     * ghost_right);
+		}
+		if(n > block) block = n;
+	}
+	if(block) {
+		xm_next_of_voice_s16(ctx, ch, block_out, block, ramping,
+		                     resampler);
+		for(uint16_t k = 0; k < 2 * block; ++k) out[k] += block_out[k];
+		out += 2 * block;
+		numsamples -= block;
+		mixed = true;
+	}
 	#endif
+
+	if(xm_next_of_voice_s16(ctx, ch, out, numsamples, ramping,
+	                        resampler)) {
+		mixed = true;
+	}
+	PROFILE_END(ch->profile.mix_time);
+	return mixed;
 }
 
-static void xm_sample_unmixed(xm_context_t* ctx, float* out_lr) {
-	if(ckd_sub(&ctx->remaining_samples_in_tick,
-	           ctx->remaining_samples_in_tick, TICK_SUBSAMPLES)) {
-		xm_tick(ctx);
+/* Same as xm_next_of_voice(), for xm_next_of_channel_s16() */
+static inline bool xm_next_of_voice_s16(xm_context_t* ctx,
+                                        xm_channel_context_t* ch,
+                                        int32_t* out, uint16_t numsamples,
+                                        [[maybe_unused]] bool ramping,
+                                        uint8_t resampler) {
+	bool mixed = false;
+
+	#if XM_RAMPING
+	if(ramping && ch->ramp_frames) {
+		const uint16_t ramp = ch->ramp_frames < numsamples
+			? (uint16_t)ch->ramp_frames : numsamples;
+		for(uint16_t i = 0; i < ramp && ch->sample != NULL;
+		    ++i, out += 2) {
+			const float k = (float)(ch->ramp_frames - 1 - i);
+			const float fval = xm_next_of_sample(
+				ctx, ch, &ch->sample, &ch->sample_position,
+				ch->step, resampler) * AMPLIFICATION;
+			out[0] += FLOAT_TO_Q15(fval * (ch->actual_volume[0]
+			                               - k * ch->volume_step[0]));
+			out[1] += FLOAT_TO_Q15(fval * (ch->actual_volume[1]
+			                               - k * ch->volume_step[1]));
+			PROFILE_COUNT(ch->profile.frames_mixed, 1);
+			mixed = true;
+		}
+		ch->ramp_frames -= ramp;
+		numsamples -= ramp;
+	}
+	#endif
+
+	if(ch->actual_volume[0] == 0.f && ch->actual_volume[1] == 0.f) {
+		xm_skip_sample(ch, numsamples);
+		return mixed;
 	}
 
-	for(uint8_t i = 0; i < ctx->module.num_channels; ++i, out_lr += 2) {
-		__builtin_memset(out_lr, 0, 2 * sizeof(float));
-		xm_next_of_channel(ctx, ctx->channels + i,
-		                   out_lr, out_lr + 1);
+	if(numsamples && ch->sample != NULL) mixed = true;
+	/* At most 32768 * AMPLIFICATION, so that a Q15 sample point times a
+	   Q15 volume (and a Q15 difference times a lerp factor) always fits in
+	   31 bits */
+	static_assert(XM_MICROSTEP_BITS <= 15);
+	const int32_t vol_left = FLOAT_TO_Q15(ch->actual_volume[0]
+	                                      * AMPLIFICATION);
+	const int32_t vol_right = FLOAT_TO_Q15(ch->actual_volume[1]
+	                                       * AMPLIFICATION);
+	while(numsamples && ch->sample != NULL) {
+		uint16_t run = xm_safe_run_length(ctx, ch, numsamples);
+		if(run == 0) {
+			const int32_t val = FLOAT_TO_Q15(xm_next_of_sample(
+				ctx, ch, &ch->sample, &ch->sample_position,
+				ch->step, resampler));
+			out[0] += (val * vol_left) >> 15;
+			out[1] += (val * vol_right) >> 15;
+			out += 2;
+			--numsamples;
+			PROFILE_COUNT(ch->profile.frames_mixed, 1);
+			continue;
+		}
+
+		const xm_sample_point_t* data = xm_sample_data(ctx,
+		                                               ch->sample);
+		if(resampler == RESAMPLE_TABLE) {
+			/* Interpolate in floating point, only mix in fixed
+			   point */
+			float buf[RESAMPLE_BLOCK];
+			if(run > RESAMPLE_BLOCK) run = RESAMPLE_BLOCK;
+			xm_polyphase_run(ctx->interpolation, data,
+			                 ch->sample_position, ch->step, buf, run);
+			for(uint16_t i = 0; i < run; ++i, out += 2) {
+				const int32_t val = FLOAT_TO_Q15(buf[i]);
+				out[0] += (val * vol_left) >> 15;
+				out[1] += (val * vol_right) >> 15;
+			}
+			ch->sample_position += run * ch->step;
+			numsamples -= run;
+			PROFILE_COUNT(ch->profile.frames_mixed, run);
+			continue;
+		}
+
+		uint32_t pos = ch->sample_position;
+		for(uint16_t i = 0; i < run; ++i, pos += ch->step, out += 2) {
+			uint32_t a = pos / SAMPLE_MICROSTEPS;
+			int32_t val = SAMPLE_POINT_TO_Q15(data[a]);
+			#if XM_LINEAR_INTERPOLATION
+			if(resampler == RESAMPLE_LINEAR) {
+				val += ((SAMPLE_POINT_TO_Q15(data[a+1]) - val)
+				        * (int32_t)(pos % SAMPLE_MICROSTEPS))
+					>> XM_MICROSTEP_BITS;
+			}
+			#endif
+			out[0] += (val * vol_left) >> 15;
+			out[1] += (val * vol_right) >> 15;
+		}
+		ch->sample_position = pos;
+		numsamples -= run;
+		PROFILE_COUNT(ch->profile.frames_mixed, run);
+	}
+
+	return mixed;
+}
+
+/* Muted channels skip streamed samples like any other, without reading
+   them */
+static bool xm_is_streamed_voice([[maybe_unused]] const xm_context_t* ctx,
+                                 [[maybe_unused]]
+                                 const xm_channel_context_t* ch) {
+	return ch->sample != NULL && SAMPLE_IS_STREAMED(ch->sample)
+		&& !XM_CHANNEL_MUTED(ctx, ch);
+}
+
+/* Same as xm_next_of_channel(), for a channel playing a streamed sample:
+   mixes it window by window */
+static inline bool xm_next_of_stream([[maybe_unused]] xm_context_t* ctx,
+                                     [[maybe_unused]] xm_channel_context_t* ch,
+                                     [[maybe_unused]] float* out_left,
+                                     [[maybe_unused]] float* out_right,
+                                     [[maybe_unused]] uint16_t stride,
+                                     [[maybe_unused]] uint16_t numsamples,
+                                     [[maybe_unused]] bool ramping,
+                                     [[maybe_unused]] uint8_t resampler) {
+	#if XM_STREAMING
+	if(ctx->streams == NULL) {
+		/* No provider, play silently */
+		if(ramping) xm_kill_ghosts(ctx, ch);
+		xm_skip_sample(ch, numsamples);
+		return false;
+	}
+
+	bool mixed = false;
+	while(numsamples && ch->sample != NULL) {
+		uint16_t n = xm_stream_begin(ctx, ch, numsamples);
+		if(xm_next_of_channel(ctx, ch, out_left, out_right, stride, n,
+		                      ramping, resampler)) {
+			mixed = true;
+		}
+		xm_stream_end(ctx, ch);
+		out_left += n * stride;
+		out_right += n * stride;
+		numsamples -= n;
+	}
+	/* The sample is over, but ramps and ghosts may not be */
+	if(numsamples && xm_next_of_channel(ctx, ch, out_left, out_right,
+	                                    stride, numsamples, ramping,
+	                                    resampler)) {
+		mixed = true;
+	}
+	return mixed;
+	#else
+	UNREACHABLE();
+	return false;
+	#endif
+}
+
+static inline bool xm_next_of_stream_s16([[maybe_unused]] xm_context_t* ctx,
+                                         [[maybe_unused]]
+                                         xm_channel_context_t* ch,
+                                         [[maybe_unused]] int32_t* out,
+                                         [[maybe_unused]] uint16_t numsamples,
+                                         [[maybe_unused]] bool ramping,
+                                         [[maybe_unused]] uint8_t resampler) {
+	#if XM_STREAMING
+	if(ctx->streams == NULL) {
+		if(ramping) xm_kill_ghosts(ctx, ch);
+		xm_skip_sample(ch, numsamples);
+		return false;
+	}
+
+	bool mixed = false;
+	while(numsamples && ch->sample != NULL) {
+		uint16_t n = xm_stream_begin(ctx, ch, numsamples);
+		if(xm_next_of_channel_s16(ctx, ch, out, n, ramping,
+		                          resampler)) {
+			mixed = true;
+		}
+		xm_stream_end(ctx, ch);
+		out += 2 * n;
+		numsamples -= n;
+	}
+	if(numsamples && xm_next_of_channel_s16(ctx, ch, out, numsamples,
+	                                        ramping, resampler)) {
+		mixed = true;
+	}
+	return mixed;
+	#else
+	UNREACHABLE();
+	return false;
+	#endif
+}
 
-		assert(out_lr[0] <= 1.f);
-		assert(out_lr[0] >= -1.f);
-		assert(out_lr[1] <= 1.f);
-		assert(out_lr[1] >= -1.f);
+/* Instantiate the mixer for one combination of quality features. Features
+   are compile time constants in each instance, so the per frame loops never
+   test them. */
+#define MIX_KERNEL(name, ramping, resampler)                               \
+	static bool xm_mix_##name(xm_context_t* ctx,                       \
+	                          xm_channel_context_t* ch,                \
+	                          float* out_left, float* out_right,       \
+	                          uint16_t stride, uint16_t numsamples) {  \
+		if(xm_is_streamed_voice(ctx, ch)) {                        \
+			return xm_next_of_stream(ctx, ch, out_left,        \
+			                         out_right, stride,        \
+			                         numsamples, ramping,      \
+			                         resampler);               \
+		}                                                          \
+		return xm_next_of_channel(ctx, ch, out_left, out_right,    \
+		                          stride, numsamples, ramping,     \
+		                          resampler);                      \
+	}                                                                  \
+	static bool xm_mix_s16_##name(xm_context_t* ctx,                   \
+	                              xm_channel_context_t* ch,            \
+	                              int32_t* out, uint16_t numsamples) { \
+		if(xm_is_streamed_voice(ctx, ch)) {                        \
+			return xm_next_of_stream_s16(ctx, ch, out,         \
+			                             numsamples, ramping,  \
+			                             resampler);           \
+		}                                                          \
+		return xm_next_of_channel_s16(ctx, ch, out, numsamples,    \
+		                              ramping, resampler);         \
 	}
+
+MIX_KERNEL(nearest, false, RESAMPLE_NEAREST)
+MIX_KERNEL(table, false, RESAMPLE_TABLE)
+#if XM_LINEAR_INTERPOLATION
+MIX_KERNEL(linear, false, RESAMPLE_LINEAR)
+#endif
+#if XM_RAMPING
+MIX_KERNEL(ramping_nearest, true, RESAMPLE_NEAREST)
+MIX_KERNEL(ramping_table, true, RESAMPLE_TABLE)
+#if XM_LINEAR_INTERPOLATION
+MIX_KERNEL(ramping_linear, true, RESAMPLE_LINEAR)
+#endif
+#endif
+
+/* By XM_QUALITY_RAMPING, then RESAMPLE_*. Features the library was built
+   without are never selected, see xm_set_quality(). */
+#define MIX_KERNEL_ENTRY(name) { xm_mix_##name, xm_mix_s16_##name }
+static const xm_mix_kernel_t xm_mix_kernels[2][3] = {
+	{
+		MIX_KERNEL_ENTRY(nearest),
+		#if XM_LINEAR_INTERPOLATION
+		MIX_KERNEL_ENTRY(linear),
+		#else
+		MIX_KERNEL_ENTRY(nearest),
+		#endif
+		MIX_KERNEL_ENTRY(table),
+	},
+	#if XM_RAMPING
+	{
+		MIX_KERNEL_ENTRY(ramping_nearest),
+		#if XM_LINEAR_INTERPOLATION
+		MIX_KERNEL_ENTRY(ramping_linear),
+		#else
+		MIX_KERNEL_ENTRY(ramping_nearest),
+		#endif
+		MIX_KERNEL_ENTRY(ramping_table),
+	},
+	#endif
+};
+
+/* Quality features and the interpolation table can only change between
+   calls, so this is done once per call, never per frame */
+static const xm_mix_kernel_t* xm_mix_kernel(const xm_context_t* ctx) {
+	static_assert(XM_QUALITY_RAMPING == 1);
+	uint8_t resampler = (ctx->interpolation != NULL) ? RESAMPLE_TABLE
+		: (ctx->quality & XM_QUALITY_LINEAR_INTERPOLATION)
+		? RESAMPLE_LINEAR : RESAMPLE_NEAREST;
+	return &xm_mix_kernels[ctx->quality & XM_QUALITY_RAMPING][resampler];
+}
+
+void xm_begin_spans([[maybe_unused]] xm_context_t* ctx) {
+	#if XM_EVENTS
+	ctx->events_offset = 0;
+	#endif
+}
+
+void xm_end_spans(xm_context_t* ctx, bool silent) {
+	ctx->generated_silence = silent;
 }
 
-static void xm_sample(xm_context_t* ctx, float* out_left, float* out_right) {
-	if(ckd_sub(&ctx->remaining_samples_in_tick,
-	           ctx->remaining_samples_in_tick, TICK_SUBSAMPLES)) {
+/* Advance playback by up to numsamples frames, but never past the next tick
+   boundary. Calls xm_tick() first if the current tick is over. */
+uint16_t xm_begin_span(xm_context_t* ctx, uint16_t numsamples) {
+	if(numsamples == 0) return 0;
+
+	if(ctx->remaining_samples_in_tick < TICK_SUBSAMPLES) {
 		xm_tick(ctx);
 	}
 
-	for(uint8_t i = 0; i < ctx->module.num_channels; ++i) {
-		xm_next_of_channel(ctx, ctx->channels + i, out_left, out_right);
+	assert(ctx->remaining_samples_in_tick >= TICK_SUBSAMPLES);
+	uint32_t span = ctx->remaining_samples_in_tick / TICK_SUBSAMPLES;
+	if(span > numsamples) span = numsamples;
+	ctx->remaining_samples_in_tick -= span * TICK_SUBSAMPLES;
+	#if XM_TIMING_FUNCTIONS
+	ctx->generated_samples += span;
+	#endif
+	#if XM_EVENTS
+	ctx->events_offset += span;
+	#endif
+	return (uint16_t)span;
+}
+
+/* Undo the accounting of xm_begin_span() for a span that will not be played.
+   The tick it started (if any) stays done. */
+static void xm_cancel_span(xm_context_t* ctx, uint16_t span) {
+	ctx->remaining_samples_in_tick += (uint32_t)span * TICK_SUBSAMPLES;
+	#if XM_TIMING_FUNCTIONS
+	ctx->generated_samples -= span;
+	#endif
+	#if XM_EVENTS
+	ctx->events_offset -= span;
+	#endif
+}
+
+bool xm_mix_channel_span(xm_context_t* ctx, uint8_t channel, float* out,
+                         uint16_t numsamples) {
+	xm_channel_context_t* ch = ctx->channels + channel - 1;
+
+	/* Same as skipping channels missing from ctx->active_channels, see
+	   xm_update_active_channels() */
+	if(ch->sample == NULL && !xm_has_ghosts(ctx, ch)) return false;
+	return xm_mix_kernel(ctx)->mix(ctx, ch, out, out + 1, 2, numsamples);
+}
+
+static void xm_sample_unmixed(xm_context_t* ctx, float* out_lr,
+                              uint16_t numsamples) {
+	const uint16_t stride = (uint16_t)(2 * ctx->module.num_channels);
+	__builtin_memset(out_lr, 0, sizeof(float) * stride * numsamples);
+	xm_begin_spans(ctx);
+
+	const xm_mix_kernel_t* kernel = xm_mix_kernel(ctx);
+	bool silent = true;
+	while(numsamples) {
+		uint16_t span = xm_begin_span(ctx, numsamples);
+		for(uint8_t i = 0; i < ctx->num_active_channels; ++i) {
+			uint8_t c = ctx->active_channels[i];
+			if(kernel->mix(ctx, ctx->channels + c,
+			               out_lr + 2 * c, out_lr + 2 * c + 1,
+			               stride, span)) {
+				silent = false;
+			}
+		}
+		out_lr += stride * span;
+		numsamples -= span;
 	}
+	xm_end_spans(ctx, silent);
+}
 
-	assert(*out_left <= ctx->module.num_channels);
-	assert(*out_left >= -ctx->module.num_channels);
-	assert(*out_right <= ctx->module.num_channels);
-	assert(*out_right >= -ctx->module.num_channels);
+static void xm_zero_frames(float* out, uint16_t from, uint16_t to) {
+	__builtin_memset(out + 2 * from, 0, sizeof(float) * 2 * (to - from));
+}
+
+void xm_generate_stems(xm_context_t* ctx, const uint8_t* groups,
+                       uint8_t num_stems, float* const* stems, bool* mixed,
+                       uint16_t numsamples) {
+	/* Stems are zeroed lazily, right before the first channel is mixed
+	   in them: started[] is set once a stem holds valid samples up to
+	   the current span, touched[] once it does for the current span */
+	bool started[MAX_CHANNELS] = {};
+	bool touched[MAX_CHANNELS];
+	__builtin_memset(mixed, 0, sizeof(bool) * num_stems);
+	xm_begin_spans(ctx);
+
+	const xm_mix_kernel_t* kernel = xm_mix_kernel(ctx);
+	bool silent = true;
+	uint16_t offset = 0;
+	while(offset < numsamples) {
+		uint16_t span = xm_begin_span(ctx, (uint16_t)(numsamples - offset));
+		uint16_t end = (uint16_t)(offset + span);
+		__builtin_memset(touched, 0, sizeof(bool) * num_stems);
+
+		for(uint8_t i = 0; i < ctx->num_active_channels; ++i) {
+			uint8_t c = ctx->active_channels[i];
+			uint8_t s = (groups != NULL) ? groups[c] : c;
+			if(s >= num_stems) {
+				/* Played, but not rendered anywhere */
+				xm_dry_run_channel(ctx, ctx->channels + c, span);
+				continue;
+			}
+
+			float* out = stems[s];
+			if(!touched[s]) {
+				xm_zero_frames(out, started[s] ? offset : 0, end);
+				started[s] = touched[s] = true;
+			}
+			if(kernel->mix(ctx, ctx->channels + c,
+			               out + 2 * offset, out + 2 * offset + 1,
+			               2, span)) {
+				mixed[s] = true;
+				silent = false;
+			}
+		}
+
+		for(uint8_t s = 0; s < num_stems; ++s) {
+			if(started[s] && !touched[s]) {
+				xm_zero_frames(stems[s], offset, end);
+			}
+		}
+		offset = end;
+	}
+
+	xm_end_spans(ctx, silent);
+}
+
+/* Mix all the active channels of the current span in a zeroed buffer
+
+   @returns true if anything was mixed in the output */
+static bool xm_mix_span(xm_context_t* ctx, float* out_left, float* out_right,
+                        uint16_t stride, uint16_t span) {
+	const xm_mix_kernel_t* kernel = xm_mix_kernel(ctx);
+	bool mixed = false;
+	for(uint8_t i = 0; i < ctx->num_active_channels; ++i) {
+		if(kernel->mix(ctx, ctx->channels + ctx->active_channels[i],
+		               out_left, out_right, stride, span)) {
+			mixed = true;
+		}
+	}
+	return mixed;
+}
+
+static void xm_sample(xm_context_t* ctx, float* out_left, float* out_right,
+                      uint16_t stride, uint16_t numsamples) {
+	for(uint16_t i = 0; i < numsamples; ++i) {
+		out_left[i * stride] = 0.f;
+		out_right[i * stride] = 0.f;
+	}
+	xm_begin_spans(ctx);
+
+	bool silent = true;
+	while(numsamples) {
+		uint16_t span = xm_begin_span(ctx, numsamples);
+		if(xm_mix_span(ctx, out_left, out_right, stride, span)) {
+			silent = false;
+		}
+		out_left += stride * span;
+		out_right += stride * span;
+		numsamples -= span;
+	}
+	xm_end_spans(ctx, silent);
 }
 
 void xm_generate_samples(xm_context_t* ctx,
                          float* output,
                          uint16_t numsamples) {
-	#if XM_TIMING_FUNCTIONS
-	ctx->generated_samples += numsamples;
-	#endif
-	for(uint16_t i = 0; i < numsamples; i++, output += 2) {
-		__builtin_memset(output, 0, 2 * sizeof(float));
-		xm_sample(ctx, output, output + 1);
-	}
+	xm_sample(ctx, output, output + 1, 2, numsamples);
 }
 
 void xm_generate_samples_noninterleaved(xm_context_t* ctx,
                                         float* out_left,
                                         float* out_right,
                                         uint16_t numsamples) {
-	#if XM_TIMING_FUNCTIONS
-	ctx->generated_samples += numsamples;
-	#endif
-	for(uint16_t i = 0; i < numsamples; ++i) {
-		*out_left = 0.f;
-		*out_right = 0.f;
-		xm_sample(ctx, out_left++, out_right++);
-	}
+	xm_sample(ctx, out_left, out_right, 1, numsamples);
 }
 
 void xm_generate_samples_unmixed(xm_context_t* ctx,
                                  float* out,
                                  uint16_t numsamples) {
+	xm_sample_unmixed(ctx, out, numsamples);
+}
+
+uint32_t xm_render(xm_context_t* ctx, float* output, uint32_t numsamples) {
+	uint32_t rendered = 0;
+	bool silent = true;
+	xm_begin_spans(ctx);
+
+	while(rendered < numsamples && !XM_LOOPS_DONE(ctx)) {
+		uint32_t left = numsamples - rendered;
+		uint16_t span = xm_begin_span(ctx, left > UINT16_MAX
+		                              ? UINT16_MAX : (uint16_t)left);
+		/* xm_tick() may have just reached the loop limit, in which case
+		   this span (and everything after it) is not rendered */
+		if(XM_LOOPS_DONE(ctx)) {
+			xm_cancel_span(ctx, span);
+			break;
+		}
+
+		float* out = output + 2 * (size_t)rendered;
+		__builtin_memset(out, 0, sizeof(float) * 2 * span);
+		if(xm_mix_span(ctx, out, out + 1, 2, span)) {
+			silent = false;
+		}
+		rendered += span;
+	}
+
+	xm_end_spans(ctx, silent);
+	return rendered;
+}
+
+static void xm_sample_s16(xm_context_t* ctx, int16_t* out_left,
+                          int16_t* out_right, uint16_t stride,
+                          uint16_t numsamples) {
+	int32_t acc[2 * S16_MIX_BLOCK];
+	const xm_mix_kernel_t* kernel = xm_mix_kernel(ctx);
+	bool silent = true;
+	xm_begin_spans(ctx);
+
+	while(numsamples) {
+		uint16_t span = xm_begin_span(ctx, numsamples < S16_MIX_BLOCK
+		                              ? numsamples : S16_MIX_BLOCK);
+		__builtin_memset(acc, 0, sizeof(int32_t) * 2 * span);
+		for(uint8_t i = 0; i < ctx->num_active_channels; ++i) {
+			if(kernel->mix_s16(ctx, ctx->channels
+			                   + ctx->active_channels[i], acc, span)) {
+				silent = false;
+			}
+		}
+
+		/* Saturate */
+		for(uint16_t i = 0; i < span; ++i) {
+			int32_t l = acc[2 * i];
+			int32_t r = acc[2 * i + 1];
+			XM_CLAMP2F(l, INT16_MAX, INT16_MIN);
+			XM_CLAMP2F(r, INT16_MAX, INT16_MIN);
+			out_left[i * stride] = (int16_t)l;
+			out_right[i * stride] = (int16_t)r;
+		}
+
+		out_left += stride * span;
+		out_right += stride * span;
+		numsamples -= span;
+	}
+	xm_end_spans(ctx, silent);
+}
+
+void xm_generate_samples_s16(xm_context_t* ctx, int16_t* output,
+                             uint16_t numsamples) {
+	xm_sample_s16(ctx, output, output + 1, 2, numsamples);
+}
+
+void xm_generate_samples_s16_noninterleaved(xm_context_t* ctx,
+                                            int16_t* out_left,
+                                            int16_t* out_right,
+                                            uint16_t numsamples) {
+	xm_sample_s16(ctx, out_left, out_right, 1, numsamples);
+}
+
+void xm_set_sample_rate(xm_context_t* ctx, uint32_t rate) {
+	static_assert(MAX_RATE == 3355443); /* As documented in xm.h */
+	assert(rate > 32 && rate <= MAX_RATE);
+	const uint32_t old_rate = ctx->rate;
+	if(rate == old_rate) return;
+	ctx->rate = rate;
+
+	/* Keep the same time left in the current tick. This is exact when
+	   switching back and forth between multiples of the same rate. */
+	ctx->remaining_samples_in_tick = (uint32_t)
+		(((uint64_t)ctx->remaining_samples_in_tick * rate
+		  + old_rate / 2) / old_rate);
+
+	/* Same steps as if the last xm_tick() had been done at this rate */
+	xm_update_period_steps(ctx);
+	for(uint8_t i = 0; i < ctx->module.num_channels; ++i) {
+		xm_channel_context_t* ch = ctx->channels + i;
+		if(ch->period) ch->step = xm_step(ctx, ch);
+	}
+
+	#if XM_RAMPING
+	for(uint8_t i = 0; i < MAX_GHOSTS; ++i) {
+		xm_ghost_t* g = ctx->ghosts + i;
+		g->step = (uint32_t)(((uint64_t)g->step * old_rate + rate / 2)
+		                     / rate);
+	}
+	#endif
+}
+
+/* ----- Timeline and seek index ----- */
+
+/* @returns true if the next call to xm_tick() will call xm_row(), mirrors
+   the checks at the start of xm_tick() */
+static bool xm_next_tick_is_row(const xm_context_t* ctx) {
+	bool wrap = ctx->current_tick >= ctx->tempo;
+	if(!wrap && ctx->current_tick) return false;
+	return !ctx->extra_rows || ctx->extra_rows_done + wrap > ctx->extra_rows;
+}
+
+/* Advance all channels by numsamples frames, with the exact same outcome as
+   xm_mix_span(), but without generating anything */
+static void xm_dry_run_span(xm_context_t* ctx, uint16_t numsamples) {
+	for(uint8_t i = 0; i < ctx->num_active_channels; ++i) {
+		xm_dry_run_channel(ctx, ctx->channels + ctx->active_channels[i],
+		                   numsamples);
+	}
+}
+
+static void xm_dry_run_channel(xm_context_t* ctx, xm_channel_context_t* ch,
+                               uint16_t n) {
+	if(XM_CHANNEL_MUTED(ctx, ch)) {
+		xm_kill_ghosts(ctx, ch);
+		xm_skip_sample(ch, n);
+		return;
+	}
+
+	#if XM_STREAMING
+	if(ctx->streams == NULL && xm_is_streamed_voice(ctx, ch)) {
+		/* Same as xm_next_of_stream() without a provider: ramps are
+		   not advanced either */
+		if(ctx->quality & XM_QUALITY_RAMPING) xm_kill_ghosts(ctx, ch);
+		xm_skip_sample(ch, n);
+		return;
+	}
+	#endif
+
+	#if XM_RAMPING
+	if(ctx->quality & XM_QUALITY_RAMPING) {
+		/* Ghosts end early when their sample does, so they are
+		   advanced frame by frame (only the sample position matters
+		   here) */
+		for(uint8_t j = 0; j < MAX_GHOSTS; ++j) {
+			xm_ghost_t* g = ctx->ghosts + j;
+			if(g->frames == 0 || ctx->channels + g->channel != ch) {
+				continue;
+			}
+			float buf[RAMPING_FRAMES];
+			xm_ghost_run(ctx, ch, g, buf, n, RESAMPLE_NEAREST);
+		}
+		ch->ramp_frames -= ch->ramp_frames < n ? ch->ramp_frames : n;
+	}
+	#endif
+
+	xm_skip_sample(ch, n);
+}
+
+static xm_seek_snapshot_t* xm_seek_snapshot(const xm_seek_index_t* idx,
+                                            uint16_t i) {
+	return (xm_seek_snapshot_t*)((char*)(idx + 1)
+	                             + SEEK_SNAPSHOT_SIZE(idx->ctx) * i);
+}
+
+static uint16_t* xm_seek_visits(const xm_seek_index_t* idx) {
+	return (uint16_t*)xm_seek_snapshot(idx, idx->max_snapshots);
+}
+
+static void xm_save_snapshot(const xm_context_t* ctx, xm_seek_snapshot_t* s,
+                             uint32_t position, uint32_t num_visits) {
+	*s = (xm_seek_snapshot_t){
+		.position = position,
+		.num_visits = num_visits,
+		.remaining_samples_in_tick = ctx->remaining_samples_in_tick,
+		.current_tick = ctx->current_tick,
+		.extra_rows_done = ctx->extra_rows_done,
+		.current_row = ctx->current_row,
+		.extra_rows = ctx->extra_rows,
+		.current_table_index = ctx->current_table_index,
+		.global_volume = ctx->global_volume,
+		.tempo = ctx->tempo,
+		.bpm = ctx->bpm,
+		.position_jump = ctx->position_jump,
+		.pattern_break = ctx->pattern_break,
+		.jump_dest = ctx->jump_dest,
+		.jump_row = ctx->jump_row,
+		.loop_count = ctx->loop_count,
+	};
+	#if XM_RAMPING
+	__builtin_memcpy(s->ghosts, ctx->ghosts, sizeof(ctx->ghosts));
+	#endif
+	__builtin_memcpy(s + 1, ctx->channels,
+	                 sizeof(xm_channel_context_t) * ctx->module.num_channels);
+}
+
+uint32_t xm_size_for_seek_index(const xm_context_t* ctx,
+                                uint16_t num_snapshots) {
+	return (uint32_t)sizeof(xm_seek_index_t)
+		+ SEEK_SNAPSHOT_SIZE(ctx) * num_snapshots
+		+ (uint32_t)sizeof(uint16_t) * MAX_ROWS_PER_PATTERN
+		* ctx->module.length;
+}
+
+xm_seek_index_t* xm_build_seek_index(xm_context_t* ctx, char* buffer,
+                                     uint32_t size,
+                                     uint16_t rows_per_snapshot) {
+	assert((uintptr_t)buffer % alignof(xm_seek_index_t) == 0);
+	assert(ctx->loop_count == 0);
+	uint32_t fixed_size = xm_size_for_seek_index(ctx, 0);
+	if(size < fixed_size + 2 * SEEK_SNAPSHOT_SIZE(ctx)) return NULL;
+	#if XM_EVENTS
+	/* Not actual playback, don't write any events */
+	xm_event_t* events = ctx->events;
+	ctx->events = NULL;
+	#endif
+
+	xm_seek_index_t* idx = (xm_seek_index_t*)buffer;
+	uint32_t max_snapshots = (size - fixed_size) / SEEK_SNAPSHOT_SIZE(ctx);
+	*idx = (xm_seek_index_t){
+		.ctx = ctx,
+		#if XM_TIMING_FUNCTIONS
+		.generated_samples = ctx->generated_samples,
+		#endif
+		.rows_per_snapshot = rows_per_snapshot ? rows_per_snapshot : 1,
+		.max_snapshots = max_snapshots > UINT16_MAX
+		                 ? UINT16_MAX : (uint16_t)max_snapshots,
+	};
+	uint16_t* visits = xm_seek_visits(idx);
+
+	uint32_t position = 0;
+	uint32_t num_visits = 0;
+	uint32_t rows = 0;
+	while(ctx->loop_count == 0) {
+		/* At this point, the previous tick is completely over */
+		assert(ctx->remaining_samples_in_tick < TICK_SUBSAMPLES);
+
+		bool is_row = xm_next_tick_is_row(ctx);
+		uint16_t row = 0;
+		uint8_t count = 0;
+		if(is_row) {
+			/* Jumps would be applied by xm_row() anyway, doing it
+			   now tells which row is going to be played */
+			xm_apply_jumps(ctx);
+			row = (uint16_t)(MAX_ROWS_PER_PATTERN
+			                 * ctx->current_table_index
+			                 + ctx->current_row);
+			count = ctx->row_loop_count[row];
+
+			if(rows % idx->rows_per_snapshot == 0
+			   && idx->num_snapshots == idx->max_snapshots) {
+				/* Out of space, drop every other snapshot */
+				for(uint16_t i = 1; 2 * i < idx->num_snapshots; ++i) {
+					__builtin_memcpy(xm_seek_snapshot(idx, i),
+					                 xm_seek_snapshot(idx, (uint16_t)(2 * i)),
+					                 SEEK_SNAPSHOT_SIZE(ctx));
+				}
+				idx->num_snapshots = (uint16_t)((idx->num_snapshots + 1) / 2);
+				idx->rows_per_snapshot *= 2;
+			}
+			if(rows % idx->rows_per_snapshot == 0) {
+				xm_save_snapshot(ctx, xm_seek_snapshot(idx, idx->num_snapshots++),
+				                 position, num_visits);
+			}
+			rows++;
+		}
+
+		uint16_t span = xm_begin_span(ctx, UINT16_MAX);
+		if(ctx->loop_count) break;
+		if(is_row && ctx->row_loop_count[row] != count) {
+			visits[num_visits++] = row;
+		}
+		xm_dry_run_span(ctx, span);
+		position += span;
+	}
+
+	idx->length = position;
+	xm_seek_exact(ctx, idx, 0);
+	#if XM_EVENTS
+	ctx->events = events;
+	#endif
+	return idx;
+}
+
+uint32_t xm_get_seek_index_length(const xm_seek_index_t* idx) {
+	return idx->length;
+}
+
+void xm_seek_exact(xm_context_t* ctx, const xm_seek_index_t* idx,
+                   uint32_t samples) {
+	assert(idx->ctx == ctx);
+	assert(idx->num_snapshots > 0);
+	#if XM_EVENTS
+	/* Not actual playback, don't write any events */
+	xm_event_t* events = ctx->events;
+	ctx->events = NULL;
+	#endif
+
+	/* Find the last snapshot at or before the requested position */
+	uint16_t lo = 0, hi = idx->num_snapshots;
+	while(hi - lo > 1) {
+		uint16_t mid = (uint16_t)((lo + hi) / 2);
+		if(xm_seek_snapshot(idx, mid)->position <= samples) {
+			lo = mid;
+		} else {
+			hi = mid;
+		}
+	}
+	const xm_seek_snapshot_t* s = xm_seek_snapshot(idx, lo);
+
+	ctx->remaining_samples_in_tick = s->remaining_samples_in_tick;
+	ctx->current_tick = s->current_tick;
+	ctx->extra_rows_done = s->extra_rows_done;
+	ctx->current_row = s->current_row;
+	ctx->extra_rows = s->extra_rows;
+	ctx->current_table_index = s->current_table_index;
+	ctx->global_volume = s->global_volume;
+	ctx->tempo = s->tempo;
+	ctx->bpm = s->bpm;
+	ctx->position_jump = s->position_jump;
+	ctx->pattern_break = s->pattern_break;
+	ctx->jump_dest = s->jump_dest;
+	ctx->jump_row = s->jump_row;
+	ctx->loop_count = s->loop_count;
 	#if XM_TIMING_FUNCTIONS
-	ctx->generated_samples += numsamples;
+	ctx->generated_samples = idx->generated_samples + s->position;
+	#endif
+	#if XM_RAMPING
+	__builtin_memcpy(ctx->ghosts, s->ghosts, sizeof(ctx->ghosts));
+	#endif
+	/* Mute status and profiling counters are not playback state, keep
+	   them as they are now */
+	for(uint8_t i = 0; i < ctx->module.num_channels; ++i) {
+		xm_channel_context_t* ch = ctx->channels + i;
+		bool muted = ch->muted;
+		#if XM_PROFILING
+		xm_profile_t profile = ch->profile;
+		#endif
+		__builtin_memcpy(ch, (const xm_channel_context_t*)(s + 1) + i,
+		                 sizeof(xm_channel_context_t));
+		ch->muted = muted;
+		#if XM_PROFILING
+		ch->profile = profile;
+		#endif
+	}
+
+	__builtin_memset(ctx->row_loop_count, 0,
+	                 MAX_ROWS_PER_PATTERN * ctx->module.length);
+	const uint16_t* visits = xm_seek_visits(idx);
+	for(uint32_t i = 0; i < s->num_visits; ++i) {
+		ctx->row_loop_count[visits[i]] = 1;
+	}
+
+	/* active_channels is only used after the next xm_tick(), which
+	   rebuilds it */
+	for(uint32_t left = samples - s->position; left; ) {
+		uint16_t span = xm_begin_span(ctx, left > UINT16_MAX
+		                              ? UINT16_MAX : (uint16_t)left);
+		xm_dry_run_span(ctx, span);
+		left -= span;
+	}
+
+	#if XM_EVENTS
+	ctx->events = events;
+	ctx->events_pattern_index = UINT32_MAX;
 	#endif
-	for(uint16_t i = 0; i < numsamples;
-	    ++i, out += ctx->module.num_channels * 2) {
-		xm_sample_unmixed(ctx, out);
+}
+
+uint32_t xm_analyze_timeline(xm_context_t* ctx, xm_timeline_row_t* rows,
+                             uint32_t max_rows, uint32_t* num_rows) {
+	const uint8_t loops = ctx->max_loop_count ? ctx->max_loop_count : 1;
+	uint32_t position = 0;
+	uint32_t n = 0;
+	#if XM_EVENTS
+	/* Not actual playback, don't write any events */
+	xm_event_t* events = ctx->events;
+	ctx->events = NULL;
+	#endif
+
+	while(ctx->loop_count < loops) {
+		assert(ctx->remaining_samples_in_tick < TICK_SUBSAMPLES);
+		bool is_row = xm_next_tick_is_row(ctx);
+		if(is_row) {
+			/* Resolve jumps now, to know which row is next */
+			xm_apply_jumps(ctx);
+			if(n < max_rows) {
+				rows[n].position = position;
+				rows[n].pattern_index = ctx->current_table_index;
+				rows[n].row = ctx->current_row;
+			}
+		}
+
+		/* Sample positions don't matter for sequencing, so nothing is
+		   done for the span itself */
+		uint16_t span = xm_begin_span(ctx, UINT16_MAX);
+		if(ctx->loop_count >= loops) break;
+		if(is_row) {
+			if(n < max_rows) {
+				rows[n].tempo = ctx->tempo;
+				rows[n].bpm = ctx->bpm;
+			}
+			n++;
+		}
+		position += span;
 	}
+
+	if(num_rows) *num_rows = n;
+	#if XM_EVENTS
+	ctx->events = events;
+	#endif
+	return position;
 }
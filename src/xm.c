@@ -7,6 +7,24 @@
  * http://sam.zoy.org/wtfpl/COPYING for more details. */
 
 #include "xm_internal.h"
+#include <stddef.h>
+
+/* Start of the playback state in xm_context_t, see xm_save_state() */
+#define STATE_CTX_OFFSET offsetof(xm_context_t, remaining_samples_in_tick)
+
+/* Store a pointer into the array base as its index plus one, so that NULL
+   pointers are kept as is. Shared contexts point into the module data of
+   their source context, so the base must be the array, not the context. */
+#define STATE_CALC_OFFSET(dest, base) do { \
+		if(dest) (dest) = (void*)((intptr_t)((dest) - (base)) + 1); \
+	} while(0)
+
+#define STATE_APPLY_OFFSET(dest, base) do { \
+		if(dest) (dest) = (base) + ((intptr_t)(dest) - 1); \
+	} while(0)
+
+static uint32_t xm_interpolation_taps(xm_interpolation_t) __attribute__((warn_unused_result));
+static float xm_sinc(float) __attribute__((warn_unused_result));
 
 
 
@@ -25,6 +43,216 @@ void xm_seek(xm_context_t* ctx, uint8_t pot, uint8_t row, uint8_t tick) {
 	ctx->current_row = row;
 	ctx->current_tick = tick;
 	ctx->remaining_samples_in_tick = 0;
+	#if XM_EVENTS
+	ctx->events_pattern_index = UINT32_MAX;
+	#endif
+}
+
+
+
+/* @returns the number of taps of an interpolation mode, or 0 if it needs no
+   table */
+static uint32_t xm_interpolation_taps(xm_interpolation_t mode) {
+	switch(mode) {
+	case XM_INTERPOLATION_CUBIC:
+		return 4;
+	case XM_INTERPOLATION_SINC:
+		return MAX_INTERPOLATION_TAPS;
+	default:
+		return 0;
+	}
+}
+
+static float xm_sinc(float x) {
+	if(x == 0.f) return 1.f;
+	x *= 3.14159265f;
+	return sinf(x) / x;
+}
+
+uint32_t xm_size_for_interpolation_table(xm_interpolation_t mode) {
+	uint32_t taps = xm_interpolation_taps(mode);
+	if(taps == 0) return 0;
+	return (uint32_t)(sizeof(xm_interpolation_table_t)
+	                  + sizeof(float) * INTERPOLATION_PHASES * taps);
+}
+
+xm_interpolation_table_t* xm_build_interpolation_table(xm_interpolation_t mode,
+                                                       char* buffer) {
+	uint32_t taps = xm_interpolation_taps(mode);
+	if(taps == 0) return NULL;
+	assert((uintptr_t)buffer % alignof(xm_interpolation_table_t) == 0);
+	xm_interpolation_table_t* table = (xm_interpolation_table_t*)buffer;
+	table->taps = taps;
+
+	for(uint32_t p = 0; p < INTERPOLATION_PHASES; ++p) {
+		float* c = table->coefs + p * taps;
+		float t = (float)p / (float)INTERPOLATION_PHASES;
+
+		if(mode == XM_INTERPOLATION_CUBIC) {
+			/* Catmull-Rom spline, through frames a-1 to a+2 */
+			c[0] = ((-.5f * t + 1.f) * t - .5f) * t;
+			c[1] = (1.5f * t - 2.5f) * t * t + 1.f;
+			c[2] = ((-1.5f * t + 2.f) * t + .5f) * t;
+			c[3] = (.5f * t - .5f) * t * t;
+			continue;
+		}
+
+		/* Lanczos kernel, sinc(x) * sinc(x / (taps/2)), normalised so
+		   that constant signals are left as is */
+		float sum = 0.f;
+		for(uint32_t j = 0; j < taps; ++j) {
+			float x = (float)j - (float)(taps / 2 - 1) - t;
+			c[j] = xm_sinc(x) * xm_sinc(x / (float)(taps / 2));
+			sum += c[j];
+		}
+		for(uint32_t j = 0; j < taps; ++j) {
+			c[j] /= sum;
+		}
+	}
+
+	return table;
+}
+
+void xm_set_interpolation_table(xm_context_t* ctx,
+                                const xm_interpolation_table_t* table) {
+	ctx->interpolation = table;
+}
+
+#if XM_STREAMING
+uint32_t xm_size_for_sample_provider(const xm_context_t* ctx) {
+	return (uint32_t)(sizeof(xm_stream_window_t)
+	                  * ctx->module.num_channels);
+}
+
+void xm_set_sample_provider(xm_context_t* ctx, xm_sample_provider_t provider,
+                            void* user, char* buffer) {
+	ctx->provider = provider;
+	ctx->provider_user = user;
+	if(provider == NULL) {
+		ctx->streams = NULL;
+		return;
+	}
+
+	assert(buffer != NULL);
+	assert((uintptr_t)buffer % alignof(xm_stream_window_t) == 0);
+	ctx->streams = (xm_stream_window_t*)buffer;
+	for(uint8_t i = 0; i < ctx->module.num_channels; ++i) {
+		/* Window samples are told apart from real samples (and from
+		   each other) by their index, see xm_sample_data() */
+		ctx->streams[i].sample.index = STREAM_INDEX + 1 + i;
+		ctx->streams[i].length = 0;
+		ctx->streams[i].source = UINT16_MAX;
+	}
+}
+#else
+uint32_t xm_size_for_sample_provider([[maybe_unused]] const xm_context_t* ctx) {
+	return 0;
+}
+
+void xm_set_sample_provider([[maybe_unused]] xm_context_t* ctx,
+                            [[maybe_unused]] xm_sample_provider_t provider,
+                            [[maybe_unused]] void* user,
+                            [[maybe_unused]] char* buffer) {}
+#endif
+
+void xm_set_quality(xm_context_t* ctx, uint8_t flags) {
+	ctx->quality = flags & QUALITY_AVAILABLE;
+
+	#if XM_RAMPING
+	if(!(ctx->quality & XM_QUALITY_RAMPING)) {
+		/* Only the ramping mixer advances volume ramps and ghosts,
+		   end them now instead of resuming them stale if ramping is
+		   turned back on */
+		__builtin_memset(ctx->ghosts, 0, sizeof(ctx->ghosts));
+		for(uint8_t i = 0; i < ctx->module.num_channels; ++i) {
+			ctx->channels[i].ramp_frames = 0;
+		}
+	}
+	#endif
+}
+
+uint8_t xm_get_quality(const xm_context_t* ctx) {
+	return (uint8_t)ctx->quality;
+}
+
+
+
+uint32_t xm_size_for_state(const xm_context_t* ctx) {
+	return (uint32_t)(sizeof(xm_context_t) - STATE_CTX_OFFSET
+	                  + sizeof(xm_channel_context_t) * ctx->module.num_channels
+	                  + sizeof(uint8_t) * MAX_ROWS_PER_PATTERN
+	                  * ctx->module.length
+	                  #if XM_TIMING_FUNCTIONS
+	                  + sizeof(uint32_t) * (ctx->module.num_instruments
+	                                        + ctx->module.num_samples)
+	                  #endif
+	                  );
+}
+
+void xm_save_state(const xm_context_t* ctx, char* out) {
+	__builtin_memcpy(out, (const char*)ctx + STATE_CTX_OFFSET,
+	                 sizeof(xm_context_t) - STATE_CTX_OFFSET);
+	out += sizeof(xm_context_t) - STATE_CTX_OFFSET;
+
+	/* Channels point inside the module data, store indexes instead so that
+	   the state can be restored in another context */
+	for(uint8_t i = 0; i < ctx->module.num_channels; ++i) {
+		xm_channel_context_t ch = ctx->channels[i];
+		STATE_CALC_OFFSET(ch.instrument, ctx->instruments);
+		STATE_CALC_OFFSET(ch.sample, ctx->samples);
+		if((uintptr_t)ch.current - (uintptr_t)ctx->pattern_slots
+		   >= sizeof(xm_pattern_slot_t) * ctx->rows[ctx->module.num_rows]) {
+			/* The shared empty slot of play.c, never read by
+			   xm_tick() (its tick_effects are 0) until the next
+			   row sets it again */
+			ch.current = NULL;
+		}
+		STATE_CALC_OFFSET(ch.current, ctx->pattern_slots);
+		__builtin_memcpy(out, &ch, sizeof(ch));
+		out += sizeof(ch);
+	}
+
+	__builtin_memcpy(out, ctx->row_loop_count,
+	                 MAX_ROWS_PER_PATTERN * ctx->module.length);
+	out += MAX_ROWS_PER_PATTERN * ctx->module.length;
+
+	#if XM_TIMING_FUNCTIONS
+	__builtin_memcpy(out, ctx->instrument_triggers,
+	                 sizeof(uint32_t) * ctx->module.num_instruments);
+	out += sizeof(uint32_t) * ctx->module.num_instruments;
+	__builtin_memcpy(out, ctx->sample_triggers,
+	                 sizeof(uint32_t) * ctx->module.num_samples);
+	#endif
+}
+
+void xm_restore_state(xm_context_t* ctx, const char* state) {
+	const uint8_t max_loop_count = ctx->max_loop_count;
+	__builtin_memcpy((char*)ctx + STATE_CTX_OFFSET, state,
+	                 sizeof(xm_context_t) - STATE_CTX_OFFSET);
+	ctx->max_loop_count = max_loop_count;
+	state += sizeof(xm_context_t) - STATE_CTX_OFFSET;
+
+	__builtin_memcpy(ctx->channels, state,
+	                 sizeof(xm_channel_context_t) * ctx->module.num_channels);
+	state += sizeof(xm_channel_context_t) * ctx->module.num_channels;
+	for(uint8_t i = 0; i < ctx->module.num_channels; ++i) {
+		xm_channel_context_t* ch = ctx->channels + i;
+		STATE_APPLY_OFFSET(ch->instrument, ctx->instruments);
+		STATE_APPLY_OFFSET(ch->sample, ctx->samples);
+		STATE_APPLY_OFFSET(ch->current, ctx->pattern_slots);
+	}
+
+	__builtin_memcpy(ctx->row_loop_count, state,
+	                 MAX_ROWS_PER_PATTERN * ctx->module.length);
+	state += MAX_ROWS_PER_PATTERN * ctx->module.length;
+
+	#if XM_TIMING_FUNCTIONS
+	__builtin_memcpy(ctx->instrument_triggers, state,
+	                 sizeof(uint32_t) * ctx->module.num_instruments);
+	state += sizeof(uint32_t) * ctx->module.num_instruments;
+	__builtin_memcpy(ctx->sample_triggers, state,
+	                 sizeof(uint32_t) * ctx->module.num_samples);
+	#endif
 }
 
 
@@ -111,11 +339,38 @@ xm_sample_point_t* xm_get_sample_waveform(xm_context_t* ctx,
                                           uint8_t sample, uint32_t* length) {
 	xm_sample_t* s = ctx->samples + ctx->instruments[instrument-1].samples_index + sample;
 	*length = s->length;
+	if(SAMPLE_IS_STREAMED(s)) return NULL;
 	return ctx->samples_data + s->index;
 }
 
+void xm_update_sample_waveform(xm_context_t* ctx, uint8_t instrument,
+                               uint8_t sample) {
+	xm_sample_t* s = ctx->samples + ctx->instruments[instrument-1].samples_index + sample;
+	if(SAMPLE_IS_STREAMED(s)) return;
+	xm_sample_point_t* data = ctx->samples_data + s->index;
+	uint32_t end = s->length;
+
+	/* See SAMPLE_GUARD_LENGTH */
+	if(s->ping_pong && s->loop_length > 0) {
+		for(uint32_t i = 0; i < s->loop_length; ++i) {
+			data[end + i] = data[s->length - 1 - i];
+		}
+		end += s->loop_length;
+	}
+
+	if(s->loop_length > 0) {
+		data[end] = data[s->length - s->loop_length];
+	} else {
+		data[end] = (s->length > 0) ? data[s->length - 1] : 0;
+	}
+}
+
 
 
+bool xm_is_silent(const xm_context_t* ctx) {
+	return ctx->generated_silence;
+}
+
 void xm_get_playing_speed(const xm_context_t* ctx,
                           uint8_t* bpm, uint8_t* tempo) {
 	if(bpm) *bpm = ctx->bpm;
@@ -139,11 +394,11 @@ void xm_get_position(const xm_context_t* ctx, uint8_t* pattern_index,
 #if XM_TIMING_FUNCTIONS
 uint32_t xm_get_latest_trigger_of_instrument(const xm_context_t* ctx,
                                              uint8_t instr) {
-	return ctx->instruments[instr-1].latest_trigger;
+	return ctx->instrument_triggers[instr-1];
 }
 uint32_t xm_get_latest_trigger_of_sample(const xm_context_t* ctx,
                                          uint8_t instr, uint8_t sample) {
-	return ctx->samples[ctx->instruments[instr-1].samples_index + sample].latest_trigger;
+	return ctx->sample_triggers[ctx->instruments[instr-1].samples_index + sample];
 }
 uint32_t xm_get_latest_trigger_of_channel(const xm_context_t* ctx,
                                           uint8_t chn) {
@@ -161,6 +416,59 @@ uint32_t xm_get_latest_trigger_of_channel([[maybe_unused]] const xm_context_t* c
 }
 #endif
 
+#if XM_EVENTS
+void xm_set_event_buffer(xm_context_t* ctx, xm_event_t* events,
+                         uint32_t length) {
+	assert(events == NULL || (length && (length & (length - 1)) == 0));
+	ctx->events = events;
+	ctx->events_mask = length - 1;
+	ctx->events_written = 0;
+	ctx->events_pattern_index = UINT32_MAX;
+}
+uint32_t xm_get_events_written(const xm_context_t* ctx) {
+	return ctx->events_written;
+}
+#else
+void xm_set_event_buffer([[maybe_unused]] xm_context_t* ctx, [[maybe_unused]] xm_event_t* events, [[maybe_unused]] uint32_t length) {
+}
+uint32_t xm_get_events_written([[maybe_unused]] const xm_context_t* ctx) {
+	return 0;
+}
+#endif
+
+#if XM_PROFILING
+void xm_get_profile(const xm_context_t* ctx, uint8_t chn, xm_profile_t* out) {
+	if(chn) {
+		*out = ctx->channels[chn - 1].profile;
+		return;
+	}
+
+	*out = ctx->profile;
+	for(uint8_t i = 0; i < ctx->module.num_channels; ++i) {
+		const xm_profile_t* p = &(ctx->channels[i].profile);
+		out->tick_effects_time += p->tick_effects_time;
+		out->tick_envelopes_time += p->tick_envelopes_time;
+		out->mix_time += p->mix_time;
+		out->frames_mixed += p->frames_mixed;
+		out->note_triggers += p->note_triggers;
+		out->loop_wraps += p->loop_wraps;
+	}
+}
+
+void xm_reset_profile(xm_context_t* ctx) {
+	__builtin_memset(&(ctx->profile), 0, sizeof(xm_profile_t));
+	for(uint8_t i = 0; i < ctx->module.num_channels; ++i) {
+		__builtin_memset(&(ctx->channels[i].profile), 0,
+		                 sizeof(xm_profile_t));
+	}
+}
+#else
+void xm_get_profile([[maybe_unused]] const xm_context_t* ctx, [[maybe_unused]] uint8_t chn, xm_profile_t* out) {
+	__builtin_memset(out, 0, sizeof(xm_profile_t));
+}
+void xm_reset_profile([[maybe_unused]] xm_context_t* ctx) {}
+#endif
+
 bool xm_is_channel_active(const xm_context_t* ctx, uint8_t chn) {
 	const xm_channel_context_t* ch = ctx->channels + (chn - 1);
 	return ch->sample != NULL
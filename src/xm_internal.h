@@ -11,6 +11,12 @@
 #include <string.h>
 #include <stdckdint.h>
 
+#if XM_SIMD && defined(__SSE2__)
+#include <immintrin.h>
+#elif XM_SIMD && defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
 #if XM_VERBOSE
 #include <stdio.h>
 #define NOTICE(fmt, ...) do {                                           \
@@ -21,6 +27,18 @@
 #define NOTICE(...)
 #endif
 
+#if XM_PROFILING
+#include <time.h>
+/* Add the time elapsed since PROFILE_START() to an xm_profile_t counter */
+#define PROFILE_START() const uint64_t profile_start = xm_profile_now()
+#define PROFILE_END(counter) ((counter) += xm_profile_now() - profile_start)
+#define PROFILE_COUNT(counter, n) ((counter) += (n))
+#else
+#define PROFILE_START()
+#define PROFILE_END(counter)
+#define PROFILE_COUNT(counter, n)
+#endif
+
 #if NDEBUG
 #define UNREACHABLE() __builtin_unreachable()
 #define assert(x) (void)(x)
@@ -54,7 +72,14 @@ static_assert(!(XM_LIBXM_DELTA_SAMPLES && _Generic((xm_sample_point_t){},
 #define NUM_NOTES 96
 #define MAX_ENVELOPE_POINTS 12
 #define MAX_ROWS_PER_PATTERN 256
-#define RAMPING_POINTS 31
+#define RAMPING_FRAMES 64 /* Length of volume ramps and ghost voice fade
+                            outs, in frames */
+#define MAX_GHOSTS 16
+
+/* Quality features compiled in, see xm_set_quality() */
+#define QUALITY_AVAILABLE ((XM_RAMPING ? XM_QUALITY_RAMPING : 0) \
+                           | (XM_LINEAR_INTERPOLATION \
+                              ? XM_QUALITY_LINEAR_INTERPOLATION : 0))
 #define MAX_VOLUME 64
 #define MAX_FADEOUT_VOLUME 32768
 #define MAX_PANNING 256 /* cannot be stored in a uint8_t, this is ft2
@@ -71,11 +96,6 @@ static_assert(!(XM_LIBXM_DELTA_SAMPLES && _Generic((xm_sample_point_t){},
    has been loaded */
 #define KEY_OFF_NOTE 128
 
-/* How much is a channel final volume allowed to change per audio frame; this is
-   used to avoid abrubt volume changes which manifest as "clicks" in the
-   generated sound. */
-#define RAMPING_VOLUME_RAMP (1.f/128.f)
-
 /* Final amplification factor for the generated audio frames. This value is a
    compromise between too quiet output and clipping. */
 #define AMPLIFICATION .25f
@@ -87,6 +107,10 @@ static_assert(!(XM_LIBXM_DELTA_SAMPLES && _Generic((xm_sample_point_t){},
    about 0.00003%. */
 #define TICK_SUBSAMPLES (1<<13)
 
+/* Highest supported output rate, so that ctx->remaining_samples_in_tick can
+   hold a whole tick at MIN_BPM, plus what is left of the previous tick. */
+#define MAX_RATE (UINT32_MAX / 2 / (10 * TICK_SUBSAMPLES / 4 / MIN_BPM))
+
 /* Granularity of ch->step and ch->sample_position, for precise pitching of
    samples. Minimum sample step is about 0.008 per frame, at 65535 Hz, when
    playing C-0. For C-1 at 48000 Hz, the step is about 0.02.
@@ -94,13 +118,76 @@ static_assert(!(XM_LIBXM_DELTA_SAMPLES && _Generic((xm_sample_point_t){},
    For example, with 2^12 microsteps, that means the worst pitch error is
    log2((.008 * 2^12 + 0.5)/(.008 * 2^12))*1200 = 26 cents. (Playing C-1 at 48000
    Hz, the error is 10 cents.) However, this only leaves 20 bits for the sample
-   position, effectively limiting the maximum sample size to 1M frames. */
+   position, effectively limiting the maximum sample size to 1M frames.
+
+   The error grows with the output rate: at 192000 Hz, C-0 is off by up to 76
+   cents. Use more XM_MICROSTEP_BITS for low notes at such rates. */
 #define SAMPLE_MICROSTEPS (1<<XM_MICROSTEP_BITS)
 
 #define MAX_SAMPLE_LENGTH (UINT32_MAX/SAMPLE_MICROSTEPS)
 
+/* Streamed samples (see xm_prescan_module_streaming()) have no frames in
+   ctx->samples_data, and are marked with this index. Their positions are 64
+   bits wide (see ch->stream_frame), so they are only limited to 2^31 frames,
+   which keeps their unrolled ping-pong loops below 2^32 frames. Indexes
+   above STREAM_INDEX are the window samples of each channel, see
+   xm_sample_data(). */
+#define STREAM_INDEX (1u << 31)
+#define MAX_STREAMED_SAMPLE_LENGTH (STREAM_INDEX - 1)
+static_assert(MAX_SAMPLE_LENGTH < STREAM_INDEX);
+#if XM_STREAMING
+#define SAMPLE_IS_STREAMED(smp) ((smp)->index == STREAM_INDEX)
+#else
+#define SAMPLE_IS_STREAMED(smp) false
+#endif
+
+/* Frames held in the window of each channel playing a streamed sample,
+   including one guard frame. Must be a multiple of 4, see
+   xm_stream_window_t. */
+#define STREAM_WINDOW_FRAMES 2048
+
+/* Size of ctx->period_steps: one octave of linear periods (1/64 semitones).
+   Entries have PERIOD_STEPS_FRAC_BITS extra bits of precision. Played notes
+   are at most 6 octaves above 8363 Hz, so that xm_octave_step() never shifts
+   left, and entries fit in 32 bits for any rate above 32 Hz. */
+#define PERIOD_STEPS_LENGTH 768
+#define PERIOD_STEPS_FRAC_BITS 11
+
+/* Number of extra frames stored after each sample in samples_data. Ping-pong
+   loops are unrolled (the loop, played backwards, is appended after the loop
+   end), so they can be played like a forward loop of twice the length. Then
+   one more guard frame holds the value of the frame that comes after the
+   last one (the loop start, or the last frame again for non-looping
+   samples), so that the mixer can always read frame a+1 without checking
+   for the end of the loop. */
+#define SAMPLE_GUARD_LENGTH(loop_length, ping_pong) \
+	(1 + ((ping_pong) ? (loop_length) : 0))
+
+/* Interpolation tables hold taps coefficients for each of their
+   INTERPOLATION_PHASES phases. The phase of a sample position is its
+   fractional part, truncated to INTERPOLATION_PHASE_BITS bits. */
+#define INTERPOLATION_PHASE_BITS 8
+#define INTERPOLATION_PHASES (1<<INTERPOLATION_PHASE_BITS)
+#define INTERPOLATION_PHASE(pos) (((pos) % SAMPLE_MICROSTEPS) \
+                                  >> (XM_MICROSTEP_BITS - INTERPOLATION_PHASE_BITS))
+static_assert(XM_MICROSTEP_BITS >= INTERPOLATION_PHASE_BITS);
+
+/* Maximum number of taps of an interpolation table, must be a multiple
+   of 4 */
+#define MAX_INTERPOLATION_TAPS 8
+static_assert(STREAM_WINDOW_FRAMES > 4 * MAX_INTERPOLATION_TAPS);
+
 /* ----- Data types ----- */
 
+struct xm_interpolation_table_s {
+	/* Tap j of a position in frame a is frame a-taps/2+1+j. Taps are
+	   read straight from samples_data when they all are in
+	   0..=SAMPLE_LOOP_END (the last one can be the guard frame), see
+	   xm_safe_run_length(). */
+	uint32_t taps; /* 4 or MAX_INTERPOLATION_TAPS */
+	float coefs[]; /* INTERPOLATION_PHASES * taps, phase by phase */
+};
+
 struct xm_envelope_point_s {
 	uint16_t frame;
 	static_assert(MAX_ENVELOPE_VALUE < UINT8_MAX);
@@ -124,11 +211,8 @@ struct xm_envelope_s {
 typedef struct xm_envelope_s xm_envelope_t;
 
 struct xm_sample_s {
-	#if XM_TIMING_FUNCTIONS
-	uint32_t latest_trigger;
-	#endif
-
-	/* ctx->samples_data[index..(index+length)] */
+	/* ctx->samples_data[index..(index+length)], followed by
+	   SAMPLE_GUARD_LENGTH(loop_length, ping_pong) guard frames */
 	uint32_t index;
 	uint32_t length; /* same as loop_end (seeking beyond a loop with 9xx is
 	                    invalid anyway) */
@@ -140,6 +224,12 @@ struct xm_sample_s {
 	int8_t finetune; /* -16..15 (-1 semitone..+15/16 semitone) */
 	int8_t relative_note;
 
+	#if XM_LAZY_SAMPLES
+	/* Type and offset in the module of the sample data, if it is not
+	   decoded yet (see xm_create_context_lazy()), or 0 */
+	uint32_t lazy;
+	#endif
+
 	#if XM_STRINGS
 	static_assert(SAMPLE_NAME_LENGTH % 8 == 0);
 	char name[SAMPLE_NAME_LENGTH];
@@ -148,10 +238,6 @@ struct xm_sample_s {
 typedef struct xm_sample_s xm_sample_t;
 
 struct xm_instrument_s {
-	#if XM_TIMING_FUNCTIONS
-	uint32_t latest_trigger;
-	#endif
-
 	xm_envelope_t volume_envelope;
 	xm_envelope_t panning_envelope;
 	uint8_t sample_of_notes[NUM_NOTES];
@@ -174,17 +260,20 @@ struct xm_instrument_s {
 };
 typedef struct xm_instrument_s xm_instrument_t;
 
+/* Only non-empty slots are stored, in row order then channel order */
 struct xm_pattern_slot_s {
 	uint8_t note; /* 1..=96 = Notes 0..=95, KEY_OFF_NOTE = Key Off */
 	uint8_t instrument; /* 1..=128 */
 	uint8_t volume_column;
 	uint8_t effect_type;
 	uint8_t effect_param;
+	uint8_t channel; /* 0..num_channels */
 };
 typedef struct xm_pattern_slot_s xm_pattern_slot_t;
 
 struct xm_pattern_s {
-	/* ctx->pattern_slots[index*num_chans..(index+num_rows)*num_chans] */
+	/* Slots of row i of this pattern are
+	   ctx->pattern_slots[ctx->rows[index+i]..ctx->rows[index+i+1]] */
 	static_assert((MAX_PATTERNS - 1) * MAX_ROWS_PER_PATTERN < UINT16_MAX);
 	uint16_t rows_index;
 	uint16_t num_rows;
@@ -213,32 +302,58 @@ struct xm_module_s {
 	char trackername[TRACKER_NAME_LENGTH];
 	#endif
 
+	/* Speed at the start of the module, ctx->tempo and ctx->bpm are the
+	   current speed */
+	uint8_t tempo;
+	uint8_t bpm;
+
+	#if XM_LAZY_SAMPLES
+	uint16_t lazy_table_index; /* Next POT entry to scan for samples to
+	                              decode, 0..=length */
 	char __pad[2];
+	#endif
 };
 typedef struct xm_module_s xm_module_t;
 
 struct xm_channel_context_s {
-	xm_instrument_t* instrument; /* Last instrument triggered by a note.
-	                                Could be NULL. */
+	#if XM_PROFILING
+	xm_profile_t profile; /* Only the per channel counters are used */
+	#endif
+
+	/* The mixer handles one channel at a time, for a whole span, and only
+	   reads the fields from here to ramp_frames (and muted). Keep them
+	   together at the start, in the same cache line. Everything else is
+	   only used by xm_tick(). */
 	xm_sample_t* sample; /* Last sample triggered by a note. Could be
 	                        NULL */
-	xm_pattern_slot_t* current;
-
-	#if XM_TIMING_FUNCTIONS
-	uint32_t latest_trigger; /* In generated samples (1/ctx->rate secs) */
-	#endif
+	xm_instrument_t* instrument; /* Last instrument triggered by a note.
+	                                Could be NULL. */
+	const xm_pattern_slot_t* current; /* Never NULL during playback, empty
+	                                     slots point to a shared empty
+	                                     slot (or NULL after
+	                                     xm_restore_state()) */
 
 	uint32_t sample_position; /* In microsteps */
 	uint32_t step; /* In microsteps */
+	#if XM_STREAMING
+	/* In frames, added to sample_position for streamed samples whose
+	   positions do not fit in 32 bits, see xm_channel_position(). 0
+	   whenever the position fits. */
+	uint32_t stream_frame;
+	#endif
 
-	float actual_volume[2]; /* Multiplier for left/right channel */
+	float actual_volume[2]; /* Multiplier for left/right channel, at the
+	                           end of the current volume ramp */
 	#if XM_RAMPING
-	/* These values are updated at the end of each tick, to save
-	 * a couple of float operations on every generated sample. */
-	float target_volume[2];
-	uint32_t frame_count; /* Gets reset after every note */
-	static_assert(RAMPING_POINTS % 2 == 1);
-	float end_of_previous_sample[RAMPING_POINTS];
+	/* Set at the end of each tick, so that the volume reaches
+	   actual_volume linearly over RAMPING_FRAMES frames. The current
+	   volume is actual_volume - ramp_frames * volume_step. */
+	float volume_step[2];
+	uint32_t ramp_frames; /* Frames left in the volume ramp */
+	#endif
+
+	#if XM_TIMING_FUNCTIONS
+	uint32_t latest_trigger; /* In generated samples (1/ctx->rate secs) */
 	#endif
 
 	uint16_t period; /* 1/64 semitone increments (linear frequencies) */
@@ -250,6 +365,8 @@ struct xm_channel_context_s {
 	uint16_t autovibrato_ticks;
 	uint16_t volume_envelope_frame_count;
 	uint16_t panning_envelope_frame_count;
+	bool muted; /* First of the 1 byte fields, as it is read by the
+	               mixer */
 	uint8_t volume_envelope_volume; /* 0..=MAX_ENVELOPE_VALUE  */
 	uint8_t panning_envelope_panning; /* 0..=MAX_ENVELOPE_VALUE */
 
@@ -261,6 +378,7 @@ struct xm_channel_context_s {
 	int8_t finetune;
 	uint8_t next_instrument; /* Last instrument seen in the
 	                            instrument column. Could be 0. */
+	uint8_t tick_effects; /* TICK_* flags of current, set by xm_row() */
 
 	int8_t autovibrato_note_offset; /* in 1/64 semitones */
 	uint8_t arp_note_offset; /* in semitones */
@@ -298,19 +416,65 @@ struct xm_channel_context_s {
 	bool tremor_on;
 
 	bool sustained;
-	bool muted;
 
 	#if XM_TIMING_FUNCTIONS
-	char __pad[7 % (UINTPTR_MAX == UINT64_MAX ? 8 : 4)];
+	char __pad[(6 + (XM_RAMPING ? 4 : 0) + (XM_STREAMING ? 4 : 0))
+	           % (UINTPTR_MAX == UINT64_MAX ? 8 : 4)];
 	#else
-	char __pad[3];
+	char __pad[(2 + (XM_RAMPING ? 4 : 0) + (XM_STREAMING ? 4 : 0))
+	           % (UINTPTR_MAX == UINT64_MAX ? 8 : 4)];
 	#endif
 };
 typedef struct xm_channel_context_s xm_channel_context_t;
 
+#if XM_STREAMING
+/* Frames of the streamed sample of a channel around its position, paged in
+   by xm_stream_begin() from the provider of xm_set_sample_provider(). */
+struct xm_stream_window_s {
+	/* Played by the mixer instead of the streamed sample: a copy of it,
+	   without loop, over the frames of data. Its length is the length
+	   of the window if it holds the end of a sample without loop, and
+	   MAX_SAMPLE_LENGTH otherwise, so that it never ends early. */
+	xm_sample_t sample;
+	/* Unrolled frame (see SAMPLE_LOOP_END()) of the streamed sample held
+	   in data[0]. Past the loop end, frames wrap around to the loop
+	   start, so the window never needs to loop. */
+	uint32_t start;
+	uint32_t length; /* Frames held in data, plus one guard frame */
+	uint16_t source; /* Index in ctx->samples of the streamed sample, or
+	                    UINT16_MAX if the window is empty */
+	char __pad[2];
+	xm_sample_point_t data[STREAM_WINDOW_FRAMES];
+};
+typedef struct xm_stream_window_s xm_stream_window_t;
+static_assert(STREAM_WINDOW_FRAMES % 4 == 0);
+#endif
+
+#if XM_RAMPING
+/* The fade out of a voice cut by a new note, so that the new note doesn't
+   click. Ghosts have no pointers, so they can be copied with the rest of
+   the playback state. */
+struct xm_ghost_s {
+	float volume[2]; /* At the start of the fade out */
+	uint32_t sample_position; /* In microsteps */
+	uint32_t step; /* In microsteps */
+	uint16_t sample; /* Index in ctx->samples */
+	uint8_t channel; /* Index in ctx->channels, only mixed with it */
+	uint8_t frames; /* Left in the fade out, or 0 if the ghost is free */
+};
+typedef struct xm_ghost_s xm_ghost_t;
+static_assert(RAMPING_FRAMES <= UINT8_MAX);
+#endif
+
 struct xm_context_s {
+	#if XM_PROFILING
+	xm_profile_t profile; /* Only the per context counters are used */
+	#endif
+
 	xm_pattern_t* patterns;
 	xm_pattern_slot_t* pattern_slots;
+	uint32_t* rows; /* Index of the first slot of each row, plus one last
+	                   entry for the total number of slots */
 	xm_instrument_t* instruments; /* Instrument 1 has index 0,
 	                               * instrument 2 has index 1, etc. */
 	xm_sample_t* samples;
@@ -318,15 +482,67 @@ struct xm_context_s {
 	xm_channel_context_t* channels;
 	uint8_t* row_loop_count;
 
+	#if XM_TIMING_FUNCTIONS
+	/* Latest trigger of each instrument and sample, in generated samples.
+	   These are not stored in xm_instrument_t and xm_sample_t, which only
+	   hold module data and can be shared between contexts. */
+	uint32_t* instrument_triggers;
+	uint32_t* sample_triggers;
+	#endif
+
+	#if XM_EVENTS
+	xm_event_t* events; /* Ring provided by xm_set_event_buffer(), or
+	                       NULL */
+	#endif
+
+	/* Provided by xm_set_interpolation_table(), or NULL for the default
+	   linear (or nearest neighbour) interpolation */
+	const xm_interpolation_table_t* interpolation;
+
+	#if XM_STREAMING
+	/* Provided by xm_set_sample_provider(), or NULL if streamed samples
+	   are silent */
+	xm_sample_provider_t provider;
+	void* provider_user;
+	xm_stream_window_t* streams; /* One per channel */
+	#endif
+
 	xm_module_t module;
 
-	#if XM_TIMING_FUNCTIONS
-	uint32_t generated_samples;
+	/* Step of a sample played at 8363 * 2^(i/PERIOD_STEPS_LENGTH) Hz, in
+	   1/2^PERIOD_STEPS_FRAC_BITS microsteps. Rebuilt by xm_tick() when
+	   period_steps_rate != rate. */
+	uint32_t period_steps[PERIOD_STEPS_LENGTH];
+
+	uint32_t rate; /* Output sample rate, typically 44100 or 48000 */
+	uint32_t period_steps_rate; /* Rate of period_steps, or 0 if not built
+	                               yet */
+
+	uint32_t quality; /* XM_QUALITY_* flags, only the ones in
+	                     QUALITY_AVAILABLE */
+
+	#if XM_EVENTS
+	uint32_t events_mask; /* Length of the events ring, minus 1 */
+	uint32_t events_written; /* Mod 2^32 */
+	uint32_t events_offset; /* Samples generated since the start of the
+	                           current xm_generate_samples() call */
+	uint32_t events_pattern_index; /* Of the latest row event, or
+	                                  UINT32_MAX */
 	#endif
 
+	/* Everything from here to the end of the struct is playback state,
+	   copied as is by xm_save_state() (only max_loop_count is kept by
+	   xm_restore_state()) */
 	uint32_t remaining_samples_in_tick; /* In 1/TICK_SUBSAMPLE increments */
 
-	uint16_t rate; /* Output sample rate, typically 44100 or 48000 */
+	#if XM_TIMING_FUNCTIONS
+	uint32_t generated_samples;
+	#endif
+
+	#if XM_RAMPING
+	/* Shared by all channels, see xm_ghost_voice() */
+	xm_ghost_t ghosts[MAX_GHOSTS];
+	#endif
 
 	uint8_t current_tick; /* Typically 0..(ctx->tempo) */
 	uint8_t extra_rows_done;
@@ -345,12 +561,21 @@ struct xm_context_s {
 	uint8_t jump_row;
 
 	uint8_t loop_count;
-	uint8_t max_loop_count;
+	uint8_t max_loop_count; /* Not playback state, but nowhere else to
+	                           fit without padding */
 
+	bool generated_silence; /* Nothing was mixed in the last generated
+	                           samples */
+	uint8_t num_active_channels;
+	/* Channels with a sample playing or live ghosts, updated after every
+	   tick, in increasing order */
+	uint8_t active_channels[MAX_CHANNELS];
 
 	#if XM_TIMING_FUNCTIONS
-	char __pad[4 % (UINTPTR_MAX == UINT64_MAX ? 8 : 4)];
+	char __pad[(4 + 4 + 7 + 6 + (XM_LAZY_SAMPLES ? 0 : 4))
+	           % (UINTPTR_MAX == UINT64_MAX ? 8 : 4)];
 	#else
-	//char __pad[0];
+	char __pad[(4 + 7 + 6 + (XM_LAZY_SAMPLES ? 0 : 4))
+	           % (UINTPTR_MAX == UINT64_MAX ? 8 : 4)];
 	#endif
 };
@@ -0,0 +1,168 @@
+/* This program is free software. It comes without any warranty, to the
+ * extent permitted by applicable law. You can redistribute it and/or
+ * modify it under the terms of the Do What The Fuck You Want To Public
+ * License, Version 2, as published by Sam Hocevar. See
+ * http://sam.zoy.org/wtfpl/COPYING for more details. */
+
+/* Companion library of libxm, for generating samples with several threads,
+ * or ahead of time in a background thread. Unlike libxm itself, this library
+ * allocates memory and creates threads. */
+
+#pragma once
+#ifndef __has_xm_mt_h
+#define __has_xm_mt_h
+
+#include <xm.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct xm_batch_s;
+typedef struct xm_batch_s xm_batch_t;
+
+struct xm_player_s;
+typedef struct xm_player_s xm_player_t;
+
+
+
+/** Create a batch renderer, with its own pool of threads.
+ *
+ * @param num_threads total number of threads used to generate samples,
+ * including the thread calling xm_batch_generate_samples(). With 1, no
+ * thread is created and everything is done by the calling thread.
+ *
+ * @returns NULL on error (out of memory, or threads could not be created)
+ */
+xm_batch_t* xm_create_batch(uint8_t num_threads)
+__attribute__((warn_unused_result));
+
+/** Stop the threads of a batch renderer, and free it. */
+void xm_free_batch(xm_batch_t*)
+__attribute__((nonnull));
+
+/** Generate samples for several independent contexts at once.
+ *
+ * This has the same effect as calling xm_generate_samples(contexts[i],
+ * outputs[i], numsamples) for every i, but contexts are spread over the
+ * threads of the batch. As long as the same contexts are passed in the same
+ * order, each context stays on the same thread from one call to the next
+ * (unless another thread runs out of work and steals it).
+ *
+ * @param contexts[.num_contexts] contexts to generate samples from, must all
+ * be distinct
+ * @param outputs[.num_contexts] output buffers, each of size 2*numsamples
+ * (interleaved L and R)
+ *
+ * @note Must not be called concurrently on the same batch.
+ */
+void xm_batch_generate_samples(xm_batch_t*, xm_context_t* const* contexts,
+                               float* const* outputs, uint16_t num_contexts,
+                               uint16_t numsamples)
+__attribute__((nonnull));
+
+/** Generate samples for a single context, with its channels spread over the
+ * threads of the batch.
+ *
+ * The generated samples are exactly the same as with xm_generate_samples(),
+ * and so is xm_is_silent() afterwards. This is only worth it for modules with
+ * many channels, as threads have to synchronise at every tick.
+ *
+ * @param output[.2*numsamples] buffer of 2*numsamples elements
+ *
+ * @note Must not be called concurrently on the same batch.
+ */
+void xm_batch_generate_samples_channels(xm_batch_t*, xm_context_t*,
+                                        float* output, uint16_t numsamples)
+__attribute__((nonnull));
+
+/** Load a module like xm_create_context(), with sample data decoded by the
+ * threads of the batch (one instrument per job). Headers and patterns are
+ * still loaded by the calling thread, so this is only worth it for modules
+ * with a lot of sample data.
+ *
+ * Same parameters as xm_create_context(), and the loaded context generates
+ * exactly the same samples.
+ *
+ * @note Must not be called concurrently on the same batch.
+ */
+xm_context_t* xm_batch_create_context(xm_batch_t*, char* pool,
+                                      const xm_prescan_data_t* p,
+                                      const char* moddata,
+                                      uint32_t moddata_length, uint32_t rate)
+__attribute__((warn_unused_result))
+__attribute__((nonnull));
+
+/** Create a render-ahead player. A background thread generates samples
+ * from the context into a ring buffer, and an audio callback only has to
+ * copy them out with xm_player_read(), which never blocks, locks or
+ * allocates.
+ *
+ * The generated samples are exactly the same as with xm_generate_samples().
+ *
+ * @param ctx context to play, it must not be used by anything else until
+ * the player is freed
+ * @param ring_length size of the ring buffer, in frames (rounded up to a
+ * power of 2). This is the latency added by the player, and how long the
+ * background thread can be late before the audio callback runs dry.
+ *
+ * @returns NULL on error (invalid ring length, out of memory, or the thread
+ * could not be created)
+ */
+xm_player_t* xm_create_player(xm_context_t* ctx, uint32_t ring_length)
+__attribute__((warn_unused_result))
+__attribute__((nonnull));
+
+/** Stop the thread of a player, and free it. The context is left as is. */
+void xm_free_player(xm_player_t*)
+__attribute__((nonnull));
+
+/** Copy generated samples out of the ring buffer. If not enough samples
+ * were generated yet, the rest of the output is filled with silence, and
+ * the missing samples will be returned by the next call.
+ *
+ * @param output[.2*numsamples] buffer of 2*numsamples elements (interleaved
+ * L and R)
+ *
+ * @returns the number of frames copied from the ring buffer
+ *
+ * @note Must only be called from one thread at a time, the same as the
+ * xm_player_*() commands below.
+ */
+uint32_t xm_player_read(xm_player_t*, float* output, uint32_t numsamples)
+__attribute__((nonnull));
+
+/** Same as xm_player_read(), with left and right channels in separate
+ * buffers of numsamples elements each. */
+uint32_t xm_player_read_noninterleaved(xm_player_t*, float* output_left,
+                                       float* output_right,
+                                       uint32_t numsamples)
+__attribute__((nonnull));
+
+/* Commands below are queued for the background thread, that applies them
+ * at the next tick boundary. Samples already in the ring buffer are not
+ * affected, except by xm_player_seek(). They all return false (and do
+ * nothing) if too many commands are waiting in the queue. */
+
+/** Queue xm_mute_channel(). */
+bool xm_player_mute_channel(xm_player_t*, uint8_t channel, bool mute)
+__attribute__((nonnull));
+
+/** Queue xm_mute_instrument(). */
+bool xm_player_mute_instrument(xm_player_t*, uint8_t instr, bool mute)
+__attribute__((nonnull));
+
+/** Queue xm_seek(). Samples generated before the seek that were not read
+ * yet are dropped. */
+bool xm_player_seek(xm_player_t*, uint8_t pot, uint8_t row, uint8_t tick)
+__attribute__((nonnull));
+
+/** Set the output gain of generated samples (1 by default). */
+bool xm_player_set_volume(xm_player_t*, float volume)
+__attribute__((nonnull));
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -7,13 +7,32 @@
  * http://sam.zoy.org/wtfpl/COPYING for more details. */
 
 #include <xm.h>
+#include <xm_mt.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 static void print_position(const xm_context_t*);
+static void disable_ramping(xm_context_t*);
 static uint16_t modal_interpeak_distance(const float*, uint16_t, uint16_t);
 
+/* Creates a copy of a context in a new libxm buffer, stored in *buf for the
+   caller to free. */
+static xm_context_t* copy_context(xm_context_t*, uint32_t rate, char** buf);
+
+/* Plays a context until it loops, with a varying number of samples per call,
+   and passes every call's samples to check(user, frames, n). Reports the
+   first call where check() returns false as a mismatch in what. */
+#define CALL_FRAMES 1000
+static int play_eq(xm_context_t*, bool (*check)(void*, const float*, uint16_t),
+                   void* user, const char* what);
+
+/* Checks that the context passed as user generates the same samples. */
+static bool check_context(void* user, const float*, uint16_t);
+
+/* Checks generated audio samples for ctx==other. */
+static int contexts_eq(xm_context_t* ctx, xm_context_t* other, const char*);
+
 /* Checks generated audio samples for channel1==channel2, channel3==channel4,
    etc. If swap_lr is true, swaps LR channels of each odd channel before
    comparing. */
@@ -26,8 +45,116 @@ static int channelpairs_pitcheq(xm_context_t*);
 /* Checks generated audio samples for pattern0==pattern1. */
 static int pat0_pat1_eq(xm_context_t*);
 
+/* Checks that copies of a context played with xm_batch_generate_samples()
+   and xm_batch_generate_samples_channels() generate the same samples as the
+   original context, and agree on xm_is_silent(). */
+static int batch_eq(xm_context_t*);
+
+/* Checks that a context loaded with xm_batch_create_context() generates the
+   same samples as the original context. */
+static int batch_load_eq(xm_context_t*, const char*, uint32_t);
+
+/* Checks that a context loaded with xm_create_context_from_callback(), from a
+   callback returning short reads, is identical to the original context. */
+static int callback_eq(xm_context_t*, const char*, uint32_t);
+
+/* Checks that the row events written during playback match the rows of
+   xm_analyze_timeline(), and that note on events match
+   xm_get_latest_trigger_of_channel(). */
+static int events_eq(xm_context_t*);
+
+/* Checks that cubic and sinc interpolation generate samples close to (but
+   not the same as) the default interpolation, whatever the number of samples
+   generated per call, and that switching back to the default interpolation
+   generates the same samples as the original context. */
+static int interpolation_eq(xm_context_t*);
+
+/* Checks that a context created with xm_create_context_lazy() decodes all its
+   samples in a few calls to xm_decode_samples(), then generates the same
+   samples as the original context. */
+static int lazy_eq(xm_context_t*, const char*, uint32_t);
+
+/* Checks that a copy of a context played with a render-ahead player generates
+   the same samples as the original context, read with xm_player_read() and
+   xm_player_read_noninterleaved(). */
+static int player_eq(xm_context_t*);
+
+/* Checks that for each combination of quality features, a copy of a context
+   generates the same samples with xm_generate_samples_s16() as with
+   xm_generate_samples() (within rounding errors), and different samples than
+   the original context unless all its features are kept. */
+static int quality_eq(xm_context_t*);
+
+/* Checks that xm_generate_samples_s16() generates the same samples as
+   xm_generate_samples(), within rounding errors of the fixed point mixer. */
+static int s16_eq(xm_context_t*);
+
+/* Checks that a copy of a context created at another sample rate, then
+   switched to the same rate with xm_set_sample_rate(), generates the same
+   samples as the original context (even when switching back and forth while
+   playing), that pitches don't depend on the rate, and that playing at twice
+   the rate takes twice as many samples. */
+static int sample_rate_eq(xm_context_t*);
+
+/* Checks that a context created from mappable libxm data generates the same
+   samples as the original context, and never writes to that data. */
+static int mappable_eq(xm_context_t*);
+
+/* Checks that after xm_seek_exact(), a copy of a context generates the same
+   samples as the original context played from the start. If mute is true,
+   the first channel of both is muted after building the seek index, and must
+   stay muted. */
+static int seek_eq(xm_context_t*, bool mute);
+
+/* Same as seek_eq(), with contexts loaded by xm_prescan_module_streaming().
+   Their samples are only provided (from the original context) during the
+   chunks checked after seeking, and are skipped silently everywhere else. */
+static int seek_streaming_eq(xm_context_t*, const char*, uint32_t);
+
+/* Checks that contexts created with xm_create_shared_context() generate the
+   same samples as the original context, even when played out of step. */
+static int shared_eq(xm_context_t*);
+
+/* Checks that a state saved by xm_save_state() and restored in a copy of
+   the context generates the same samples as the original context, and
+   likewise between two shared contexts of the same context, and that
+   restoring a state keeps xm_set_max_loop_count(). */
+static int state_eq(xm_context_t*);
+
+/* Checks that xm_generate_stems() (run on copies of the context) generates
+   the same samples as xm_generate_samples() when all the channels are in one
+   stem, that channels outside of any stem are played but not rendered, and
+   that one stem per channel matches xm_generate_samples_unmixed(). */
+static int stems_eq(xm_context_t*);
+
+/* Checks that a context loaded with xm_prescan_module_streaming(), with all
+   its samples streamed from the original context, generates the same
+   samples as the original context, with every resampler and mixer. */
+static int streaming_eq(xm_context_t*, const char*, uint32_t);
+
+/* Checks that xm_analyze_timeline() (run on a copy of the context) agrees
+   with actual playback, both for the length and the position of each row. */
+static int timeline_eq(xm_context_t*);
+
 static int channelpairs_pitcheq(xm_context_t*);
 
+/* Body of seek_eq() and seek_streaming_eq(), copy is a fresh copy of ctx. If
+   probe is not NULL, it is a copy of ctx with a provider reading from
+   source, and copy reads from source through window when it is heard. */
+static int seek_copy_eq(xm_context_t* ctx, xm_context_t* copy, bool mute,
+                        xm_context_t* probe, xm_context_t* source,
+                        char* window);
+
+/* Checks one mode of interpolation_eq() */
+static int interpolation_mode_eq(xm_context_t*, xm_interpolation_t);
+
+/* Bodies of timeline_eq() and events_eq(), with the rows of
+   xm_analyze_timeline() */
+static int play_timeline(xm_context_t*, const xm_timeline_row_t*, uint32_t,
+                         uint32_t);
+static int play_events(xm_context_t*, const xm_timeline_row_t*, uint32_t,
+                       uint32_t);
+
 
 int main(int argc, char** argv) {
 	if(argc != 3) {
@@ -65,6 +192,20 @@ int main(int argc, char** argv) {
 	if(ctx_buffer == NULL) return 1;
 	xm_context_t* ctx = xm_create_context(ctx_buffer, p, xm_file_data,
 	                                      (uint32_t)xm_file_length, 48000);
+	if(strcmp(argv[1], "batch_load_eq") == 0) {
+		return batch_load_eq(ctx, xm_file_data,
+		                     (uint32_t)xm_file_length);
+	} else if(strcmp(argv[1], "callback_eq") == 0) {
+		return callback_eq(ctx, xm_file_data, (uint32_t)xm_file_length);
+	} else if(strcmp(argv[1], "lazy_eq") == 0) {
+		return lazy_eq(ctx, xm_file_data, (uint32_t)xm_file_length);
+	} else if(strcmp(argv[1], "seek_streaming_eq") == 0) {
+		return seek_streaming_eq(ctx, xm_file_data,
+		                         (uint32_t)xm_file_length);
+	} else if(strcmp(argv[1], "streaming_eq") == 0) {
+		return streaming_eq(ctx, xm_file_data,
+		                    (uint32_t)xm_file_length);
+	}
 	free(xm_file_data);
 
 	/* Perform the test */
@@ -76,6 +217,34 @@ int main(int argc, char** argv) {
 		return channelpairs_pitcheq(ctx);
 	} else if(strcmp(argv[1], "pat0_pat1_eq") == 0) {
 		return pat0_pat1_eq(ctx);
+	} else if(strcmp(argv[1], "batch_eq") == 0) {
+		return batch_eq(ctx);
+	} else if(strcmp(argv[1], "player_eq") == 0) {
+		return player_eq(ctx);
+	} else if(strcmp(argv[1], "events_eq") == 0) {
+		return events_eq(ctx);
+	} else if(strcmp(argv[1], "interpolation_eq") == 0) {
+		return interpolation_eq(ctx);
+	} else if(strcmp(argv[1], "quality_eq") == 0) {
+		return quality_eq(ctx);
+	} else if(strcmp(argv[1], "s16_eq") == 0) {
+		return s16_eq(ctx);
+	} else if(strcmp(argv[1], "sample_rate_eq") == 0) {
+		return sample_rate_eq(ctx);
+	} else if(strcmp(argv[1], "mappable_eq") == 0) {
+		return mappable_eq(ctx);
+	} else if(strcmp(argv[1], "seek_eq") == 0) {
+		return seek_eq(ctx, false);
+	} else if(strcmp(argv[1], "seek_muted_eq") == 0) {
+		return seek_eq(ctx, true);
+	} else if(strcmp(argv[1], "shared_eq") == 0) {
+		return shared_eq(ctx);
+	} else if(strcmp(argv[1], "state_eq") == 0) {
+		return state_eq(ctx);
+	} else if(strcmp(argv[1], "stems_eq") == 0) {
+		return stems_eq(ctx);
+	} else if(strcmp(argv[1], "timeline_eq") == 0) {
+		return timeline_eq(ctx);
 	}
 
 	fprintf(stderr, "Invalid 1st argument\n");
@@ -91,7 +260,16 @@ static void print_position(const xm_context_t* ctx) {
 	        pot, pat, row);
 }
 
+/* Channel pairs and pattern pairs of the module tests only play the same
+   without ramping: volume ramps and fade outs depend on how notes were
+   triggered */
+static void disable_ramping(xm_context_t* ctx) {
+	xm_set_quality(ctx, xm_get_quality(ctx)
+	               & XM_QUALITY_LINEAR_INTERPOLATION);
+}
+
 static int channelpairs_eq(xm_context_t* ctx, bool swap_lr) {
+	disable_ramping(ctx);
 	float frames[256];
 	uint16_t chans = xm_get_number_of_channels(ctx);
 	/* Make sure our buffer can at least fit one frame of unmixed data */
@@ -117,6 +295,7 @@ static int channelpairs_eq(xm_context_t* ctx, bool swap_lr) {
 }
 
 static int channelpairs_pitcheq(xm_context_t* ctx) {
+	disable_ramping(ctx);
 	if(xm_get_number_of_channels(ctx) != 2) return 1;
 	uint8_t bpm;
 	xm_get_playing_speed(ctx, &bpm, nullptr);
@@ -148,12 +327,12 @@ static int pat0_pat1_eq(xm_context_t* ctx0) {
 		return 1;
 	}
 
-	/* Copy the context */
-	char* buf = malloc(xm_context_size(ctx0));
-	if(buf == NULL) return 1;
-	xm_context_to_libxm(ctx0, buf);
-	xm_context_t* ctx1 = xm_create_context_from_libxm(buf, 48000);
+	char* buf;
+	xm_context_t* ctx1 = copy_context(ctx0, 48000, &buf);
+	if(ctx1 == NULL) return 1;
 	xm_seek(ctx1, 1, 0, 0);
+	disable_ramping(ctx0);
+	disable_ramping(ctx1);
 
 	float frames0[128], frames1[128];
 	uint8_t idx;
@@ -169,13 +348,1048 @@ static int pat0_pat1_eq(xm_context_t* ctx0) {
 			        (double)frames0[i], (double)frames1[i]);
 			print_position(ctx0);
 			print_position(ctx1);
+			free(buf);
+			return 1;
+		}
+	}
+
+	free(buf);
+	return 0;
+}
+
+static xm_context_t* copy_context(xm_context_t* ctx, uint32_t rate,
+                                  char** buf) {
+	*buf = malloc(xm_context_size(ctx));
+	if(*buf == NULL) return NULL;
+	xm_context_to_libxm(ctx, *buf);
+	return xm_create_context_from_libxm(*buf, rate);
+}
+
+static int play_eq(xm_context_t* ctx,
+                   bool (*check)(void*, const float*, uint16_t), void* user,
+                   const char* what) {
+	float frames[2 * CALL_FRAMES];
+	/* Use a different number of samples every time, to make sure
+	   contexts are advanced by the right amount */
+	for(uint16_t n = 1; !xm_get_loop_count(ctx);
+	    n = (uint16_t)((n + 77) % CALL_FRAMES + 1)) {
+		xm_generate_samples(ctx, frames, n);
+		if(check(user, frames, n)) continue;
+		fprintf(stderr, "Mismatch in %s\n", what);
+		print_position(ctx);
+		return 1;
+	}
+	return 0;
+}
+
+static bool check_context(void* user, const float* frames, uint16_t n) {
+	float other[2 * CALL_FRAMES];
+	xm_generate_samples(user, other, n);
+	return memcmp(frames, other, sizeof(float) * 2 * n) == 0;
+}
+
+static int contexts_eq(xm_context_t* ctx, xm_context_t* other,
+                       const char* what) {
+	return play_eq(ctx, check_context, other, what);
+}
+
+static bool s16_near(const float* frames, const int16_t* frames_s16,
+                     uint16_t n, int tolerance) {
+	for(uint16_t i = 0; i < 2 * n; ++i) {
+		float f = frames[i] * 32768.f;
+		if(f > INT16_MAX) f = INT16_MAX;
+		if(f < INT16_MIN) f = INT16_MIN;
+		if(f - (float)frames_s16[i] <= (float)tolerance
+		   && (float)frames_s16[i] - f <= (float)tolerance) {
+			continue;
+		}
+		fprintf(stderr, "%f vs %d\n", (double)f, frames_s16[i]);
+		return false;
+	}
+	return true;
+}
+
+#define BATCH_CONTEXTS 7
+struct batch_check_s {
+	xm_context_t* ctx;
+	xm_batch_t* batch;
+	xm_context_t* copies[BATCH_CONTEXTS + 1];
+	float* outputs[BATCH_CONTEXTS + 1];
+};
+
+static bool check_batch(void* user, const float* frames, uint16_t n) {
+	struct batch_check_s* b = user;
+	xm_batch_generate_samples(b->batch, b->copies, b->outputs,
+	                          BATCH_CONTEXTS, n);
+	xm_batch_generate_samples_channels(b->batch, b->copies[BATCH_CONTEXTS],
+	                                   b->outputs[BATCH_CONTEXTS], n);
+	for(uint8_t i = 0; i < BATCH_CONTEXTS + 1; ++i) {
+		if(memcmp(frames, b->outputs[i], sizeof(float) * 2 * n) == 0
+		   && xm_is_silent(b->copies[i]) == xm_is_silent(b->ctx)) {
+			continue;
+		}
+		fprintf(stderr, "Context %u differs\n", i);
+		return false;
+	}
+	return true;
+}
+
+static int batch_eq(xm_context_t* ctx) {
+	struct batch_check_s b = { .ctx = ctx };
+	char* bufs[BATCH_CONTEXTS + 1];
+	for(uint8_t i = 0; i < BATCH_CONTEXTS + 1; ++i) {
+		b.copies[i] = copy_context(ctx, 48000, bufs + i);
+		b.outputs[i] = malloc(sizeof(float) * 2 * CALL_FRAMES);
+		if(b.copies[i] == NULL || b.outputs[i] == NULL) return 1;
+	}
+	b.batch = xm_create_batch(3);
+	if(b.batch == NULL) return 1;
+
+	int ret = play_eq(ctx, check_batch, &b, "batch");
+
+	xm_free_batch(b.batch);
+	for(uint8_t i = 0; i < BATCH_CONTEXTS + 1; ++i) {
+		free(b.outputs[i]);
+		free(bufs[i]);
+	}
+	return ret;
+}
+
+struct player_check_s {
+	xm_player_t* player;
+	bool interleaved;
+	char __pad[7];
+};
+
+static bool check_player(void* user, const float* frames, uint16_t n) {
+	struct player_check_s* p = user;
+	float read[2 * CALL_FRAMES];
+	float left[CALL_FRAMES], right[CALL_FRAMES];
+
+	/* Wait for the player thread, short reads are expected */
+	for(uint32_t got = 0; got < n; ) {
+		if(p->interleaved) {
+			got += xm_player_read(p->player, read + 2 * got,
+			                      n - got);
+		} else {
+			got += xm_player_read_noninterleaved(
+				p->player, left + got, right + got, n - got);
+		}
+	}
+	if(!p->interleaved) {
+		for(uint16_t i = 0; i < n; ++i) {
+			read[2 * i] = left[i];
+			read[2 * i + 1] = right[i];
+		}
+	}
+	p->interleaved = !p->interleaved;
+	return memcmp(frames, read, sizeof(float) * 2 * n) == 0;
+}
+
+static int player_eq(xm_context_t* ctx) {
+	char* buf;
+	xm_context_t* copy = copy_context(ctx, 48000, &buf);
+	if(copy == NULL) return 1;
+	struct player_check_s p = {
+		.player = xm_create_player(copy, 1500),
+		.interleaved = true,
+	};
+	if(p.player == NULL) return 1;
+
+	int ret = play_eq(ctx, check_player, &p, "samples read from player");
+
+	xm_free_player(p.player);
+	free(buf);
+	return ret;
+}
+
+struct s16_check_s {
+	xm_context_t* copy;
+	int tolerance;
+	char __pad[4];
+};
+
+static bool check_s16(void* user, const float* frames, uint16_t n) {
+	struct s16_check_s* s = user;
+	int16_t frames_s16[2 * CALL_FRAMES];
+	xm_generate_samples_s16(s->copy, frames_s16, n);
+	return s16_near(frames, frames_s16, n, s->tolerance);
+}
+
+static int s16_eq(xm_context_t* ctx) {
+	char* buf;
+	struct s16_check_s s = {
+		.copy = copy_context(ctx, 48000, &buf),
+		/* One rounding error per channel and per multiplication */
+		.tolerance = 2 * xm_get_number_of_channels(ctx) + 2,
+	};
+	if(s.copy == NULL) return 1;
+
+	int ret = play_eq(ctx, check_s16, &s, "s16 samples");
+
+	free(buf);
+	return ret;
+}
+
+struct quality_check_s {
+	xm_context_t* copy;
+	xm_context_t* copy_s16;
+	int tolerance;
+	bool same; /* So far, between copy and the reference */
+	char __pad[3];
+};
+
+static bool check_quality(void* user, const float* frames_ref, uint16_t n) {
+	struct quality_check_s* q = user;
+	float frames[2 * CALL_FRAMES];
+	int16_t frames_s16[2 * CALL_FRAMES];
+	xm_generate_samples(q->copy, frames, n);
+	xm_generate_samples_s16(q->copy_s16, frames_s16, n);
+	if(memcmp(frames, frames_ref, sizeof(float) * 2 * n)) q->same = false;
+	return s16_near(frames, frames_s16, n, q->tolerance);
+}
+
+static int quality_eq(xm_context_t* ctx) {
+	const uint8_t all = xm_get_quality(ctx);
+	int ret = 0;
+	for(uint8_t q = 0; ret == 0 && q <= (XM_QUALITY_RAMPING
+	                                     | XM_QUALITY_LINEAR_INTERPOLATION);
+	    ++q) {
+		char *buf, *buf_s16, *buf_ref;
+		struct quality_check_s c = {
+			.copy = copy_context(ctx, 48000, &buf),
+			.copy_s16 = copy_context(ctx, 48000, &buf_s16),
+			.tolerance = 2 * xm_get_number_of_channels(ctx) + 2,
+			.same = true,
+		};
+		xm_context_t* ref = copy_context(ctx, 48000, &buf_ref);
+		if(c.copy == NULL || c.copy_s16 == NULL || ref == NULL) {
+			return 1;
+		}
+		xm_set_quality(c.copy, q);
+		xm_set_quality(c.copy_s16, q);
+
+		char what[32];
+		snprintf(what, sizeof(what), "s16 samples at quality %u", q);
+		if(xm_get_quality(c.copy) != (q & all)) {
+			fprintf(stderr, "Quality %u not masked by %u\n", q, all);
+			ret = 1;
+		} else if(play_eq(ref, check_quality, &c, what)) {
+			ret = 1;
+		} else if(c.same != (xm_get_quality(c.copy) == all)) {
+			fprintf(stderr, "Quality %u: expected %s samples\n", q,
+			        c.same ? "different" : "the same");
+			ret = 1;
+		}
+
+		free(buf_ref);
+		free(buf_s16);
+		free(buf);
+	}
+	return ret;
+}
+
+/* @returns the number of samples rendered until the module loops */
+static uint32_t render_length(xm_context_t* ctx) {
+	static float frames[2 * 4096];
+	uint32_t length = 0, n;
+	xm_set_max_loop_count(ctx, 1);
+	while((n = xm_render(ctx, frames, 4096)) == 4096) length += n;
+	return length + n;
+}
+
+static bool check_sample_rate(void* user, const float* frames, uint16_t n) {
+	xm_context_t* copy = user;
+	if(n % 2) {
+		/* Pitches must not change with the rate */
+		float freqs[256];
+		for(uint8_t ch = 1; ch <= xm_get_number_of_channels(copy);
+		    ++ch) {
+			freqs[ch] = xm_get_frequency_of_channel(copy, ch);
+		}
+		xm_set_sample_rate(copy, 96000);
+		for(uint8_t ch = 1; ch <= xm_get_number_of_channels(copy);
+		    ++ch) {
+			float f = xm_get_frequency_of_channel(copy, ch);
+			if(f > freqs[ch] * 1.01f || f < freqs[ch] * .99f) {
+				fprintf(stderr, "Channel %u played at %f Hz "
+				        "instead of %f Hz\n", ch, (double)f,
+				        (double)freqs[ch]);
+				return false;
+			}
+		}
+		xm_set_sample_rate(copy, 48000);
+	}
+	return check_context(copy, frames, n);
+}
+
+static int sample_rate_eq(xm_context_t* ctx) {
+	char *buf, *buf_slow, *buf_fast;
+	xm_context_t* copy = copy_context(ctx, 44100, &buf);
+	xm_context_t* slow = copy_context(ctx, 48000, &buf_slow);
+	xm_context_t* fast = copy_context(ctx, 48000, &buf_fast);
+	if(copy == NULL || slow == NULL || fast == NULL) return 1;
+	xm_set_sample_rate(copy, 48000);
+	xm_set_sample_rate(fast, 96000);
+
+	int ret = play_eq(ctx, check_sample_rate, copy,
+	                  "context after changing sample rate");
+
+	/* Tick lengths are rounded to 1/8192 frame at each rate */
+	uint32_t slow_length = render_length(slow);
+	uint32_t fast_length = render_length(fast);
+	if(ret == 0 && (fast_length + 4 < 2 * slow_length
+	                || fast_length > 2 * slow_length + 4)) {
+		fprintf(stderr, "Played %u samples at 96000 Hz, %u at "
+		        "48000 Hz\n", fast_length, slow_length);
+		ret = 1;
+	}
+
+	free(buf_fast);
+	free(buf_slow);
+	free(buf);
+	return ret;
+}
+
+static int batch_load_eq(xm_context_t* ctx, const char* data,
+                         uint32_t length) {
+	xm_batch_t* batch = xm_create_batch(4);
+	xm_prescan_data_t* p = alloca(XM_PRESCAN_DATA_SIZE);
+	if(batch == NULL || !xm_prescan_module(data, length, p)) return 1;
+	char* pool = malloc(xm_size_for_context(p));
+	if(pool == NULL) return 1;
+	xm_context_t* loaded = xm_batch_create_context(batch, pool, p, data,
+	                                               length, 48000);
+	xm_free_batch(batch);
+
+	int ret = contexts_eq(ctx, loaded, "context loaded by batch");
+	free(pool);
+	return ret;
+}
+
+/* Never reads more than 13 bytes at once, to exercise refills */
+static uint32_t read_short(void* user, char* out, uint32_t offset,
+                           uint32_t length) {
+	if(length > 13) length = 13;
+	memcpy(out, (const char*)user + offset, length);
+	return length;
+}
+
+static int callback_eq(xm_context_t* ctx, const char* data, uint32_t length) {
+	xm_prescan_data_t* p = alloca(XM_PRESCAN_DATA_SIZE);
+	if(!xm_prescan_module_from_callback(read_short, (void*)data, length,
+	                                    p)) {
+		fprintf(stderr, "Prescan from callback failed\n");
+		return 1;
+	}
+	uint32_t size = xm_context_size(ctx);
+	if(xm_size_for_context(p) != size) {
+		fprintf(stderr, "Context size mismatch: %u vs %u\n",
+		        xm_size_for_context(p), size);
+		return 1;
+	}
+	char* pool = malloc(size);
+	char* libxm = malloc(size);
+	char* libxm_cb = malloc(size);
+	if(pool == NULL || libxm == NULL || libxm_cb == NULL) return 1;
+	xm_context_t* ctx_cb = xm_create_context_from_callback(pool, p,
+	                                                       read_short,
+	                                                       (void*)data,
+	                                                       length, 48000);
+
+	/* Both contexts are fresh, so their libxm data is only module data */
+	xm_context_to_libxm(ctx, libxm);
+	xm_context_to_libxm(ctx_cb, libxm_cb);
+	if(memcmp(libxm, libxm_cb, size)) {
+		fprintf(stderr, "Mismatch in context loaded from callback\n");
+		return 1;
+	}
+	return 0;
+}
+
+static int lazy_eq(xm_context_t* ctx, const char* data, uint32_t length) {
+	xm_prescan_data_t* p = alloca(XM_PRESCAN_DATA_SIZE);
+	if(!xm_prescan_module(data, length, p)) return 1;
+	char* pool = malloc(xm_size_for_context(p));
+	if(pool == NULL) return 1;
+	xm_context_t* lazy = xm_create_context_lazy(pool, p, data, length,
+	                                            48000);
+
+	/* One instrument at a time */
+	uint16_t left = UINT16_MAX;
+	for(uint16_t n; (n = xm_decode_samples(lazy, data, length, 1)); ) {
+		if(n >= left) {
+			fprintf(stderr, "xm_decode_samples() made no progress "
+			        "(%u samples left)\n", n);
+			free(pool);
+			return 1;
+		}
+		left = n;
+	}
+
+	int ret = contexts_eq(ctx, lazy, "lazily loaded context");
+	free(pool);
+	return ret;
+}
+
+static int mappable_eq(xm_context_t* ctx) {
+	uint32_t size = xm_context_size(ctx);
+	char* data = malloc(size);
+	char* orig = malloc(size);
+	char* pool = malloc(xm_size_for_shared_context(ctx));
+	if(data == NULL || orig == NULL || pool == NULL) return 1;
+	xm_context_to_mappable_libxm(ctx, data);
+	memcpy(orig, data, size);
+	xm_context_t* mapped = xm_create_context_from_mappable_libxm(pool, data,
+	                                                             48000);
+
+	int ret = contexts_eq(ctx, mapped, "mapped context");
+	if(ret == 0 && memcmp(data, orig, size)) {
+		fprintf(stderr, "Mappable data was modified\n");
+		ret = 1;
+	}
+
+	free(pool);
+	free(orig);
+	free(data);
+	return ret;
+}
+
+/* Reads frames from the context passed as user, which has them all */
+static void provide_from_context(void* user, uint8_t instrument,
+                                 uint8_t sample, uint32_t frame,
+                                 uint32_t count, xm_sample_point_t* out) {
+	uint32_t length;
+	const xm_sample_point_t* data = xm_get_sample_waveform(user, instrument,
+	                                                       sample, &length);
+	if(data == NULL || frame + count > length) {
+		fprintf(stderr, "Invalid read of sample %u of instrument %u "
+		        "(%u+%u, length %u)\n", sample, instrument, frame,
+		        count, length);
+		exit(1);
+	}
+	memcpy(out, data + frame, sizeof(xm_sample_point_t) * count);
+}
+
+static int seek_eq(xm_context_t* ctx, bool mute) {
+	char* buf;
+	xm_context_t* copy = copy_context(ctx, 48000, &buf);
+	if(copy == NULL) return 1;
+	int ret = seek_copy_eq(ctx, copy, mute, NULL, NULL, NULL);
+	free(buf);
+	return ret;
+}
+
+static int seek_streaming_eq(xm_context_t* ctx, const char* data,
+                             uint32_t length) {
+	xm_prescan_data_t* p = alloca(XM_PRESCAN_DATA_SIZE);
+	if(!xm_prescan_module_streaming(read_short, (void*)data, length, 1,
+	                                p)) {
+		return 1;
+	}
+	char* pools[3];
+	xm_context_t* contexts[3];
+	for(uint8_t i = 0; i < 3; ++i) {
+		pools[i] = malloc(xm_size_for_context(p));
+		if(pools[i] == NULL) return 1;
+		contexts[i] = xm_create_context_from_callback(pools[i], p,
+		                                              read_short,
+		                                              (void*)data,
+		                                              length, 48000);
+	}
+	char* windows[2] = {
+		malloc(xm_size_for_sample_provider(contexts[0])),
+		malloc(xm_size_for_sample_provider(contexts[0])),
+	};
+	if(windows[0] == NULL || windows[1] == NULL) return 1;
+	xm_set_sample_provider(contexts[2], provide_from_context, ctx,
+	                       windows[1]);
+
+	int ret = seek_copy_eq(contexts[0], contexts[1], false, contexts[2],
+	                       ctx, windows[0]);
+
+	free(windows[1]);
+	free(windows[0]);
+	for(uint8_t i = 0; i < 3; ++i) free(pools[i]);
+	return ret;
+}
+
+static int seek_copy_eq(xm_context_t* ctx, xm_context_t* copy, bool mute,
+                        xm_context_t* probe, xm_context_t* source,
+                        char* window) {
+	/* Only room for a few snapshots, to also test dropping them */
+	uint32_t index_size = xm_size_for_seek_index(copy, 5);
+	char* index_buf = malloc(index_size);
+	char* state = malloc(xm_size_for_state(ctx));
+	if(index_buf == NULL || state == NULL) return 1;
+	xm_seek_index_t* index = xm_build_seek_index(copy, index_buf,
+	                                             index_size, 1);
+	if(index == NULL) return 1;
+	uint32_t length = xm_get_seek_index_length(index);
+	if(mute) {
+		xm_mute_channel(ctx, 1, true);
+		xm_mute_channel(copy, 1, true);
+	}
+
+	float frames[2 * CALL_FRAMES];
+	uint32_t position = 0;
+	bool seek = true;
+	int ret = 0;
+	for(uint16_t n = 1; ret == 0 && position < length;
+	    n = (uint16_t)((n + 77) % CALL_FRAMES + 1), seek = !seek) {
+		if(!seek) {
+			xm_generate_samples(ctx, frames, n);
+			position += n;
+			continue;
+		}
+
+		/* Seek to the middle of every other chunk. Without a
+		   probe, listen to ctx itself. With one, ctx never has a
+		   provider, like the index, and streamed samples are only
+		   heard from a restored snapshot of it. */
+		xm_seek_exact(copy, index, position);
+		xm_context_t* heard = ctx;
+		if(probe != NULL) {
+			xm_save_state(ctx, state);
+			xm_restore_state(probe, state);
+			xm_set_sample_provider(copy, provide_from_context,
+			                       source, window);
+			xm_generate_samples(ctx, frames, n);
+			heard = probe;
+		}
+		xm_generate_samples(heard, frames, n);
+		if(!check_context(copy, frames, n)) {
+			fprintf(stderr, "Mismatch after seeking to %u\n",
+			        position);
+			print_position(ctx);
+			ret = 1;
+		}
+		if(probe != NULL) {
+			xm_set_sample_provider(copy, NULL, NULL, NULL);
+		}
+		position += n;
+	}
+
+	/* The next sample should start the second pass */
+	xm_generate_samples(ctx, frames, 1);
+	if(ret == 0 && !xm_get_loop_count(ctx)) {
+		fprintf(stderr, "Module did not loop after %u samples\n",
+		        length);
+		ret = 1;
+	}
+
+	free(state);
+	free(index_buf);
+	return ret;
+}
+
+static int shared_eq(xm_context_t* ctx) {
+	char* pool0 = malloc(xm_size_for_shared_context(ctx));
+	char* pool1 = malloc(xm_size_for_shared_context(ctx));
+	if(pool0 == NULL || pool1 == NULL) return 1;
+	xm_context_t* shared0 = xm_create_shared_context(pool0, ctx, 48000);
+
+	/* Create the second one later, it must still start from the
+	   beginning */
+	float frames[2 * 1000];
+	xm_generate_samples(shared0, frames, 1000);
+	xm_context_t* shared1 = xm_create_shared_context(pool1, ctx, 48000);
+
+	int ret = contexts_eq(ctx, shared1, "shared context");
+	free(pool1);
+	free(pool0);
+	return ret;
+}
+
+struct state_check_s {
+	xm_context_t* ctx;
+	xm_context_t* copy;
+	char* state;
+	bool saved; /* Right before the current call */
+	char __pad[7];
+};
+
+static bool check_state(void* user, const float* frames, uint16_t n) {
+	struct state_check_s* s = user;
+	bool ok = true;
+	if(s->saved) {
+		/* Restore after playing the copy for a while, to make sure
+		   everything is reset */
+		float junk[2 * CALL_FRAMES];
+		xm_generate_samples(s->copy, junk, n);
+		xm_restore_state(s->copy, s->state);
+		ok = check_context(s->copy, frames, n);
+	}
+
+	/* Save before every other call */
+	s->saved = !s->saved;
+	if(s->saved) xm_save_state(s->ctx, s->state);
+	return ok;
+}
+
+static int state_eq(xm_context_t* ctx) {
+	char* buf;
+	char* state = malloc(xm_size_for_state(ctx));
+	char* pool0 = malloc(xm_size_for_shared_context(ctx));
+	char* pool1 = malloc(xm_size_for_shared_context(ctx));
+	xm_context_t* copy = copy_context(ctx, 48000, &buf);
+	if(state == NULL || pool0 == NULL || pool1 == NULL || copy == NULL) {
+		return 1;
+	}
+
+	/* Shared contexts point into the module data of ctx, not their own */
+	struct state_check_s s = {
+		.ctx = xm_create_shared_context(pool0, ctx, 48000),
+		.copy = xm_create_shared_context(pool1, ctx, 48000),
+		.state = state,
+	};
+	float frames[2 * 1000];
+	xm_generate_samples(s.ctx, frames, 1000);
+	xm_generate_samples(s.ctx, frames, 777);
+	int ret = play_eq(s.ctx, check_state, &s,
+	                  "shared context after restoring state");
+
+	if(ret == 0) {
+		s = (struct state_check_s){
+			.ctx = ctx, .copy = copy, .state = state,
+		};
+		ret = play_eq(ctx, check_state, &s,
+		              "context after restoring state");
+	}
+
+	/* The loop limit is a setting, restoring a state of ctx (which just
+	   looped once) must not undo it */
+	xm_set_max_loop_count(copy, 1);
+	xm_save_state(ctx, state);
+	xm_restore_state(copy, state);
+	if(ret == 0 && xm_render(copy, frames, 1)) {
+		fprintf(stderr, "Restoring a state reset the loop limit\n");
+		ret = 1;
+	}
+
+	free(buf);
+	free(pool1);
+	free(pool0);
+	free(state);
+	return ret;
+}
+
+struct stems_check_s {
+	xm_context_t* ctx;
+	xm_context_t* copies[3];
+	float* stem_data;
+	float* unmixed;
+	float* stems[256];
+	uint8_t groups[256];
+	bool mixed[256];
+};
+
+static bool check_stems(void* user, const float* frames, uint16_t n) {
+	struct stems_check_s* s = user;
+	uint8_t chans = xm_get_number_of_channels(s->ctx);
+	xm_generate_stems(s->copies[0], s->groups, 1, s->stems, s->mixed, n);
+	if(s->mixed[0]
+	   ? memcmp(frames, s->stems[0], sizeof(float) * 2 * n)
+	   : !xm_is_silent(s->ctx)) {
+		fprintf(stderr, "Single stem differs\n");
+		return false;
+	}
+
+	/* Untouched stems must keep their contents */
+	for(uint32_t i = 0; i < 2 * CALL_FRAMES * (uint32_t)chans; ++i) {
+		s->stem_data[i] = 42.f;
+	}
+	xm_generate_stems(s->copies[1], nullptr, chans, s->stems, s->mixed, n);
+	xm_generate_samples_unmixed(s->copies[2], s->unmixed, n);
+	for(uint8_t c = 0; c < chans; ++c) {
+		for(uint16_t i = 0; i < 2 * n; ++i) {
+			float expected = s->unmixed[2 * c + i % 2
+			                            + 2 * chans * (i / 2)];
+			float got = s->stems[c][i];
+			if(s->mixed[c] ? got != expected
+			   : expected != 0.f || (got != 0.f && got != 42.f)) {
+				fprintf(stderr, "Stem of channel %u differs\n",
+				        c + 1);
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+static int stems_eq(xm_context_t* ctx) {
+	uint8_t chans = xm_get_number_of_channels(ctx);
+	struct stems_check_s s = { .ctx = ctx };
+	char* bufs[3];
+	for(uint8_t i = 0; i < 3; ++i) {
+		s.copies[i] = copy_context(ctx, 48000, bufs + i);
+		if(s.copies[i] == NULL) return 1;
+	}
+
+	/* Odd channels are muted in ctx, and left out of the only stem in
+	   copies[0] */
+	for(uint8_t c = 0; c < chans; ++c) {
+		s.groups[c] = (c % 2) ? 1 : 0;
+		if(c % 2) xm_mute_channel(ctx, (uint8_t)(c + 1), true);
+	}
+
+	s.stem_data = malloc(sizeof(float) * 2 * CALL_FRAMES * chans);
+	s.unmixed = malloc(sizeof(float) * 2 * CALL_FRAMES * chans);
+	if(s.stem_data == NULL || s.unmixed == NULL) return 1;
+	for(uint8_t c = 0; c < chans; ++c) {
+		s.stems[c] = s.stem_data + 2 * CALL_FRAMES * c;
+	}
+
+	int ret = play_eq(ctx, check_stems, &s, "stems");
+
+	free(s.unmixed);
+	free(s.stem_data);
+	for(uint8_t i = 0; i < 3; ++i) free(bufs[i]);
+	return ret;
+}
+
+struct streaming_check_s {
+	/* Played by play_eq() in floating point, ref plays along for the
+	   s16 calls */
+	xm_context_t* ctx;
+	xm_context_t* ref;
+	xm_context_t* st;
+	const xm_interpolation_table_t* table;
+	uint32_t calls;
+	char __pad[4];
+};
+
+static bool check_streaming(void* user, const float* frames, uint16_t n) {
+	struct streaming_check_s* s = user;
+	bool ok;
+	if(s->calls % 3 == 2) {
+		int16_t s16[2 * CALL_FRAMES], s16_st[2 * CALL_FRAMES];
+		xm_generate_samples_s16(s->ref, s16, n);
+		xm_generate_samples_s16(s->st, s16_st, n);
+		ok = memcmp(s16, s16_st, sizeof(int16_t) * 2 * n) == 0;
+		if(!ok) fprintf(stderr, "s16 samples differ\n");
+	} else {
+		float ref[2 * CALL_FRAMES];
+		xm_generate_samples(s->ref, ref, n);
+		ok = check_context(s->st, frames, n);
+	}
+
+	/* Switch interpolation every few calls, the same way in all
+	   contexts */
+	if(++s->calls % 16 == 0) {
+		const xm_interpolation_table_t* t = (s->calls / 16) % 2
+			? s->table : NULL;
+		xm_set_interpolation_table(s->ctx, t);
+		xm_set_interpolation_table(s->ref, t);
+		xm_set_interpolation_table(s->st, t);
+	}
+	return ok;
+}
+
+static int streaming_eq(xm_context_t* ctx, const char* data,
+                        uint32_t length) {
+	xm_prescan_data_t* p = alloca(XM_PRESCAN_DATA_SIZE);
+	if(!xm_prescan_module_streaming(read_short, (void*)data, length, 1,
+	                                p)) {
+		fprintf(stderr, "Streaming prescan failed\n");
+		return 1;
+	}
+	if(xm_size_for_context(p) >= xm_context_size(ctx)) {
+		fprintf(stderr, "Streamed context is not smaller: %u vs %u\n",
+		        xm_size_for_context(p), xm_context_size(ctx));
+		return 1;
+	}
+	char* pool = malloc(xm_size_for_context(p));
+	char* buf;
+	struct streaming_check_s s = {
+		.ctx = ctx,
+		.ref = copy_context(ctx, 48000, &buf),
+	};
+	if(pool == NULL || s.ref == NULL) return 1;
+	s.st = xm_create_context_from_callback(pool, p, read_short, (void*)data,
+	                                       length, 48000);
+	char* windows = malloc(xm_size_for_sample_provider(s.st));
+	char* table_buf = malloc(xm_size_for_interpolation_table(
+		                         XM_INTERPOLATION_SINC));
+	if(windows == NULL || table_buf == NULL) return 1;
+	xm_set_sample_provider(s.st, provide_from_context, ctx, windows);
+	s.table = xm_build_interpolation_table(XM_INTERPOLATION_SINC,
+	                                       table_buf);
+
+	/* Streamed voices have no ghosts, the only difference allowed */
+	xm_set_quality(ctx, XM_QUALITY_LINEAR_INTERPOLATION);
+	xm_set_quality(s.ref, XM_QUALITY_LINEAR_INTERPOLATION);
+	xm_set_quality(s.st, XM_QUALITY_LINEAR_INTERPOLATION);
+
+	int ret = play_eq(ctx, check_streaming, &s, "streamed context");
+
+	free(table_buf);
+	free(windows);
+	free(buf);
+	free(pool);
+	return ret;
+}
+
+/* @returns the rows found by xm_analyze_timeline() in a copy of ctx, for the
+   caller to free, or NULL on failure */
+static xm_timeline_row_t* analyze_copy(xm_context_t* ctx, uint32_t* num_rows,
+                                       uint32_t* length) {
+	char* buf;
+	xm_context_t* copy = copy_context(ctx, 48000, &buf);
+	if(copy == NULL) return NULL;
+	*length = xm_analyze_timeline(copy, NULL, 0, num_rows);
+	free(buf);
+
+	/* Again with a fresh copy, to get the rows */
+	xm_timeline_row_t* rows = malloc(sizeof(xm_timeline_row_t) * *num_rows);
+	copy = copy_context(ctx, 48000, &buf);
+	if(rows == NULL || copy == NULL
+	   || xm_analyze_timeline(copy, rows, *num_rows, NULL) != *length) {
+		free(rows);
+		rows = NULL;
+	}
+	free(buf);
+	return rows;
+}
+
+static int timeline_eq(xm_context_t* ctx) {
+	uint32_t num_rows, length;
+	xm_timeline_row_t* rows = analyze_copy(ctx, &num_rows, &length);
+	if(rows == NULL) return 1;
+	int ret = play_timeline(ctx, rows, num_rows, length);
+	free(rows);
+	return ret;
+}
+
+static int play_timeline(xm_context_t* ctx, const xm_timeline_row_t* rows,
+                         uint32_t num_rows, uint32_t length) {
+	/* Play up to the first sample of every row, and check that the row
+	   was just played. Rows followed by a jump or a pattern change are
+	   skipped, xm_get_position() doesn't report those as expected. */
+	float frames[2 * 1000];
+	uint32_t position = 0;
+	xm_set_max_loop_count(ctx, 1);
+	for(uint32_t i = 0; i + 1 < num_rows; ++i) {
+		while(position <= rows[i].position) {
+			uint32_t n = rows[i].position + 1 - position;
+			if(n > 1000) n = 1000;
+			position += xm_render(ctx, frames, n);
+		}
+		if(rows[i + 1].pattern_index != rows[i].pattern_index
+		   || rows[i + 1].row != rows[i].row + 1) continue;
+
+		uint8_t pot, row, bpm, tempo;
+		xm_get_position(ctx, &pot, NULL, &row, NULL);
+		xm_get_playing_speed(ctx, &bpm, &tempo);
+		if(pot == rows[i].pattern_index && row == rows[i].row
+		   && bpm == rows[i].bpm && tempo == rows[i].tempo) continue;
+		fprintf(stderr, "Mismatch at row %u: %u:%u vs %u:%u\n", i,
+		        rows[i].pattern_index, rows[i].row, pot, row);
+		return 1;
+	}
+
+	uint32_t n;
+	while((n = xm_render(ctx, frames, 1000))) position += n;
+	if(position != length) {
+		fprintf(stderr, "Length mismatch: %u vs %u\n", length, position);
+		return 1;
+	}
+
+	/* The tick that reached the loop limit is not rendered, nor counted */
+	uint32_t generated;
+	xm_get_position(ctx, NULL, NULL, NULL, &generated);
+	if(generated != position) {
+		fprintf(stderr, "Rendered %u samples, but generated %u\n",
+		        position, generated);
+		return 1;
+	}
+	return 0;
+}
+
+static int events_eq(xm_context_t* ctx) {
+	uint32_t num_rows, length;
+	xm_timeline_row_t* rows = analyze_copy(ctx, &num_rows, &length);
+	if(rows == NULL) return 1;
+	int ret = play_events(ctx, rows, num_rows, length);
+	free(rows);
+	return ret;
+}
+
+static int play_events(xm_context_t* ctx, const xm_timeline_row_t* rows,
+                       uint32_t num_rows, uint32_t length) {
+	#define EVENTS_LENGTH 256
+	xm_event_t events[EVENTS_LENGTH];
+	xm_set_event_buffer(ctx, events, EVENTS_LENGTH);
+	xm_set_max_loop_count(ctx, 1);
+
+	float frames[2 * 1000];
+	uint32_t position = 0, read = 0, row = 0, n;
+	/* Position of the latest note on event of each channel in the
+	   current call */
+	uint32_t note_on[256];
+	bool triggered[256];
+	for(uint16_t size = 1; (n = xm_render(ctx, frames, size));
+	    size = (size + 77) % 1000 + 1) {
+		uint32_t written = xm_get_events_written(ctx);
+		if(written - read > EVENTS_LENGTH) {
+			fprintf(stderr, "Event ring overflow\n");
 			return 1;
 		}
+		__builtin_memset(triggered, 0, sizeof(triggered));
+
+		for(; read != written; ++read) {
+			const xm_event_t* e = events + read % EVENTS_LENGTH;
+			uint32_t at = position + e->offset;
+			/* Events at offset n are from the tick that reached
+			   the loop limit, which starts right after the
+			   rendered samples but is not rendered itself */
+			if(e->offset > n) {
+				fprintf(stderr, "Event past the end of the "
+				        "generated samples\n");
+				return 1;
+			}
+
+			if(e->type == XM_EVENT_NOTE_ON) {
+				note_on[e->channel] = at;
+				triggered[e->channel] = true;
+			}
+
+			if(e->type != XM_EVENT_ROW
+			   || (row == num_rows && at == length)) continue;
+			if(row < num_rows && rows[row].position == at
+			   && rows[row].pattern_index == e->pattern_index
+			   && rows[row].row == e->row) {
+				++row;
+				continue;
+			}
+			if(row == num_rows) {
+				fprintf(stderr, "Row %u:%u at %u, past the "
+				        "last row\n", e->pattern_index, e->row,
+				        at);
+				return 1;
+			}
+			fprintf(stderr, "Mismatch at row %u: %u:%u at %u vs "
+			        "%u:%u at %u\n", row, rows[row].pattern_index,
+			        rows[row].row, rows[row].position,
+			        e->pattern_index, e->row, at);
+			return 1;
+		}
+
+		for(uint8_t c = 1; c <= xm_get_number_of_channels(ctx); ++c) {
+			if(!triggered[c]) continue;
+			uint32_t latest =
+				xm_get_latest_trigger_of_channel(ctx, c);
+			if(latest == note_on[c]) continue;
+			fprintf(stderr, "Note on event at %u, but channel %u "
+			        "was last triggered at %u\n", note_on[c], c,
+			        latest);
+			return 1;
+		}
+		position += n;
 	}
 
+	if(row != num_rows || position != length) {
+		fprintf(stderr, "Got %u rows out of %u\n", row, num_rows);
+		return 1;
+	}
 	return 0;
 }
 
+static int interpolation_eq(xm_context_t* ctx) {
+	if(interpolation_mode_eq(ctx, XM_INTERPOLATION_CUBIC)
+	   || interpolation_mode_eq(ctx, XM_INTERPOLATION_SINC)) {
+		return 1;
+	}
+
+	/* Switch to sinc interpolation, and back to the default */
+	char* buf;
+	xm_context_t* copy = copy_context(ctx, 48000, &buf);
+	char* table_buf = malloc(
+		xm_size_for_interpolation_table(XM_INTERPOLATION_SINC));
+	if(copy == NULL || table_buf == NULL) return 1;
+	xm_set_interpolation_table(copy, xm_build_interpolation_table(
+		                           XM_INTERPOLATION_SINC, table_buf));
+	xm_set_interpolation_table(copy, NULL);
+	int ret = contexts_eq(ctx, copy, "context after switching back to the "
+	                      "default interpolation");
+
+	free(table_buf);
+	free(buf);
+	return ret;
+}
+
+static int interpolation_mode_eq(xm_context_t* ctx, xm_interpolation_t mode) {
+	char* table_buf = malloc(xm_size_for_interpolation_table(mode));
+	if(table_buf == NULL) return 1;
+	const xm_interpolation_table_t* table =
+		xm_build_interpolation_table(mode, table_buf);
+	char* buf;
+	xm_context_t* copy = copy_context(ctx, 48000, &buf);
+	if(table == NULL || copy == NULL) return 1;
+
+	/* Render the whole module with calls of varying sizes */
+	float frames[2 * CALL_FRAMES], frames_ref[2 * CALL_FRAMES];
+	xm_set_interpolation_table(copy, table);
+	xm_set_max_loop_count(copy, 1);
+	float* out = NULL;
+	uint32_t length = 0, n;
+	for(uint16_t size = 1; (n = xm_render(copy, frames, size));
+	    size = (uint16_t)((size + 77) % CALL_FRAMES + 1)) {
+		float* p = realloc(out, sizeof(float) * 2 * (length + n));
+		if(p == NULL) return 1;
+		out = p;
+		memcpy(out + 2 * length, frames, sizeof(float) * 2 * n);
+		length += n;
+	}
+	free(buf);
+
+	/* Then compare it with the default interpolation, and with calls of
+	   a fixed size */
+	char* ref_buf;
+	xm_context_t* ref = copy_context(ctx, 48000, &ref_buf);
+	copy = copy_context(ctx, 48000, &buf);
+	if(ref == NULL || copy == NULL) return 1;
+	xm_set_max_loop_count(ref, 1);
+	xm_set_interpolation_table(copy, table);
+	xm_set_max_loop_count(copy, 1);
+	double signal = 0., error = 0.;
+	uint32_t position = 0;
+	int ret = 0;
+	while(ret == 0 && (n = xm_render(copy, frames, CALL_FRAMES))) {
+		if(xm_render(ref, frames_ref, CALL_FRAMES) != n
+		   || position + n > length) {
+			fprintf(stderr, "Length mismatch\n");
+			ret = 1;
+		} else if(memcmp(frames, out + 2 * position,
+		                 sizeof(float) * 2 * n)) {
+			fprintf(stderr, "Interpolation mode %u: mismatch "
+			        "between calls of different sizes\n", mode);
+			print_position(copy);
+			ret = 1;
+		}
+		for(uint32_t i = 0; i < 2 * n; ++i) {
+			double d = (double)frames[i] - (double)frames_ref[i];
+			signal += (double)frames_ref[i] * (double)frames_ref[i];
+			error += d * d;
+		}
+		position += n;
+	}
+	/* This is a really loose bound, expect about -40dB for most
+	   modules */
+	if(ret == 0 && (position != length || error == 0.
+	                || error > signal / 100.)) {
+		fprintf(stderr, "Interpolation mode %u: error %g for signal "
+		        "%g\n", mode, error, signal);
+		ret = 1;
+	}
+
+	free(out);
+	free(ref_buf);
+	free(buf);
+	free(table_buf);
+	return ret;
+}
+
 static uint16_t modal_interpeak_distance(const float* data, uint16_t count,
                                          uint16_t stride) {
 	if(count < 3) return 0;